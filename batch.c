@@ -0,0 +1,237 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "terminal.h"
+#include "midi.h"
+#include "batch.h"
+
+void batch_init(ConfigBatch *b, unsigned int window,
+                unsigned int timeout_ms, unsigned int retries) {
+    b->window = window == 0 ? 1 : window;
+    b->retries = retries;
+    b->timeout_ns = (uint64_t)timeout_ms * 1000000;
+    batch_reset(b);
+}
+
+/* forget about a finished batch so a new one can be started */
+void batch_reset(ConfigBatch *b) {
+    b->state = BatchIdle;
+    b->count = 0;
+    b->in_flight = 0;
+    b->acked = 0;
+    b->failed = 0;
+    b->resent = 0;
+    b->start_ns = 0;
+    b->end_ns = 0;
+}
+
+/* queue a set message, it's sent by batch_poll().  A set for something
+ * already queued but not sent yet replaces it.  Adding to a finished batch
+ * starts a new one.
+ * returns 0 on success, -1 on failure */
+int batch_add(ConfigBatch *b, size_t size, const unsigned char *msg) {
+    BatchItem *item;
+    unsigned int i;
+
+    if(size > BATCH_MAX_MESSAGE || size < JS_CONFIG_VALUE + MIDI_SYSEX_TAIL ||
+       msg[JS_CMD] != JS_CONFIG_SET) {
+        term_print("Not a config set message.");
+        return(-1);
+    }
+
+    if(b->state == BatchCommitted || b->state == BatchFailed) {
+        batch_reset(b);
+    }
+
+    item = NULL;
+    for(i = 0; i < b->count; i++) {
+        if(b->item[i].state == BatchItemQueued &&
+           memcmp(b->item[i].CC.name, &(msg[JS_CONFIG_NAME]), JS_CONFIG_NAME_LEN) == 0) {
+            item = &(b->item[i]);
+            break;
+        }
+    }
+    if(item == NULL) {
+        if(b->count == BATCH_MAX_ITEMS) {
+            term_print("Too many config sets in one batch.");
+            return(-1);
+        }
+        item = &(b->item[b->count]);
+        b->count++;
+        memcpy(item->CC.name, &(msg[JS_CONFIG_NAME]), JS_CONFIG_NAME_LEN);
+        item->state = BatchItemQueued;
+        item->tries = 0;
+    }
+    memcpy(item->msg, msg, size);
+    item->size = size;
+
+    if(b->state == BatchIdle) {
+        b->state = BatchRunning;
+        b->start_ns = midi_time_ns();
+    }
+
+    return(0);
+}
+
+/* match a set return to what's waiting on it.
+ * returns 1 if it was for this batch, 0 if not */
+int batch_ack(ConfigBatch *b, size_t size, const unsigned char *msg) {
+    BatchItem *item;
+    unsigned int i;
+
+    if(b->state != BatchRunning || size < JS_CONFIG_VALUE + MIDI_SYSEX_TAIL) {
+        return(0);
+    }
+
+    /* the oldest send of the name is what this answers */
+    for(i = 0; i < b->count; i++) {
+        item = &(b->item[i]);
+        if(item->state == BatchItemSent &&
+           memcmp(item->CC.name, &(msg[JS_CONFIG_NAME]), JS_CONFIG_NAME_LEN) == 0) {
+            break;
+        }
+    }
+    if(i == b->count) {
+        return(0);
+    }
+
+    b->in_flight--;
+    /* everything from the type on should come back as it was sent */
+    if(size == item->size &&
+       memcmp(&(msg[JS_CONFIG_TYPE]), &(item->msg[JS_CONFIG_TYPE]),
+              size - JS_CONFIG_TYPE - MIDI_SYSEX_TAIL) == 0) {
+        item->state = BatchItemAcked;
+        b->acked++;
+    } else {
+        item->state = BatchItemRejected;
+        b->failed++;
+    }
+
+    return(1);
+}
+
+/* send what can be sent and deal with anything that's been waiting too
+ * long, call whenever something might have changed or the timeout from
+ * batch_timeout_ms() has passed */
+BatchState batch_poll(ConfigBatch *b) {
+    uint64_t now;
+    BatchItem *item;
+    unsigned int i;
+
+    if(b->state != BatchRunning) {
+        return(b->state);
+    }
+
+    now = midi_time_ns();
+
+    for(i = 0; i < b->count; i++) {
+        item = &(b->item[i]);
+        if(item->state == BatchItemSent && now - item->sent_ns >= b->timeout_ns) {
+            if(item->tries > b->retries) {
+                item->state = BatchItemTimedOut;
+                b->in_flight--;
+                b->failed++;
+                continue;
+            }
+            /* send it again, in place */
+            if(midi_write_event(item->size, item->msg) < 0) {
+                term_print("Failed to write event.");
+            }
+            item->sent_ns = now;
+            item->tries++;
+            b->resent++;
+        }
+    }
+
+    for(i = 0; i < b->count && b->in_flight < b->window; i++) {
+        item = &(b->item[i]);
+        if(item->state != BatchItemQueued) {
+            continue;
+        }
+        /* a failed write is just retried after the timeout like a lost one */
+        if(midi_write_event(item->size, item->msg) < 0) {
+            term_print("Failed to write event.");
+        }
+        item->state = BatchItemSent;
+        item->sent_ns = now;
+        item->tries = 1;
+        b->in_flight++;
+    }
+
+    if(b->acked + b->failed == b->count) {
+        b->state = b->failed == 0 ? BatchCommitted : BatchFailed;
+        b->end_ns = now;
+    }
+
+    return(b->state);
+}
+
+/* milliseconds until batch_poll() needs to be called again, or -1 for
+ * whenever */
+int batch_timeout_ms(ConfigBatch *b) {
+    uint64_t now;
+    uint64_t first = UINT64_MAX;
+    unsigned int i;
+
+    if(b->state != BatchRunning) {
+        return(-1);
+    }
+
+    for(i = 0; i < b->count; i++) {
+        if(b->item[i].state == BatchItemSent &&
+           b->item[i].sent_ns + b->timeout_ns < first) {
+            first = b->item[i].sent_ns + b->timeout_ns;
+        }
+    }
+    if(first == UINT64_MAX) {
+        return(-1);
+    }
+
+    now = midi_time_ns();
+    if(first <= now) {
+        return(0);
+    }
+
+    /* round up so it's not woken up just before */
+    return((first - now + 999999) / 1000000);
+}
+
+void batch_report(ConfigBatch *b) {
+    unsigned int i;
+
+    if(b->state == BatchCommitted) {
+        term_print("Committed %u config set(s) in %.1f ms.",
+                   b->count, (b->end_ns - b->start_ns) / 1000000.0);
+        return;
+    } else if(b->state != BatchFailed) {
+        return;
+    }
+
+    term_print("%u of %u config set(s) failed:", b->failed, b->count);
+    for(i = 0; i < b->count; i++) {
+        if(b->item[i].state == BatchItemRejected) {
+            term_print("  %.8s: guitar kept a different value", b->item[i].CC.name);
+        } else if(b->item[i].state == BatchItemTimedOut) {
+            term_print("  %.8s: no answer after %u tries",
+                       b->item[i].CC.name, b->item[i].tries);
+        }
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "json_schema.h"
+
+/* config sets which are sent and followed up on as a group.  Sets are sent
+ * back to back, up to window of them waiting on their acks at once, and
+ * each ack (the set return) is matched to its set by name.  A set with no
+ * ack after the timeout is sent again, up to retries times, then fails.
+ * Once nothing is left waiting the batch is committed if every set was
+ * acked with the value asked for, otherwise it failed. */
+
+#define BATCH_MAX_ITEMS (1024)
+/* longest set message, numeric values are at most 10 bytes packed */
+#define BATCH_MAX_MESSAGE (32)
+
+#define BATCH_DEFAULT_WINDOW (8)
+#define BATCH_DEFAULT_TIMEOUT_MS (500)
+#define BATCH_DEFAULT_RETRIES (2)
+
+typedef enum {
+    BatchItemQueued = 0,
+    BatchItemSent,
+    BatchItemAcked,
+    /* acked, but with some other value */
+    BatchItemRejected,
+    BatchItemTimedOut
+} BatchItemState;
+
+typedef enum {
+    BatchIdle = 0,
+    BatchRunning,
+    BatchCommitted,
+    BatchFailed
+} BatchState;
+
+typedef struct {
+    JsName CC;
+    BatchItemState state;
+    unsigned int tries;
+    uint64_t sent_ns;
+    size_t size;
+    unsigned char msg[BATCH_MAX_MESSAGE];
+} BatchItem;
+
+typedef struct {
+    unsigned int window;
+    unsigned int retries;
+    uint64_t timeout_ns;
+
+    BatchState state;
+    unsigned int count;
+    unsigned int in_flight;
+    unsigned int acked;
+    unsigned int failed;
+    unsigned int resent;
+    uint64_t start_ns;
+    uint64_t end_ns;
+
+    BatchItem item[BATCH_MAX_ITEMS];
+} ConfigBatch;
+
+void batch_init(ConfigBatch *b, unsigned int window,
+                unsigned int timeout_ms, unsigned int retries);
+int batch_add(ConfigBatch *b, size_t size, const unsigned char *msg);
+int batch_ack(ConfigBatch *b, size_t size, const unsigned char *msg);
+BatchState batch_poll(ConfigBatch *b);
+int batch_timeout_ms(ConfigBatch *b);
+void batch_report(ConfigBatch *b);
+void batch_reset(ConfigBatch *b);
+
+#endif
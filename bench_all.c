@@ -0,0 +1,425 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* times the paths every event or value goes through and prints one line per
+ * benchmark, tab separated so it's easy to keep and compare between builds:
+ * name  ns/op  allocs/op  ops
+ * allocations are counted by wrapping malloc, calloc and realloc at link
+ * time, so only ones made directly by this program's code are seen.
+ * USAGE: bench_all [schema] [min ms per benchmark] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "terminal.h"
+#include "midi.h"
+#include "midi_ring.h"
+#include "json_schema.h"
+#include "packed_values.h"
+#include "guitar.h"
+#include "instrument.h"
+
+#define BENCH_DEFAULT_SCHEMA "test.json"
+#define BENCH_DEFAULT_MIN_MS (200)
+#define BENCH_MAX_RESULTS (64)
+#define BENCH_MAX_NAME (32)
+/* values cycled through by the packed value benchmarks */
+#define BENCH_VALUES (64)
+
+typedef struct {
+    char name[BENCH_MAX_NAME];
+    double ns;
+    double allocs;
+    uint64_t ops;
+} BenchResult;
+
+typedef void (*BenchFunc)(uint64_t n, void *arg);
+
+static BenchResult results[BENCH_MAX_RESULTS];
+static unsigned int result_count = 0;
+static uint64_t min_ns;
+
+/* anything computed is added to this so it isn't optimized away */
+static volatile uint64_t sink;
+
+static unsigned long long int allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    allocs++;
+    return(__real_malloc(size));
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    allocs++;
+    return(__real_calloc(nmemb, size));
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    allocs++;
+    return(__real_realloc(ptr, size));
+}
+
+/* run it with more and more ops until it takes long enough to be timed */
+static void bench_run(const char *name, BenchFunc func, void *arg) {
+    BenchResult *r;
+    uint64_t n = 1;
+    uint64_t start;
+    uint64_t ns;
+    unsigned long long int start_allocs;
+
+    if(result_count == BENCH_MAX_RESULTS) {
+        fprintf(stderr, "Too many benchmarks, %s skipped.\n", name);
+        return;
+    }
+    r = &(results[result_count]);
+    result_count++;
+
+    for(;;) {
+        start_allocs = allocs;
+        start = midi_time_ns();
+        func(n, arg);
+        ns = midi_time_ns() - start;
+
+        if(ns >= min_ns) {
+            break;
+        }
+        /* aim a bit past it so it's usually done on the next try */
+        if(ns < min_ns / 100) {
+            n *= 100;
+        } else {
+            n = n * min_ns / ns * 6 / 5 + 1;
+        }
+    }
+
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->ns = (double)ns / n;
+    r->allocs = (double)(allocs - start_allocs) / n;
+    r->ops = n;
+}
+
+typedef struct {
+    JsType type;
+    unsigned char buf[BENCH_VALUES * PACKED_MAX_SIZE];
+    uint64_t val[BENCH_VALUES];
+} BenchPacked;
+
+static void bench_packed_decode(uint64_t n, void *arg) {
+    BenchPacked *p = arg;
+    const JsTypeInfo *info = &(JS_TYPE_INFO[p->type]);
+    uint64_t sum = 0;
+    uint64_t i;
+
+    for(i = 0; i < n; i++) {
+        sum += info->decode(&(p->buf[(i % BENCH_VALUES) * info->size]));
+    }
+    sink += sum;
+}
+
+static void bench_packed_encode(uint64_t n, void *arg) {
+    BenchPacked *p = arg;
+    const JsTypeInfo *info = &(JS_TYPE_INFO[p->type]);
+    uint64_t i;
+
+    for(i = 0; i < n; i++) {
+        info->encode(p->val[i % BENCH_VALUES], &(p->buf[(i % BENCH_VALUES) * info->size]));
+    }
+    sink += p->buf[0];
+}
+
+typedef struct {
+    size_t size;
+    unsigned char *buf;
+} BenchSchema;
+
+static void bench_parse_schema(uint64_t n, void *arg) {
+    BenchSchema *s = arg;
+    JsInfo *js;
+    uint64_t i;
+
+    for(i = 0; i < n; i++) {
+        js = js_init();
+        if(js == NULL) {
+            return;
+        }
+        if(js_parse_json_schema(js, s->size, s->buf) < 0) {
+            fprintf(stderr, "Failed to parse schema.\n");
+        }
+        sink += js->config_count;
+        js_free(js);
+    }
+}
+
+static void bench_config_find(uint64_t n, void *arg) {
+    JsInfo *js = arg;
+    uint64_t sum = 0;
+    uint64_t i;
+
+    for(i = 0; i < n; i++) {
+        sum += (uintptr_t)js_config_find(js, js->config[i % js->config_count].CC.name);
+    }
+    sink += sum;
+}
+
+typedef struct {
+    EventRB rb;
+    size_t size;
+    unsigned char buf[MIDI_MAX_BUFFER_SIZE];
+} BenchRing;
+
+/* one event in and back out, like the process callback then the main loop */
+static void bench_ring(uint64_t n, void *arg) {
+    BenchRing *r = arg;
+    midi_timestamp ts = {0, 0};
+    midi_event *ev;
+    uint64_t i;
+
+    for(i = 0; i < n; i++) {
+        if(_midi_add_event(&(r->rb), r->size, r->buf, &ts) < 0) {
+            fprintf(stderr, "Failed to add event.\n");
+            return;
+        }
+        ev = _midi_get_event(&(r->rb));
+        sink += ev->buffer[0];
+        _midi_consume_event(&(r->rb));
+    }
+}
+
+static void bench_num_to_note(uint64_t n, void *arg) {
+    char buf[8];
+    uint64_t sum = 0;
+    uint64_t i;
+
+    for(i = 0; i < n; i++) {
+        sum += midi_num_to_note(sizeof(buf), buf, i & 127, i & 128);
+    }
+    sink += sum;
+}
+
+static void bench_count_lines(uint64_t n, void *arg) {
+    const char *str = arg;
+    int len = strlen(str);
+    uint64_t sum = 0;
+    uint64_t i;
+
+    for(i = 0; i < n; i++) {
+        sum += term_count_lines(80, len, str);
+    }
+    sink += sum;
+}
+
+static void bench_note_on_off(uint64_t n, void *arg) {
+    GuitarState *g = arg;
+    uint64_t i;
+
+    for(i = 0; i < n; i++) {
+        guitar_note_on(g, (i % 6) + 1, 40 + (i % 24), 100);
+        guitar_note_off(g, (i % 6) + 1, 40 + (i % 24), 0);
+    }
+}
+
+static void bench_bend(uint64_t n, void *arg) {
+    GuitarState *g = arg;
+    uint64_t i;
+
+    for(i = 0; i < n; i++) {
+        guitar_bend(g, (i % 6) + 1, (int)(i % 8192) - 4096);
+    }
+}
+
+/* the file wrapped up like it comes from the guitar */
+static unsigned char *load_schema(const char *path, size_t *size) {
+    FILE *in;
+    long len;
+    unsigned char *buf;
+
+    in = fopen(path, "rb");
+    if(in == NULL) {
+        fprintf(stderr, "Failed to open %s.\n", path);
+        return(NULL);
+    }
+    if(fseek(in, 0, SEEK_END) < 0 ||
+       (len = ftell(in)) < 0 ||
+       fseek(in, 0, SEEK_SET) < 0) {
+        fprintf(stderr, "Failed to get size of %s.\n", path);
+        fclose(in);
+        return(NULL);
+    }
+
+    *size = JS_SCHEMA_START + len + MIDI_SYSEX_TAIL;
+    buf = malloc(*size);
+    if(buf == NULL) {
+        fprintf(stderr, "Failed to allocate memory!\n");
+        fclose(in);
+        return(NULL);
+    }
+    memset(buf, 0, JS_SCHEMA_START);
+    buf[MIDI_CMD] = MIDI_SYSEX;
+    buf[MIDI_SYSEX_VENDOR] = JS_VENDOR_0;
+    buf[MIDI_SYSEX_VENDOR+1] = JS_VENDOR_1;
+    buf[MIDI_SYSEX_VENDOR+2] = JS_VENDOR_2;
+    buf[JS_CMD] = JS_SCHEMA_RETURN;
+    if(fread(&(buf[JS_SCHEMA_START]), 1, len, in) != (size_t)len) {
+        fprintf(stderr, "Failed to read %s.\n", path);
+        free(buf);
+        fclose(in);
+        return(NULL);
+    }
+    buf[*size-2] = MIDI_SYSEX_DUMMY_LEN;
+    buf[*size-1] = MIDI_SYSEX_END;
+
+    fclose(in);
+
+    return(buf);
+}
+
+int main(int argc, char **argv) {
+    const char *path = BENCH_DEFAULT_SCHEMA;
+    char name[BENCH_MAX_NAME];
+    BenchPacked packed;
+    BenchSchema schema;
+    BenchRing *ring;
+    JsInfo *js;
+    GuitarState *g;
+    const Instrument *inst;
+    int stdout_fd;
+    int null_fd;
+    unsigned int i;
+    int t;
+    int ret = EXIT_FAILURE;
+
+    min_ns = (uint64_t)BENCH_DEFAULT_MIN_MS * 1000000;
+    if(argc > 1) {
+        path = argv[1];
+    }
+    if(argc > 2) {
+        min_ns = (uint64_t)atoi(argv[2]) * 1000000;
+        if(min_ns == 0) {
+            min_ns = 1000000;
+        }
+    }
+
+    if(term_setup(1) < 0) {
+        return(EXIT_FAILURE);
+    }
+
+    for(t = 0; t < JsTypeMax; t++) {
+        if(JS_TYPE_INFO[t].decode == NULL) {
+            continue;
+        }
+        packed.type = t;
+        for(i = 0; i < BENCH_VALUES; i++) {
+            packed.val[i] = (uint64_t)i * 0x9E3779B97F4A7C15ull;
+            JS_TYPE_INFO[t].encode(packed.val[i], &(packed.buf[i * JS_TYPE_INFO[t].size]));
+        }
+        snprintf(name, sizeof(name), "packed_decode_%s", JS_TYPE_INFO[t].short_name);
+        bench_run(name, bench_packed_decode, &packed);
+        snprintf(name, sizeof(name), "packed_encode_%s", JS_TYPE_INFO[t].short_name);
+        bench_run(name, bench_packed_encode, &packed);
+    }
+
+    schema.buf = load_schema(path, &(schema.size));
+    if(schema.buf == NULL) {
+        goto error_term_cleanup;
+    }
+    bench_run("js_parse_json_schema", bench_parse_schema, &schema);
+
+    js = js_init();
+    if(js == NULL) {
+        goto error_free_schema;
+    }
+    if(js_parse_json_schema(js, schema.size, schema.buf) < 0) {
+        fprintf(stderr, "Failed to parse %s.\n", path);
+        goto error_free_js;
+    }
+    bench_run("js_config_find", bench_config_find, js);
+
+    ring = malloc(sizeof(BenchRing));
+    if(ring == NULL || _midi_rb_init(&(ring->rb)) < 0) {
+        fprintf(stderr, "Failed to allocate memory!\n");
+        free(ring);
+        goto error_free_js;
+    }
+    ring->size = 3;
+    ring->buf[0] = MIDI_CMD_NOTE_ON;
+    ring->buf[1] = 64;
+    ring->buf[2] = 100;
+    bench_run("midi_ring_note", bench_ring, ring);
+    ring->size = 256;
+    memset(ring->buf, 0x55, ring->size);
+    ring->buf[0] = MIDI_SYSEX;
+    ring->buf[ring->size - 1] = MIDI_SYSEX_END;
+    bench_run("midi_ring_sysex_256", bench_ring, ring);
+    _midi_rb_free(&(ring->rb));
+    free(ring);
+
+    bench_run("midi_num_to_note", bench_num_to_note, NULL);
+    bench_run("term_count_lines", bench_count_lines,
+              "Guitar state ready in 21.2 ms, 6 of 6 categories read.  "
+              "WARNING: Entered value -5 is out of reported range 0 to 360!  "
+              "\xE2\x99\xAF sharp and \xE2\x99\xAD flat, the rest is just "
+              "here to make it wrap a couple of times at 80 columns.");
+
+    inst = instrument_find(INSTRUMENT_DEFAULT);
+    g = guitar_init(inst->strings, inst->tuning);
+    if(g == NULL) {
+        goto error_free_js;
+    }
+    /* each channel is a string in MPE mode.  These print what happened in
+     * print mode, which is what's timed, to nowhere */
+    fflush(stdout);
+    stdout_fd = dup(STDOUT_FILENO);
+    null_fd = open("/dev/null", O_WRONLY);
+    if(stdout_fd < 0 || null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "Failed to redirect output.\n");
+        free(g);
+        goto error_free_js;
+    }
+    close(null_fd);
+    guitar_set_mpe_mode(g, 1);
+    bench_run("guitar_note_on_off", bench_note_on_off, g);
+    bench_run("guitar_bend", bench_bend, g);
+    fflush(stdout);
+    dup2(stdout_fd, STDOUT_FILENO);
+    close(stdout_fd);
+    free(g);
+
+    printf("# name\tns/op\tallocs/op\tops\n");
+    for(i = 0; i < result_count; i++) {
+        printf("%s\t%.2f\t%.2f\t%llu\n", results[i].name, results[i].ns,
+               results[i].allocs, (unsigned long long int)results[i].ops);
+    }
+
+    ret = EXIT_SUCCESS;
+
+error_free_js:
+    js_free(js);
+error_free_schema:
+    free(schema.buf);
+error_term_cleanup:
+    term_cleanup();
+
+    return(ret);
+}
@@ -0,0 +1,369 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* checks the packed value codec against the one value at a time functions
+ * it replaced, then times both of them.
+ * USAGE: bench_packed [values] [-q]
+ * -q skips the exhaustive 32 bit check, which takes a while */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "packed_values.h"
+
+#define BENCH_DEFAULT_VALUES (1 << 20)
+#define BENCH_RANDOM_CHECKS (1 << 24)
+
+/* the old per width functions, out of line like they were */
+__attribute__((noinline)) static uint8_t ref_decode_uint8(const unsigned char *buf) {
+    return(((buf[0] & 0x7F) << 1) |
+           ((buf[1] & 0x40) >> 6));
+}
+
+__attribute__((noinline)) static uint16_t ref_decode_uint16(const unsigned char *buf) {
+    return((((uint16_t)buf[0] & 0x7F) << 9) |
+           (((uint16_t)buf[1] & 0x7F) << 2) |
+           (((uint16_t)buf[2] & 0x60) >> 5));
+}
+
+__attribute__((noinline)) static uint32_t ref_decode_uint32(const unsigned char *buf) {
+    return((((uint32_t)buf[0] & 0x7F) << 25) |
+           (((uint32_t)buf[1] & 0x7F) << 18) |
+           (((uint32_t)buf[2] & 0x7F) << 11) |
+           (((uint32_t)buf[3] & 0x7F) <<  4) |
+           (((uint32_t)buf[4] & 0x78) >>  3));
+}
+
+__attribute__((noinline)) static uint64_t ref_decode_uint64(const unsigned char *buf) {
+    return((((uint64_t)buf[0] & 0x7F) << 57) |
+           (((uint64_t)buf[1] & 0x7F) << 50) |
+           (((uint64_t)buf[2] & 0x7F) << 43) |
+           (((uint64_t)buf[3] & 0x7F) << 36) |
+           (((uint64_t)buf[4] & 0x7F) << 29) |
+           (((uint64_t)buf[5] & 0x7F) << 22) |
+           (((uint64_t)buf[6] & 0x7F) << 15) |
+           (((uint64_t)buf[7] & 0x7F) <<  8) |
+           (((uint64_t)buf[8] & 0x7F) <<  1) |
+           (((uint64_t)buf[9] & 0x40) >>  6));
+}
+
+__attribute__((noinline)) static void ref_encode_uint8(uint8_t val, unsigned char *buf) {
+    buf[0] = (val >> 1) & 0x7F;
+    buf[1] = (val << 6) & 0x40;
+}
+
+__attribute__((noinline)) static void ref_encode_uint16(uint16_t val, unsigned char *buf) {
+    buf[0] = (val >> 9) & 0x7F;
+    buf[1] = (val >> 2) & 0x7F;
+    buf[2] = (val << 5) & 0x60;
+}
+
+__attribute__((noinline)) static void ref_encode_uint32(uint32_t val, unsigned char *buf) {
+    buf[0] = (val >> 25) & 0x7F;
+    buf[1] = (val >> 18) & 0x7F;
+    buf[2] = (val >> 11) & 0x7F;
+    buf[3] = (val >>  4) & 0x7F;
+    buf[4] = (val <<  3) & 0x78;
+}
+
+__attribute__((noinline)) static void ref_encode_uint64(uint64_t val, unsigned char *buf) {
+    buf[0] = (val >> 57) & 0x7F;
+    buf[1] = (val >> 50) & 0x7F;
+    buf[2] = (val >> 43) & 0x7F;
+    buf[3] = (val >> 36) & 0x7F;
+    buf[4] = (val >> 29) & 0x7F;
+    buf[5] = (val >> 22) & 0x7F;
+    buf[6] = (val >> 15) & 0x7F;
+    buf[7] = (val >>  8) & 0x7F;
+    buf[8] = (val >>  1) & 0x7F;
+    buf[9] = (val <<  6) & 0x40;
+}
+
+typedef struct {
+    unsigned int bits;
+    uint64_t (*ref_decode)(const unsigned char *buf);
+    void (*ref_encode)(uint64_t val, unsigned char *buf);
+} BenchWidth;
+
+static uint64_t ref_decode_8(const unsigned char *buf) { return(ref_decode_uint8(buf)); }
+static uint64_t ref_decode_16(const unsigned char *buf) { return(ref_decode_uint16(buf)); }
+static uint64_t ref_decode_32(const unsigned char *buf) { return(ref_decode_uint32(buf)); }
+static uint64_t ref_decode_64(const unsigned char *buf) { return(ref_decode_uint64(buf)); }
+static void ref_encode_8(uint64_t val, unsigned char *buf) { ref_encode_uint8(val, buf); }
+static void ref_encode_16(uint64_t val, unsigned char *buf) { ref_encode_uint16(val, buf); }
+static void ref_encode_32(uint64_t val, unsigned char *buf) { ref_encode_uint32(val, buf); }
+static void ref_encode_64(uint64_t val, unsigned char *buf) { ref_encode_uint64(val, buf); }
+
+const BenchWidth BENCH_WIDTHS[] = {
+    {8, ref_decode_8, ref_encode_8},
+    {16, ref_decode_16, ref_encode_16},
+    {32, ref_decode_32, ref_encode_32},
+    {64, ref_decode_64, ref_encode_64}
+};
+#define BENCH_WIDTH_COUNT (sizeof(BENCH_WIDTHS) / sizeof(BENCH_WIDTHS[0]))
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return(rng_state);
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static int fail(unsigned int bits, const char *what, uint64_t val) {
+    fprintf(stderr, "%u bit %s differs at %llu.\n",
+            bits, what, (unsigned long long int)val);
+    return(-1);
+}
+
+/* one value both ways against the old functions */
+static int check_value(const BenchWidth *w, uint64_t val) {
+    unsigned char ref[PACKED_MAX_SIZE];
+    unsigned char buf[PACKED_MAX_SIZE];
+    size_t size = PACKED_SIZE(w->bits);
+
+    w->ref_encode(val, ref);
+    encode_packed(val, buf, w->bits);
+    if(memcmp(ref, buf, size) != 0) {
+        return(fail(w->bits, "encode", val));
+    }
+    if(decode_packed(buf, w->bits) != val) {
+        return(fail(w->bits, "round trip", val));
+    }
+    if(w->bits < 64 &&
+       packed_sign_extend(val, w->bits) !=
+       (int64_t)(val | ((val >> (w->bits - 1)) ? ~0ull << w->bits : 0))) {
+        return(fail(w->bits, "sign extend", val));
+    }
+
+    return(0);
+}
+
+/* every possible input, including junk in the top bits, decodes the same */
+static int check_decode_all(const BenchWidth *w) {
+    unsigned char buf[PACKED_MAX_SIZE];
+    uint64_t i;
+    unsigned int j;
+    size_t size = PACKED_SIZE(w->bits);
+
+    for(i = 0; i < (1ull << (size * 8)); i++) {
+        for(j = 0; j < size; j++) {
+            buf[j] = i >> (j * 8);
+        }
+        if(decode_packed(buf, w->bits) != w->ref_decode(buf)) {
+            return(fail(w->bits, "decode", i));
+        }
+    }
+
+    return(0);
+}
+
+static int check_random(const BenchWidth *w) {
+    unsigned char buf[PACKED_MAX_SIZE];
+    uint64_t mask = w->bits == 64 ? ~0ull : (1ull << w->bits) - 1;
+    unsigned int i;
+    unsigned int j;
+
+    /* each bit alone and everything but each bit */
+    for(i = 0; i < w->bits; i++) {
+        if(check_value(w, 1ull << i) < 0 ||
+           check_value(w, ~(1ull << i) & mask) < 0) {
+            return(-1);
+        }
+    }
+
+    for(i = 0; i < BENCH_RANDOM_CHECKS; i++) {
+        if(check_value(w, rng() & mask) < 0) {
+            return(-1);
+        }
+        for(j = 0; j < PACKED_SIZE(w->bits); j++) {
+            buf[j] = rng();
+        }
+        if(decode_packed(buf, w->bits) != w->ref_decode(buf)) {
+            return(fail(w->bits, "decode", i));
+        }
+    }
+
+    return(0);
+}
+
+static int check(int quick) {
+    unsigned int i;
+    uint64_t val;
+
+    for(i = 0; i < BENCH_WIDTH_COUNT; i++) {
+        if(BENCH_WIDTHS[i].bits <= 16) {
+            for(val = 0; val < (1ull << BENCH_WIDTHS[i].bits); val++) {
+                if(check_value(&(BENCH_WIDTHS[i]), val) < 0) {
+                    return(-1);
+                }
+            }
+            if(check_decode_all(&(BENCH_WIDTHS[i])) < 0) {
+                return(-1);
+            }
+        } else if(BENCH_WIDTHS[i].bits == 32 && !quick) {
+            for(val = 0; val < (1ull << 32); val++) {
+                if(check_value(&(BENCH_WIDTHS[i]), val) < 0) {
+                    return(-1);
+                }
+            }
+        }
+        if(check_random(&(BENCH_WIDTHS[i])) < 0) {
+            return(-1);
+        }
+    }
+
+    printf("Codec matches the old functions%s.\n",
+           quick ? " (32 bit not exhaustive)" : "");
+
+    return(0);
+}
+
+static void report(const char *what, unsigned int bits, uint64_t ns, size_t count, uint64_t sum) {
+    printf("%2u bit %-14s %7.2f ns/value (%016llx)\n",
+           bits, what, (double)ns / count, (unsigned long long int)sum);
+}
+
+static uint64_t sum_values(const uint64_t *val, size_t count) {
+    uint64_t sum = 0;
+    size_t i;
+
+    for(i = 0; i < count; i++) {
+        sum += val[i];
+    }
+
+    return(sum);
+}
+
+static void bench(const BenchWidth *w, size_t count) {
+    unsigned char *buf;
+    uint64_t *val;
+    size_t size = PACKED_SIZE(w->bits);
+    uint64_t mask = w->bits == 64 ? ~0ull : (1ull << w->bits) - 1;
+    uint64_t start;
+    uint64_t ns;
+    size_t i;
+
+    buf = malloc(count * size);
+    val = malloc(count * sizeof(uint64_t));
+    if(buf == NULL || val == NULL) {
+        fprintf(stderr, "Failed to allocate memory!\n");
+        free(buf);
+        free(val);
+        return;
+    }
+    for(i = 0; i < count; i++) {
+        encode_packed(rng() & mask, &(buf[i * size]), w->bits);
+    }
+    /* fault it all in before anything's timed */
+    memset(val, 0, count * sizeof(uint64_t));
+
+    start = now_ns();
+    for(i = 0; i < count; i++) {
+        val[i] = w->ref_decode(&(buf[i * size]));
+    }
+    ns = now_ns() - start;
+    report("decode old", w->bits, ns, count, sum_values(val, count));
+
+    /* the width is a constant here like it is in the wrappers */
+    start = now_ns();
+    switch(w->bits) {
+        case 8:
+            for(i = 0; i < count; i++) {
+                val[i] = decode_packed_uint8(&(buf[i * size]));
+            }
+            break;
+        case 16:
+            for(i = 0; i < count; i++) {
+                val[i] = decode_packed_uint16(&(buf[i * size]));
+            }
+            break;
+        case 32:
+            for(i = 0; i < count; i++) {
+                val[i] = decode_packed_uint32(&(buf[i * size]));
+            }
+            break;
+        default:
+            for(i = 0; i < count; i++) {
+                val[i] = decode_packed_uint64(&(buf[i * size]));
+            }
+    }
+    ns = now_ns() - start;
+    report("decode inline", w->bits, ns, count, sum_values(val, count));
+
+    /* and not, like from a type table */
+    start = now_ns();
+    for(i = 0; i < count; i++) {
+        val[i] = decode_packed(&(buf[i * size]), *(volatile unsigned int *)&(w->bits));
+    }
+    ns = now_ns() - start;
+    report("decode generic", w->bits, ns, count, sum_values(val, count));
+
+    start = now_ns();
+    for(i = 0; i < count; i++) {
+        w->ref_encode(val[i], &(buf[i * size]));
+    }
+    report("encode old", w->bits, now_ns() - start, count, buf[count / 2]);
+
+    start = now_ns();
+    for(i = 0; i < count; i++) {
+        encode_packed(val[i], &(buf[i * size]), w->bits);
+    }
+    report("encode inline", w->bits, now_ns() - start, count, buf[count / 2]);
+
+    free(buf);
+    free(val);
+}
+
+int main(int argc, char **argv) {
+    size_t count = BENCH_DEFAULT_VALUES;
+    int quick = 0;
+    int i;
+
+    for(i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-q") == 0) {
+            quick = 1;
+        } else {
+            count = strtoul(argv[i], NULL, 10);
+            if(count == 0) {
+                count = 1;
+            }
+        }
+    }
+
+    if(check(quick) < 0) {
+        return(EXIT_FAILURE);
+    }
+
+    for(i = 0; i < (int)BENCH_WIDTH_COUNT; i++) {
+        bench(&(BENCH_WIDTHS[i]), count);
+    }
+
+    return(EXIT_SUCCESS);
+}
@@ -0,0 +1,270 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* times parsing a schema over and over with the built in parser and, if
+ * it's built in, json-c, and checks they both come up with the same thing.
+ * USAGE: bench_schema [schema] [iterations] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "terminal.h"
+#include "midi.h"
+#include "json_schema.h"
+
+#define BENCH_DEFAULT_SCHEMA "test.json"
+#define BENCH_DEFAULT_ITERATIONS (2000)
+/* about what a USB MIDI device comes through ALSA in */
+#define BENCH_CHUNK (256)
+
+typedef struct {
+    const char *name;
+    JsSchemaParser parser;
+} BenchParser;
+
+const BenchParser BENCH_PARSERS[] = {
+    {"built in", JsSchemaParserBuiltin},
+#ifdef JS_SCHEMA_JSONC
+    {"json-c", JsSchemaParserJsonC},
+#endif
+};
+#define BENCH_PARSER_COUNT (sizeof(BENCH_PARSERS) / sizeof(BENCH_PARSERS[0]))
+
+/* the file wrapped up like it comes from the guitar */
+unsigned char *load_schema(const char *path, size_t *size) {
+    FILE *in;
+    long len;
+    unsigned char *buf;
+
+    in = fopen(path, "rb");
+    if(in == NULL) {
+        fprintf(stderr, "Failed to open %s.\n", path);
+        return(NULL);
+    }
+    if(fseek(in, 0, SEEK_END) < 0 ||
+       (len = ftell(in)) < 0 ||
+       fseek(in, 0, SEEK_SET) < 0) {
+        fprintf(stderr, "Failed to get size of %s.\n", path);
+        fclose(in);
+        return(NULL);
+    }
+
+    *size = JS_SCHEMA_START + len + MIDI_SYSEX_TAIL;
+    buf = malloc(*size);
+    if(buf == NULL) {
+        fprintf(stderr, "Failed to allocate memory!\n");
+        fclose(in);
+        return(NULL);
+    }
+    memset(buf, 0, JS_SCHEMA_START);
+    buf[MIDI_CMD] = MIDI_SYSEX;
+    buf[MIDI_SYSEX_VENDOR] = JS_VENDOR_0;
+    buf[MIDI_SYSEX_VENDOR+1] = JS_VENDOR_1;
+    buf[MIDI_SYSEX_VENDOR+2] = JS_VENDOR_2;
+    buf[JS_CMD] = JS_SCHEMA_RETURN;
+    if(fread(&(buf[JS_SCHEMA_START]), 1, len, in) != (size_t)len) {
+        fprintf(stderr, "Failed to read %s.\n", path);
+        free(buf);
+        fclose(in);
+        return(NULL);
+    }
+    buf[*size-2] = MIDI_SYSEX_DUMMY_LEN;
+    buf[*size-1] = MIDI_SYSEX_END;
+
+    fclose(in);
+
+    return(buf);
+}
+
+/* chunk is 0 to pass it all at once */
+JsInfo *parse(JsSchemaParser parser, size_t size, const unsigned char *buf,
+              size_t chunk) {
+    JsInfo *js;
+    size_t pos;
+    size_t len;
+
+    if(js_set_schema_parser(parser) < 0) {
+        return(NULL);
+    }
+
+    js = js_init();
+    if(js == NULL) {
+        return(NULL);
+    }
+
+    if(chunk == 0) {
+        if(js_parse_json_schema(js, size, buf) < 0) {
+            goto error;
+        }
+        return(js);
+    }
+
+    if(js_schema_stream_begin(js) < 0) {
+        goto error;
+    }
+    for(pos = JS_SCHEMA_START; pos < size; pos += len) {
+        len = size - pos < chunk ? size - pos : chunk;
+        if(js_schema_stream_feed(js, len, &(buf[pos])) < 0) {
+            goto error;
+        }
+    }
+    if(js_schema_stream_end(js) < 0) {
+        goto error;
+    }
+
+    return(js);
+
+error:
+    js_free(js);
+    return(NULL);
+}
+
+int compare(JsInfo *a, JsInfo *b) {
+    unsigned int i;
+
+    if(a->config_count != b->config_count ||
+       a->category_count != b->category_count) {
+        fprintf(stderr, "Got %u and %u items, %u and %u categories.\n",
+                a->config_count, b->config_count,
+                a->category_count, b->category_count);
+        return(-1);
+    }
+
+    for(i = 0; i < a->category_count; i++) {
+        if(strcmp(js_category_name(a, i), js_category_name(b, i)) != 0) {
+            fprintf(stderr, "Category %u differs.\n", i);
+            return(-1);
+        }
+    }
+
+    for(i = 0; i < a->config_count; i++) {
+        if(a->config[i].CC.key != b->config[i].CC.key ||
+           a->config[i].Typ != b->config[i].Typ ||
+           a->meta[i].Step != b->meta[i].Step ||
+           a->meta[i].TT != b->meta[i].TT ||
+           a->meta[i].Cat != b->meta[i].Cat ||
+           a->meta[i].F != b->meta[i].F ||
+           a->meta[i].Lo.uint != b->meta[i].Lo.uint ||
+           a->meta[i].Hi.uint != b->meta[i].Hi.uint ||
+           strcmp(js_config_desc(a, &(a->config[i])),
+                  js_config_desc(b, &(b->config[i]))) != 0) {
+            fprintf(stderr, "Item %u (%.8s) differs.\n",
+                    i, a->config[i].CC.name);
+            return(-1);
+        }
+    }
+
+    return(0);
+}
+
+int run(const BenchParser *p, size_t size, const unsigned char *buf,
+        size_t chunk, unsigned int iterations) {
+    JsInfo *js;
+    unsigned int i;
+    uint64_t start, ns;
+
+    start = midi_time_ns();
+    for(i = 0; i < iterations; i++) {
+        js = parse(p->parser, size, buf, chunk);
+        if(js == NULL) {
+            fprintf(stderr, "%s parser failed.\n", p->name);
+            return(-1);
+        }
+        js_free(js);
+    }
+    ns = midi_time_ns() - start;
+
+    printf("%-8s %-10s %8.2f us/parse %8.1f MB/s\n",
+           p->name, chunk == 0 ? "whole" : "256 chunks",
+           (double)ns / iterations / 1000.0,
+           (double)size * iterations / ((double)ns / 1000000000.0) / 1000000.0);
+
+    return(0);
+}
+
+int main(int argc, char **argv) {
+    const char *path = BENCH_DEFAULT_SCHEMA;
+    unsigned int iterations = BENCH_DEFAULT_ITERATIONS;
+    unsigned char *buf;
+    size_t size;
+    JsInfo *first;
+    JsInfo *js;
+    unsigned int i;
+    int ret = EXIT_FAILURE;
+
+    if(argc > 1) {
+        path = argv[1];
+    }
+    if(argc > 2) {
+        iterations = atoi(argv[2]);
+        if(iterations == 0) {
+            iterations = 1;
+        }
+    }
+
+    if(term_setup(1) < 0) {
+        return(EXIT_FAILURE);
+    }
+
+    buf = load_schema(path, &size);
+    if(buf == NULL) {
+        goto error_term_cleanup;
+    }
+
+    /* everything has to agree before the times mean anything */
+    first = parse(BENCH_PARSERS[0].parser, size, buf, 0);
+    if(first == NULL) {
+        fprintf(stderr, "%s parser failed.\n", BENCH_PARSERS[0].name);
+        goto error_free_buf;
+    }
+    for(i = 0; i < BENCH_PARSER_COUNT * 2; i++) {
+        js = parse(BENCH_PARSERS[i / 2].parser, size, buf, i % 2 ? BENCH_CHUNK : 0);
+        if(js == NULL) {
+            fprintf(stderr, "%s parser failed.\n", BENCH_PARSERS[i / 2].name);
+            goto error_free_first;
+        }
+        if(compare(first, js) < 0) {
+            fprintf(stderr, "%s parser disagrees.\n", BENCH_PARSERS[i / 2].name);
+            js_free(js);
+            goto error_free_first;
+        }
+        js_free(js);
+    }
+
+    printf("%s: %zu bytes, %u items, %u iterations\n",
+           path, size, first->config_count, iterations);
+    for(i = 0; i < BENCH_PARSER_COUNT; i++) {
+        if(run(&(BENCH_PARSERS[i]), size, buf, 0, iterations) < 0 ||
+           run(&(BENCH_PARSERS[i]), size, buf, BENCH_CHUNK, iterations) < 0) {
+            goto error_free_first;
+        }
+    }
+
+    ret = EXIT_SUCCESS;
+
+error_free_first:
+    js_free(first);
+error_free_buf:
+    free(buf);
+error_term_cleanup:
+    term_cleanup();
+
+    return(ret);
+}
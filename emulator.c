@@ -0,0 +1,513 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "terminal.h"
+#include "midi.h"
+#include "midi_loopback.h"
+#include "json_schema.h"
+#include "emulator.h"
+
+/* open notes, low E first */
+const int EMU_OPEN_NOTES[EMU_STRINGS] = { 40, 45, 50, 55, 59, 64 };
+#define EMU_FRETS (13)
+#define EMU_BEND_RANGE (2048)
+
+static uint32_t _emu_rand(Emulator *emu) {
+    /* xorshift, just needs to be repeatable */
+    emu->rand ^= emu->rand << 13;
+    emu->rand ^= emu->rand >> 17;
+    emu->rand ^= emu->rand << 5;
+
+    return(emu->rand);
+}
+
+static uint64_t _emu_interval(Emulator *emu, unsigned int rate) {
+    return(emu->sample_rate / rate);
+}
+
+static size_t _emu_sysex_start(unsigned char *buf, unsigned char cmd, const unsigned char *name) {
+    buf[MIDI_CMD] = MIDI_SYSEX;
+    buf[MIDI_SYSEX_VENDOR] = JS_VENDOR_0;
+    buf[MIDI_SYSEX_VENDOR+1] = JS_VENDOR_1;
+    buf[MIDI_SYSEX_VENDOR+2] = JS_VENDOR_2;
+    buf[JS_CMD] = cmd;
+    if(name == NULL) {
+        memset(&(buf[JS_CONFIG_NAME]), 0, JS_CONFIG_NAME_LEN);
+    } else {
+        memcpy(&(buf[JS_CONFIG_NAME]), name, JS_CONFIG_NAME_LEN);
+    }
+
+    return(JS_CONFIG_NAME + JS_CONFIG_NAME_LEN);
+}
+
+static size_t _emu_sysex_end(unsigned char *buf, size_t pos) {
+    buf[pos] = MIDI_SYSEX_DUMMY_LEN;
+    buf[pos+1] = MIDI_SYSEX_END;
+
+    return(pos + MIDI_SYSEX_TAIL);
+}
+
+static int _emu_queue(Emulator *emu, size_t size, const unsigned char *buf) {
+    unsigned char *tx;
+    size_t newsize;
+
+    /* reclaim what's been sent already */
+    if(emu->tx_pos > 0) {
+        memmove(emu->tx, &(emu->tx[emu->tx_pos]), emu->tx_used - emu->tx_pos);
+        emu->tx_used -= emu->tx_pos;
+        emu->tx_pos = 0;
+    }
+
+    if(emu->tx_used + sizeof(size_t) + size > emu->tx_size) {
+        newsize = emu->tx_size * 2;
+        while(emu->tx_used + sizeof(size_t) + size > newsize) {
+            newsize *= 2;
+        }
+        tx = realloc(emu->tx, newsize);
+        if(tx == NULL) {
+            term_print("Failed to allocate memory!");
+            return(-1);
+        }
+        emu->tx = tx;
+        emu->tx_size = newsize;
+    }
+
+    memcpy(&(emu->tx[emu->tx_used]), &size, sizeof(size_t));
+    memcpy(&(emu->tx[emu->tx_used + sizeof(size_t)]), buf, size);
+    emu->tx_used += sizeof(size_t) + size;
+
+    return(0);
+}
+
+static size_t _emu_encode_value(JsInfo *js, JsConfig *config, unsigned char *buf) {
+    const char *text;
+    size_t len;
+
+    if(!js_config_get_type_is_valid(config->Typ)) {
+        return(0);
+    }
+
+    if(JS_TYPE_INFO[config->Typ].encode == NULL) {
+        text = js_config_text(js, config);
+        len = strlen(text);
+        memcpy(buf, text, len);
+        return(len);
+    }
+
+    JS_TYPE_INFO[config->Typ].encode(config->val.uint, buf);
+
+    return(js_config_get_type_size(config->Typ));
+}
+
+static int _emu_queue_config(Emulator *emu, JsConfig *config) {
+    unsigned char buf[JS_CONFIG_VALUE + MIDI_MAX_BUFFER_SIZE / 2];
+    size_t pos;
+
+    pos = _emu_sysex_start(buf, JS_CONFIG_RETURN, (const unsigned char *)config->CC.name);
+    buf[JS_CONFIG_TYPE] = config->Typ;
+    pos = JS_CONFIG_VALUE + _emu_encode_value(emu->js, config, &(buf[JS_CONFIG_VALUE]));
+    pos = _emu_sysex_end(buf, pos);
+
+    emu->stats.config_returns++;
+
+    return(_emu_queue(emu, pos, buf));
+}
+
+static void _emu_config_query(Emulator *emu, const unsigned char *name) {
+    static const unsigned char all[JS_CONFIG_NAME_LEN] = { 0 };
+    unsigned char buf[JS_CONFIG_QUERY_LEN];
+    unsigned int i;
+    int category = -1;
+    size_t pos;
+
+    for(i = 0; i < emu->js->category_count; i++) {
+        if(memcmp(js_category_name(emu->js, i), name, JS_CONFIG_NAME_LEN) == 0) {
+            category = i;
+            break;
+        }
+    }
+
+    /* an empty name gets everything */
+    if(category >= 0 || memcmp(name, all, JS_CONFIG_NAME_LEN) == 0) {
+        for(i = 0; i < emu->js->config_count; i++) {
+            if(category < 0 || emu->js->meta[i].Cat == category) {
+                if(_emu_queue_config(emu, &(emu->js->config[i])) < 0) {
+                    return;
+                }
+            }
+        }
+    }
+
+    pos = _emu_sysex_start(buf, JS_CONFIG_DONE, name);
+    pos = _emu_sysex_end(buf, pos);
+    _emu_queue(emu, pos, buf);
+}
+
+static void _emu_handle_sysex(Emulator *emu, size_t size, unsigned char *buf) {
+    JsConfig *config;
+
+    if(size < JS_CONFIG_QUERY_LEN ||
+       buf[MIDI_SYSEX_VENDOR] != JS_VENDOR_0 ||
+       buf[MIDI_SYSEX_VENDOR+1] != JS_VENDOR_1 ||
+       buf[MIDI_SYSEX_VENDOR+2] != JS_VENDOR_2) {
+        emu->stats.unknown++;
+        return;
+    }
+
+    switch(buf[JS_CMD]) {
+        case JS_SCHEMA_QUERY:
+            emu->stats.schema_queries++;
+            memcpy(&(emu->schema[JS_SCHEMA_NAME]), &(buf[JS_SCHEMA_NAME]), JS_SCHEMA_NAME_LEN);
+            _emu_queue(emu, emu->schema_size, emu->schema);
+            break;
+        case JS_CONFIG_QUERY:
+            emu->stats.config_queries++;
+            _emu_config_query(emu, &(buf[JS_CONFIG_NAME]));
+            break;
+        case JS_CONFIG_SET:
+            emu->stats.config_sets++;
+            config = js_decode_config_value(emu->js, size, buf);
+            if(config == NULL) {
+                break;
+            }
+            /* the guitar echos back what was set */
+            buf[JS_CMD] = JS_CONFIG_SET_RETURN;
+            _emu_queue(emu, size, buf);
+            break;
+        default:
+            emu->stats.unknown++;
+    }
+}
+
+static void _emu_receive(void *priv, uint32_t frame,
+                         const unsigned char *buffer, size_t size) {
+    Emulator *emu = (Emulator *)priv;
+
+    if(emu->rx_size == 0 && buffer[0] != MIDI_SYSEX) {
+        /* nothing else means anything to the guitar */
+        return;
+    }
+
+    if(emu->rx_size + size > sizeof(emu->rx)) {
+        emu->rx_overflow = 1;
+    } else {
+        memcpy(&(emu->rx[emu->rx_size]), buffer, size);
+    }
+    emu->rx_size += size;
+
+    if(buffer[size-1] != MIDI_SYSEX_END) {
+        /* more to come */
+        return;
+    }
+
+    if(!emu->rx_overflow) {
+        _emu_handle_sysex(emu, emu->rx_size, emu->rx);
+    }
+    emu->rx_size = 0;
+    emu->rx_overflow = 0;
+}
+
+static void _emu_add_event(Emulator *emu, uint32_t time, unsigned int size,
+                           unsigned char b0, unsigned char b1, unsigned char b2) {
+    EmuEvent *ev;
+    unsigned int i;
+
+    if(emu->event_count == EMU_MAX_CYCLE_EVENTS) {
+        emu->stats.dropped++;
+        return;
+    }
+
+    /* keep them in order as they're added */
+    for(i = emu->event_count; i > 0 && emu->events[i-1].time > time; i--) {
+        emu->events[i] = emu->events[i-1];
+    }
+    ev = &(emu->events[i]);
+    ev->time = time;
+    ev->size = size;
+    ev->buffer[0] = b0;
+    ev->buffer[1] = b1;
+    ev->buffer[2] = b2;
+    emu->event_count++;
+}
+
+static void _emu_play_string(Emulator *emu, unsigned int i, uint64_t end) {
+    EmuString *s = &(emu->string[i]);
+    unsigned char channel = (emu->config.channel + (EMU_STRINGS - 1 - i)) & MIDI_CHANNEL_MASK;
+    unsigned int bend;
+    unsigned int expression;
+    uint64_t next;
+
+    for(;;) {
+        /* find whichever comes next */
+        next = end;
+        if(s->held && s->off_at < next) {
+            next = s->off_at;
+        }
+        if(s->next_on < next) {
+            next = s->next_on;
+        }
+        if(s->held && emu->config.bend_rate > 0 && s->next_bend < next) {
+            next = s->next_bend;
+        }
+        if(s->held && emu->config.expression_rate > 0 && s->next_expression < next) {
+            next = s->next_expression;
+        }
+        if(next >= end) {
+            break;
+        }
+
+        if(s->held && next == s->off_at) {
+            _emu_add_event(emu, next - emu->now, MIDI_CMD_NOTE_SIZE,
+                           MIDI_CMD_NOTE_OFF | channel, s->note, 0);
+            s->held = 0;
+        } else if(next == s->next_on) {
+            if(s->held) {
+                _emu_add_event(emu, next - emu->now, MIDI_CMD_NOTE_SIZE,
+                               MIDI_CMD_NOTE_OFF | channel, s->note, 0);
+            }
+            s->note = EMU_OPEN_NOTES[i] + _emu_rand(emu) % EMU_FRETS;
+            _emu_add_event(emu, next - emu->now, MIDI_CMD_NOTE_SIZE,
+                           MIDI_CMD_NOTE_ON | channel, s->note,
+                           1 + _emu_rand(emu) % 127);
+            s->held = 1;
+            s->phase = 0;
+            s->off_at = next + (uint64_t)emu->sample_rate * emu->config.note_length_ms / 1000;
+            s->next_bend = next;
+            s->next_expression = next;
+            /* spread them out a bit so the strings don't all line up */
+            s->next_on = next + _emu_interval(emu, emu->config.note_rate) / 2 +
+                         _emu_rand(emu) % _emu_interval(emu, emu->config.note_rate);
+            emu->stats.notes++;
+        } else if(next == s->next_bend) {
+            /* triangle wave */
+            bend = s->phase % (EMU_BEND_RANGE * 2);
+            if(bend > EMU_BEND_RANGE) {
+                bend = EMU_BEND_RANGE * 2 - bend;
+            }
+            bend += MIDI_CMD_PITCHBEND_OFFSET;
+            _emu_add_event(emu, next - emu->now, MIDI_CMD_PITCHBEND_SIZE,
+                           MIDI_CMD_PITCHBEND | channel,
+                           bend & 0x7F, (bend >> 7) & 0x7F);
+            s->phase += 64;
+            s->next_bend = next + _emu_interval(emu, emu->config.bend_rate);
+        } else {
+            expression = _emu_rand(emu) & 0x3FFF;
+            _emu_add_event(emu, next - emu->now, MIDI_CMD_CC_SIZE,
+                           MIDI_CMD_CC | channel, MIDI_CC_EXPRESSION_MSB,
+                           expression >> 7);
+            _emu_add_event(emu, next - emu->now, MIDI_CMD_CC_SIZE,
+                           MIDI_CMD_CC | channel, MIDI_CC_EXPRESSION_LSB,
+                           expression & 0x7F);
+            s->next_expression = next + _emu_interval(emu, emu->config.expression_rate);
+        }
+    }
+}
+
+static void _emu_cycle(void *priv, uint32_t frame, uint32_t nframes) {
+    Emulator *emu = (Emulator *)priv;
+    size_t size;
+    size_t chunk;
+    unsigned int i;
+
+    /* replies go first, as many as there's room for */
+    while(emu->tx_pos < emu->tx_used) {
+        memcpy(&size, &(emu->tx[emu->tx_pos]), sizeof(size_t));
+        chunk = size - emu->tx_sent;
+        if(chunk > EMU_SYSEX_CHUNK) {
+            chunk = EMU_SYSEX_CHUNK;
+        }
+        if(!midi_loopback_inject_room(chunk) ||
+           midi_loopback_inject(0, &(emu->tx[emu->tx_pos + sizeof(size_t) + emu->tx_sent]), chunk) < 0) {
+            break;
+        }
+        emu->tx_sent += chunk;
+        if(emu->tx_sent == size) {
+            emu->tx_pos += sizeof(size_t) + size;
+            emu->tx_sent = 0;
+        }
+    }
+
+    if(emu->config.note_rate > 0) {
+        emu->event_count = 0;
+        for(i = 0; i < EMU_STRINGS; i++) {
+            _emu_play_string(emu, i, emu->now + nframes);
+        }
+        for(i = 0; i < emu->event_count; i++) {
+            if(midi_loopback_inject(emu->events[i].time,
+                                    emu->events[i].buffer,
+                                    emu->events[i].size) < 0) {
+                emu->stats.dropped += emu->event_count - i;
+                break;
+            }
+            emu->stats.events++;
+        }
+    }
+
+    emu->now += nframes;
+}
+
+static unsigned char *_emu_load_schema(const char *path, size_t *size) {
+    FILE *in;
+    long len;
+    unsigned char *buf;
+    size_t pos;
+
+    in = fopen(path, "rb");
+    if(in == NULL) {
+        term_print("Failed to open %s.", path);
+        return(NULL);
+    }
+    if(fseek(in, 0, SEEK_END) < 0 ||
+       (len = ftell(in)) < 0 ||
+       fseek(in, 0, SEEK_SET) < 0) {
+        term_print("Failed to get size of %s.", path);
+        goto error;
+    }
+
+    *size = JS_SCHEMA_START + len + MIDI_SYSEX_TAIL;
+    buf = malloc(*size);
+    if(buf == NULL) {
+        term_print("Failed to allocate memory!");
+        goto error;
+    }
+    pos = _emu_sysex_start(buf, JS_SCHEMA_RETURN, NULL);
+    if(fread(&(buf[pos]), 1, len, in) != (size_t)len) {
+        term_print("Failed to read %s.", path);
+        free(buf);
+        goto error;
+    }
+    _emu_sysex_end(buf, pos + len);
+
+    fclose(in);
+
+    return(buf);
+
+error:
+    fclose(in);
+    return(NULL);
+}
+
+Emulator *emu_init(const char *schema_path, uint32_t sample_rate, const EmuConfig *config) {
+    Emulator *emu;
+    unsigned int i;
+
+    emu = malloc(sizeof(Emulator));
+    if(emu == NULL) {
+        term_print("Failed to allocate memory!");
+        return(NULL);
+    }
+
+    emu->config = *config;
+    if(emu->config.note_rate > sample_rate) {
+        emu->config.note_rate = sample_rate;
+    }
+    if(emu->config.bend_rate > sample_rate) {
+        emu->config.bend_rate = sample_rate;
+    }
+    if(emu->config.expression_rate > sample_rate) {
+        emu->config.expression_rate = sample_rate;
+    }
+    emu->sample_rate = sample_rate;
+    emu->now = 0;
+    emu->rand = config->seed == 0 ? 1 : config->seed;
+    emu->rx_size = 0;
+    emu->rx_overflow = 0;
+    emu->tx_used = 0;
+    emu->tx_pos = 0;
+    emu->tx_sent = 0;
+    emu->event_count = 0;
+    memset(&(emu->stats), 0, sizeof(emu->stats));
+
+    for(i = 0; i < EMU_STRINGS; i++) {
+        emu->string[i].held = 0;
+        emu->string[i].note = -1;
+        emu->string[i].next_on = 0;
+        emu->string[i].phase = 0;
+    }
+
+    emu->tx_size = MIDI_MAX_BUFFER_SIZE;
+    emu->tx = malloc(emu->tx_size);
+    if(emu->tx == NULL) {
+        term_print("Failed to allocate memory!");
+        goto error;
+    }
+
+    emu->schema = _emu_load_schema(schema_path, &(emu->schema_size));
+    if(emu->schema == NULL) {
+        goto error_free_tx;
+    }
+
+    emu->js = js_init();
+    if(emu->js == NULL) {
+        goto error_free_schema;
+    }
+    if(js_parse_json_schema(emu->js, emu->schema_size, emu->schema) < 0) {
+        term_print("Failed to parse schema %s.", schema_path);
+        goto error_free_js;
+    }
+
+    /* start with everything at its lowest */
+    for(i = 0; i < emu->js->config_count; i++) {
+        if(js_config_get_type_is_numeric(emu->js->config[i].Typ)) {
+            /* same bits for signed values */
+            emu->js->config[i].val.uint = emu->js->meta[i].Lo.uint;
+        } else {
+            emu->js->config[i].val.text = emu->js->meta[i].Desc;
+        }
+        emu->js->config[i].validValue = 1;
+    }
+
+    return(emu);
+
+error_free_js:
+    js_free(emu->js);
+error_free_schema:
+    free(emu->schema);
+error_free_tx:
+    free(emu->tx);
+error:
+    free(emu);
+    return(NULL);
+}
+
+void emu_free(Emulator *emu) {
+    js_free(emu->js);
+    free(emu->schema);
+    free(emu->tx);
+    free(emu);
+}
+
+void emu_attach(Emulator *emu) {
+    MidiLoopbackPeer peer = {
+        .cycle = _emu_cycle,
+        .receive = _emu_receive,
+        .thru = NULL,
+        .priv = emu
+    };
+
+    midi_loopback_set_peer(&peer);
+}
+
+void emu_get_stats(Emulator *emu, EmuStats *stats) {
+    *stats = emu->stats;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _EMULATOR_H
+#define _EMULATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "json_schema.h"
+
+/* stand-in for a guitar on the other end of the loopback backend.  It
+ * answers schema and config queries from a captured schema and can play
+ * made up notes on all the strings. */
+
+#define EMU_STRINGS (6)
+#define EMU_MAX_CYCLE_EVENTS (256)
+/* long sysexes are sent in pieces like a USB MIDI device through ALSA would */
+#define EMU_SYSEX_CHUNK (256)
+
+typedef struct {
+    /* notes per second on each string, 0 for none */
+    unsigned int note_rate;
+    unsigned int note_length_ms;
+    /* bend and expression messages per second while a note is held */
+    unsigned int bend_rate;
+    unsigned int expression_rate;
+    /* channel of the high E string, the rest follow */
+    unsigned int channel;
+    unsigned int seed;
+} EmuConfig;
+
+typedef struct {
+    unsigned long long schema_queries;
+    unsigned long long config_queries;
+    unsigned long long config_sets;
+    unsigned long long config_returns;
+    unsigned long long unknown;
+    unsigned long long notes;
+    unsigned long long events;
+    unsigned long long dropped;
+} EmuStats;
+
+typedef struct {
+    int held;
+    int note;
+    uint64_t off_at;
+    uint64_t next_on;
+    uint64_t next_bend;
+    uint64_t next_expression;
+    unsigned int phase;
+} EmuString;
+
+typedef struct {
+    uint32_t time;
+    unsigned int size;
+    unsigned char buffer[3];
+} EmuEvent;
+
+typedef struct {
+    JsInfo *js;
+    unsigned char *schema;
+    size_t schema_size;
+
+    EmuConfig config;
+    uint32_t sample_rate;
+    uint64_t now;
+    uint32_t rand;
+    EmuString string[EMU_STRINGS];
+
+    /* sysex being received */
+    unsigned char rx[MIDI_MAX_BUFFER_SIZE];
+    size_t rx_size;
+    int rx_overflow;
+
+    /* replies waiting to be sent, length prefixed */
+    unsigned char *tx;
+    size_t tx_size;
+    size_t tx_used;
+    size_t tx_pos;
+    /* how much of the reply at tx_pos has gone out */
+    size_t tx_sent;
+
+    EmuEvent events[EMU_MAX_CYCLE_EVENTS];
+    unsigned int event_count;
+
+    EmuStats stats;
+} Emulator;
+
+Emulator *emu_init(const char *schema_path, uint32_t sample_rate, const EmuConfig *config);
+void emu_free(Emulator *emu);
+/* become the loopback backend's peer, call before midi_setup() */
+void emu_attach(Emulator *emu);
+void emu_get_stats(Emulator *emu, EmuStats *stats);
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "midi.h"
+#include "fetch.h"
+
+typedef struct {
+    char name[JS_CONFIG_NAME_LEN+1];
+    FetchPriority priority;
+} FetchCategoryPriority;
+
+/* what drives the guitar state and display comes first, __SYSTEM is only
+ * identifiers and diagnostics */
+const FetchCategoryPriority FETCH_PRIORITIES[] = {
+    {"____MIDI", FetchPriorityFirst},
+    {"__TUNING", FetchPriorityFirst},
+    {"__SYSTEM", FetchPriorityLazy}
+};
+
+static FetchPriority fetch_category_priority(JsInfo *js, unsigned int category) {
+    const char *name = js_category_name(js, category);
+    unsigned int items = 0;
+    unsigned int engineering = 0;
+    unsigned int i;
+
+    for(i = 0; i < sizeof(FETCH_PRIORITIES) / sizeof(FETCH_PRIORITIES[0]); i++) {
+        if(memcmp(name, FETCH_PRIORITIES[i].name, JS_CONFIG_NAME_LEN) == 0) {
+            return(FETCH_PRIORITIES[i].priority);
+        }
+    }
+
+    /* nothing but engineering items can wait too */
+    for(i = 0; i < js->config_count; i++) {
+        if(js->meta[i].Cat == (int)category) {
+            items++;
+            if(js->meta[i].F != (unsigned int)-1 &&
+               (js->meta[i].F & SF_ENGINEERING)) {
+                engineering++;
+            }
+        }
+    }
+    if(items > 0 && items == engineering) {
+        return(FetchPriorityLazy);
+    }
+
+    return(FetchPriorityNormal);
+}
+
+static void fetch_check_ready(ConfigFetch *f, uint64_t now) {
+    unsigned int i;
+
+    if(f->ready_ns != 0) {
+        return;
+    }
+
+    for(i = 0; i < f->count; i++) {
+        if(f->priority[i] != FetchPriorityLazy && f->state[i] != FetchDone) {
+            return;
+        }
+    }
+
+    f->ready_ns = now;
+}
+
+void fetch_init(ConfigFetch *f, JsInfo *js, unsigned int depth) {
+    unsigned int i;
+
+    f->depth = depth;
+    f->count = js->category_count;
+    memset(f->state, FetchPending, sizeof(f->state));
+    for(i = 0; i < f->count; i++) {
+        f->priority[i] = fetch_category_priority(js, i);
+    }
+    f->next_seq = 0;
+    f->in_flight = 0;
+    f->done = 0;
+    f->all_sent = 0;
+    f->start_ns = midi_time_ns();
+    f->ready_ns = 0;
+    f->end_ns = 0;
+    fetch_check_ready(f, f->start_ns);
+}
+
+/* returns the next category to ask for, FETCH_ALL to ask for everything at
+ * once or FETCH_NONE if nothing should be sent right now.  Call it until it
+ * returns FETCH_NONE. */
+int fetch_next(ConfigFetch *f) {
+    unsigned int i;
+    int best = FETCH_NONE;
+
+    if(f->depth == 0) {
+        if(f->all_sent || f->done == f->count) {
+            return(FETCH_NONE);
+        }
+        f->all_sent = 1;
+        f->sent_ns[0] = midi_time_ns();
+        return(FETCH_ALL);
+    }
+
+    if(f->in_flight >= f->depth) {
+        return(FETCH_NONE);
+    }
+
+    for(i = 0; i < f->count; i++) {
+        if(f->state[i] == FetchPending &&
+           (best == FETCH_NONE || f->priority[i] < f->priority[best])) {
+            best = i;
+        }
+    }
+    if(best == FETCH_NONE) {
+        return(FETCH_NONE);
+    }
+    /* lazy ones go one at a time once nothing else is waiting, so anything
+     * requested isn't stuck behind them */
+    if(f->priority[best] == FetchPriorityLazy && f->in_flight > 0) {
+        return(FETCH_NONE);
+    }
+
+    f->state[best] = FetchInFlight;
+    f->sent_ns[best] = midi_time_ns();
+    f->seq[best] = f->next_seq++;
+    f->in_flight++;
+
+    return(best);
+}
+
+static void fetch_finish(ConfigFetch *f, unsigned int category, uint64_t now) {
+    f->state[category] = FetchDone;
+    f->done++;
+    fetch_check_ready(f, now);
+    if(f->done == f->count) {
+        f->end_ns = now;
+    }
+}
+
+/* a query finished, name is the name in the done message.  If it doesn't
+ * match anything in flight, replies are assumed to come in the order they
+ * were asked for.  Returns the category finished, or FETCH_ALL or FETCH_NONE
+ * if nothing was waiting. */
+int fetch_done(ConfigFetch *f, JsInfo *js, const char *name) {
+    uint64_t now = midi_time_ns();
+    unsigned int i;
+    int found = FETCH_NONE;
+
+    if(f->depth == 0) {
+        if(!f->all_sent || f->done == f->count) {
+            return(FETCH_NONE);
+        }
+        latency_record(&(f->latency), now - f->sent_ns[0]);
+        for(i = 0; i < f->count; i++) {
+            if(f->state[i] != FetchDone) {
+                fetch_finish(f, i, now);
+            }
+        }
+        return(FETCH_ALL);
+    }
+
+    for(i = 0; i < f->count; i++) {
+        if(f->state[i] != FetchInFlight) {
+            continue;
+        }
+        if(memcmp(js_category_name(js, i), name, JS_CONFIG_NAME_LEN) == 0) {
+            found = i;
+            break;
+        }
+        if(found == FETCH_NONE || f->seq[i] < f->seq[found]) {
+            found = i;
+        }
+    }
+
+    if(found == FETCH_NONE) {
+        return(FETCH_NONE);
+    }
+
+    latency_record(&(f->latency), now - f->sent_ns[found]);
+    f->in_flight--;
+    fetch_finish(f, found, now);
+
+    return(found);
+}
+
+/* for a category that was read some other way */
+void fetch_mark_done(ConfigFetch *f, unsigned int category) {
+    if(category >= f->count || f->state[category] == FetchDone) {
+        return;
+    }
+
+    if(f->state[category] == FetchInFlight) {
+        f->in_flight--;
+    }
+    fetch_finish(f, category, midi_time_ns());
+}
+
+/* ask for a category next, for when something needs it.
+ * returns 1 if it's still to come, 0 if it's already done or -1 if there's
+ * no such category */
+int fetch_request(ConfigFetch *f, unsigned int category) {
+    if(category >= f->count) {
+        return(-1);
+    }
+
+    if(f->state[category] == FetchDone) {
+        return(0);
+    }
+    if(f->state[category] == FetchPending) {
+        f->priority[category] = FetchPriorityRequested;
+    }
+
+    return(1);
+}
+
+int fetch_is_done(ConfigFetch *f, unsigned int category) {
+    return(category < f->count && f->state[category] == FetchDone);
+}
+
+int fetch_ready(ConfigFetch *f) {
+    return(f->ready_ns != 0);
+}
+
+int fetch_complete(ConfigFetch *f) {
+    return(f->done == f->count);
+}
+
+uint64_t fetch_ready_ns(ConfigFetch *f) {
+    if(f->ready_ns == 0) {
+        return(midi_time_ns() - f->start_ns);
+    }
+
+    return(f->ready_ns - f->start_ns);
+}
+
+uint64_t fetch_elapsed_ns(ConfigFetch *f) {
+    if(f->end_ns == 0) {
+        return(midi_time_ns() - f->start_ns);
+    }
+
+    return(f->end_ns - f->start_ns);
+}
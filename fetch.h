@@ -0,0 +1,91 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FETCH_H
+#define _FETCH_H
+
+#include <stdint.h>
+
+#include "latency.h"
+#include "json_schema.h"
+
+/* keeps up to depth category queries in flight at once instead of waiting
+ * for each one to finish before asking for the next.  A depth of 0 asks for
+ * everything with a single query with an empty name instead, for devices
+ * which accept that.
+ *
+ * Categories are asked for in order of priority, what's needed to show what
+ * the guitar is doing comes first and once that's in, it's considered ready.
+ * Lazy ones are then read one at a time in the background, unless something
+ * asks for one sooner with fetch_request(). */
+
+#define FETCH_DEFAULT_DEPTH (4)
+
+/* returned by fetch_next() */
+#define FETCH_NONE (-1)
+#define FETCH_ALL (-2)
+
+typedef enum {
+    FetchPriorityRequested = 0,
+    FetchPriorityFirst,
+    FetchPriorityNormal,
+    FetchPriorityLazy
+} FetchPriority;
+
+typedef enum {
+    FetchPending = 0,
+    FetchInFlight,
+    FetchDone
+} FetchState;
+
+typedef struct {
+    unsigned int depth;
+    unsigned int count;
+    unsigned char state[JS_MAX_CATEGORIES];
+    unsigned char priority[JS_MAX_CATEGORIES];
+    /* when each was asked for, and in what order */
+    uint64_t sent_ns[JS_MAX_CATEGORIES];
+    unsigned int seq[JS_MAX_CATEGORIES];
+    unsigned int next_seq;
+
+    unsigned int in_flight;
+    unsigned int done;
+    int all_sent;
+
+    uint64_t start_ns;
+    /* when everything but the lazy categories was done */
+    uint64_t ready_ns;
+    uint64_t end_ns;
+    /* time from asking for a category to it being done, not touched by
+     * fetch_init() so it collects over every fetch */
+    LatencyHist latency;
+} ConfigFetch;
+
+void fetch_init(ConfigFetch *f, JsInfo *js, unsigned int depth);
+int fetch_next(ConfigFetch *f);
+int fetch_done(ConfigFetch *f, JsInfo *js, const char *name);
+void fetch_mark_done(ConfigFetch *f, unsigned int category);
+int fetch_request(ConfigFetch *f, unsigned int category);
+int fetch_is_done(ConfigFetch *f, unsigned int category);
+int fetch_ready(ConfigFetch *f);
+int fetch_complete(ConfigFetch *f);
+uint64_t fetch_ready_ns(ConfigFetch *f);
+uint64_t fetch_elapsed_ns(ConfigFetch *f);
+
+#endif
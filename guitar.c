@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "guitar.h"
 #include "midi.h"
@@ -13,22 +14,50 @@ typedef enum {
 
 #define FIELD_ARRAY_NUM(FIELD) (sizeof(FIELD) / sizeof(FIELD[0]))
 
+/* a bit for each of the first N strings */
+#define GUITAR_STRINGS_MASK(N) ((1u << (N)) - 1)
+
+/* the low bits of dirty are the strings */
+#define GUITAR_DIRTY_MODE (1 << GUITAR_MAX_STRINGS)
+#define GUITAR_DIRTY_ALL (GUITAR_STRINGS_MASK(GUITAR_MAX_STRINGS) | GUITAR_DIRTY_MODE)
+
+#define GUITAR_NOTES (128)
+
 static char buffer[MIDI_MAX_BUFFER_SIZE];
 
-void guitar_stop_strings(GuitarState *g) {
+static void guitar_stop_strings(GuitarState *g) {
     unsigned int i;
 
-    for(i = 0; i < sizeof(g->string) / sizeof(g->string[0]); i++) {
-        g->string[i].note = -1;
-        g->string[i].velocity = 0;
-        g->string[i].bend = 0;
-        g->string[i].expression = 0;
+    for(i = 0; i < FIELD_ARRAY_NUM(g->shared->state.string); i++) {
+        g->shared->state.string[i].open = 0;
+        g->shared->state.string[i].note = -1;
+        g->shared->state.string[i].velocity = 0;
+        g->shared->state.string[i].bend = 0;
+        g->shared->state.string[i].expression = 0;
+        g->shared->state.string[i].events = 0;
+        g->shared->state.string[i].event_ns = 0;
     }
+
+    g->free_strings = GUITAR_STRINGS_MASK(g->shared->state.strings);
+    memset(g->note_string, -1, sizeof(g->note_string));
+    g->last_string = 0;
+    g->started = 0;
+    memset(g->string_started, 0, sizeof(g->string_started));
 }
 
-GuitarState *guitar_init() {
+static void guitar_apply_tuning(GuitarState *g, unsigned int strings, const int *tuning);
+
+/* strings and their tuning come from the instrument, there's always room for
+ * GUITAR_MAX_STRINGS so they can change later without anything being moved */
+GuitarState *guitar_init(unsigned int strings, const int *tuning) {
     GuitarState *g;
 
+    if(strings == 0 || strings > GUITAR_MAX_STRINGS) {
+        fprintf(stderr, "Can't have %u strings, only 1 to %d.\n",
+                strings, GUITAR_MAX_STRINGS);
+        return(NULL);
+    }
+
     g = malloc(sizeof(GuitarState));
     if(g == NULL) {
         fprintf(stderr, "Failed to allocate memory.\n");
@@ -43,11 +72,65 @@ GuitarState *guitar_init() {
     g->bendRangeSemitones = 4800;
     g->bendRangeCents = 100;
 
+    g->shared = &(g->local);
+    atomic_init(&(g->shared->magic), GUITAR_SHARED_MAGIC);
+    g->shared->version = GUITAR_SHARED_VERSION;
+    g->shared->size = sizeof(GuitarShared);
+    atomic_init(&(g->shared->seq), 0);
+    g->shared->state.events = 0;
+    g->shared->state.event_ns = 0;
+    g->shared->state.strings = 0;
     guitar_stop_strings(g);
+    g->shm_name = NULL;
+    g->attached = 0;
+
+    if(pthread_mutex_init(&(g->tuning_lock), NULL) != 0) {
+        fprintf(stderr, "Failed to create mutex.\n");
+        free(g);
+        return(NULL);
+    }
+    atomic_init(&(g->tuning_pending), 0);
+
+    /* nothing's been drawn yet */
+    atomic_init(&(g->dirty), GUITAR_DIRTY_ALL);
+    g->last_render_ns = 0;
+    guitar_set_render_rate(g, GUITAR_DEFAULT_RENDER_RATE);
+
+    g->strings = strings;
+    guitar_apply_tuning(g, strings, tuning);
 
     return(g);
 }
 
+void guitar_read(GuitarState *g, GuitarSnapshot *snap) {
+    guitar_shared_read(g->shared, snap);
+}
+
+/* only the thread tracking events changes the state, between these */
+static void guitar_write_begin(GuitarState *g) {
+    GuitarShared *shared = g->shared;
+
+    atomic_store_explicit(&(shared->seq),
+                          atomic_load_explicit(&(shared->seq), memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/* string is -1 for a change which isn't to any one string */
+static void guitar_write_end(GuitarState *g, int string, uint64_t ns) {
+    GuitarShared *shared = g->shared;
+
+    if(string >= 0) {
+        shared->state.string[string].events++;
+        shared->state.string[string].event_ns = ns;
+    }
+    shared->state.events++;
+    shared->state.event_ns = ns;
+    atomic_store_explicit(&(shared->seq),
+                          atomic_load_explicit(&(shared->seq), memory_order_relaxed) + 1,
+                          memory_order_release);
+}
+
 GuitarMode guitar_get_mode(GuitarState *g) {
     if(!g->MPEOn) {
         if(g->singleChannelMode) {
@@ -75,47 +158,130 @@ const char *guitar_mode_to_string(GuitarMode mode) {
     return("Unknown");
 }
 
-void guitar_print(GuitarState *g) {
+/* a note's name in to buf, or --- for no note */
+static void guitar_note_name(size_t size, char *buf, int note) {
+    int len;
+
+    if(note < 0) {
+        snprintf(buf, size, "---");
+    } else {
+        len = midi_num_to_note(size - 1, buf, note, 0);
+        if(len <= 0) {
+            snprintf(buf, size, "?%d", note);
+        } else {
+            buf[len] = '\0';
+        }
+    }
+}
+
+/* the line shown for a string, returns its length */
+static int guitar_format_string(const GuitarString *string, unsigned int i,
+                                size_t size, char *buf) {
+    char open[16];
+    char note[16];
+
+    guitar_note_name(sizeof(open), open, string->open);
+    guitar_note_name(sizeof(note), note, string->note);
+
+    return(snprintf(buf, size, "%u (%s) Nt: %s  Vl: %d  Bd: %d  Ex: %d",
+                    i + 1, open, note, string->velocity, string->bend,
+                    string->expression));
+}
+
+static void guitar_print(GuitarState *g, const GuitarSnapshot *snap) {
     unsigned int i;
-    int size;
-    int pos = 0;
+    int pos;
+
+    pos = snprintf(buffer, sizeof(buffer), "Mode: %s",
+                   guitar_mode_to_string(guitar_get_mode(g)));
+    for(i = 0; i < snap->strings; i++) {
+        buffer[pos] = '\n';
+        pos++;
+        pos += guitar_format_string(&(snap->string[i]), i,
+                                    sizeof(buffer) - pos, &(buffer[pos]));
+    }
 
-    const char *mode = guitar_mode_to_string(guitar_get_mode(g));
-    const char *note[FIELD_ARRAY_NUM(g->string)];
+    term_print_static("%s", buffer);
+}
 
-    for(i = 0; i < FIELD_ARRAY_NUM(g->string); i++) {
-        if(g->string[i].note < 0) {
-            note[i] = "---";
-        } else {
-            size = midi_num_to_note(sizeof(buffer) - pos, &(buffer[pos]), g->string[i].note, 0);
-            if(size <= 0) {
-                size = snprintf(&(buffer[pos]), sizeof(buffer) - pos, "?%d", g->string[i].note);
-            } else {
-                buffer[pos+size] = '\0';
-                note[i] = &(buffer[pos]);
-                pos += size + 1;
+/* changes only mark what they touched, it's drawn by guitar_render() */
+static void guitar_mark_dirty(GuitarState *g, unsigned int dirty) {
+    atomic_fetch_or_explicit(&(g->dirty), dirty, memory_order_relaxed);
+}
+
+void guitar_set_render_rate(GuitarState *g, unsigned int rate) {
+    if(rate == 0) {
+        g->render_interval_ns = 0;
+    } else {
+        g->render_interval_ns = 1000000000 / rate;
+    }
+}
+
+/* draw what's changed, if it's been long enough since the last time.  Only
+ * the lines of strings which changed are redrawn and curses only sends the
+ * cells in them which are different */
+void guitar_render(GuitarState *g) {
+    GuitarSnapshot snap;
+    uint64_t now;
+    unsigned int dirty;
+    unsigned int i;
+
+    if(atomic_load_explicit(&(g->dirty), memory_order_relaxed) == 0 ||
+       term_print_mode()) {
+        return;
+    }
+
+    now = midi_time_ns();
+    if(now - g->last_render_ns < g->render_interval_ns) {
+        return;
+    }
+
+    /* anything changed after this is marked again for the next time */
+    dirty = atomic_exchange_explicit(&(g->dirty), 0, memory_order_relaxed);
+    guitar_read(g, &snap);
+
+    if(dirty & GUITAR_DIRTY_MODE) {
+        guitar_print(g, &snap);
+    } else {
+        for(i = 0; i < snap.strings; i++) {
+            if(!(dirty & (1 << i))) {
+                continue;
+            }
+            guitar_format_string(&(snap.string[i]), i, sizeof(buffer), buffer);
+            /* line 0 is the mode */
+            if(term_print_static_line(i + 1, "%s", buffer) < 0) {
+                guitar_print(g, &snap);
+                break;
             }
         }
+        term_update();
     }
 
-    term_print_static("Mode: %s\n"
-                      "1 Nt: %s  Vl: %d  Bd: %d  Ex: %d\n"
-                      "2 Nt: %s  Vl: %d  Bd: %d  Ex: %d\n"
-                      "3 Nt: %s  Vl: %d  Bd: %d  Ex: %d\n"
-                      "4 Nt: %s  Vl: %d  Bd: %d  Ex: %d\n"
-                      "5 Nt: %s  Vl: %d  Bd: %d  Ex: %d\n"
-                      "6 Nt: %s  Vl: %d  Bd: %d  Ex: %d",
-                      mode,
-                      note[0], g->string[0].velocity, g->string[0].bend, g->string[0].expression,
-                      note[1], g->string[1].velocity, g->string[1].bend, g->string[1].expression,
-                      note[2], g->string[2].velocity, g->string[2].bend, g->string[2].expression,
-                      note[3], g->string[3].velocity, g->string[3].bend, g->string[3].expression,
-                      note[4], g->string[4].velocity, g->string[4].bend, g->string[4].expression,
-                      note[5], g->string[5].velocity, g->string[5].bend, g->string[5].expression);
+    g->last_render_ns = now;
+}
+
+/* returns how long until guitar_render() should be called again to draw what's
+ * changed, or -1 if nothing has */
+int guitar_render_timeout_ms(GuitarState *g) {
+    uint64_t since;
+
+    if(atomic_load_explicit(&(g->dirty), memory_order_relaxed) == 0 ||
+       term_print_mode()) {
+        return(-1);
+    }
+
+    since = midi_time_ns() - g->last_render_ns;
+    if(since >= g->render_interval_ns) {
+        return(0);
+    }
+
+    /* round up so it isn't woken up just before it's time */
+    return((g->render_interval_ns - since + 999999) / 1000000);
 }
 
 void guitar_set_single_channel_mode(GuitarState *g, int single) {
     g->singleChannelMode = single;
+    guitar_mark_dirty(g, GUITAR_DIRTY_MODE);
     if(g->singleChannelMode) {
         term_print("Single channel mode is ON.");
     } else {
@@ -125,6 +291,7 @@ void guitar_set_single_channel_mode(GuitarState *g, int single) {
 
 void guitar_set_mpe_mode(GuitarState *g, int MPEOn) {
     g->MPEOn = MPEOn;
+    guitar_mark_dirty(g, GUITAR_DIRTY_MODE);
     if(g->MPEOn) {
         term_print("MPE mode is ON.");
     } else {
@@ -145,7 +312,7 @@ void guitar_set_bend_semitones(GuitarState *g, int semitones) {
             term_print("Bend range is now %d semitones and %d cents.",
                        g->bendRangeSemitones, g->bendRangeCents);
         } else {
-            guitar_print(g);
+            guitar_mark_dirty(g, GUITAR_DIRTY_MODE);
         }
     }
 }
@@ -157,7 +324,7 @@ void guitar_set_bend_cents(GuitarState *g, int cents) {
             term_print("Bend range is now %d semitones and %d cents.",
                        g->bendRangeSemitones, g->bendRangeCents);
         } else {
-            guitar_print(g);
+            guitar_mark_dirty(g, GUITAR_DIRTY_MODE);
         }
     }
 }
@@ -180,19 +347,14 @@ void print_note_simple(GuitarState *g, int channel, int note, int velocity, int
     }
 }
 
-void guitar_note_on(GuitarState *g, int channel, int note, int velocity) {
-    unsigned int i;
+/* which of strings a channel is for, or -1 if it's for none of them.  Any
+ * string may be on any channel in single channel mode, so it's always 0 */
+static int guitar_channel_string(GuitarState *g, unsigned int strings, int channel) {
     int foundChannel = -1;
 
     switch(guitar_get_mode(g)) {
         case GuitarModeSingleChannel:
             foundChannel = 0;
-            for(i = 0; i < FIELD_ARRAY_NUM(g->string); i++) {
-               if(g->string[i].note == -1) {
-                  foundChannel = i;
-                  break;
-               }
-            }
             break;
         case GuitarModeStringPerChannel:
             foundChannel = channel - g->firstStringChannel;
@@ -202,124 +364,397 @@ void guitar_note_on(GuitarState *g, int channel, int note, int velocity) {
             break;
     }
 
-    if(foundChannel < 0 ||
-       (unsigned long)foundChannel > FIELD_ARRAY_NUM(g->string) - 1) {
-        print_note_simple(g, channel, note, velocity, 1);
-        return;
+    if(foundChannel < 0 || (unsigned int)foundChannel >= strings) {
+        return(-1);
     }
 
-    g->string[foundChannel].note = note;
-    g->string[foundChannel].velocity = velocity;
+    return(foundChannel);
+}
 
-    if(term_print_mode()) {
-        print_note_simple(g, channel, note, velocity, 1);
-    } else {
-        guitar_print(g);
+/* the string a note's being played on, or for a note of -1, the string
+ * something for the whole channel goes to.  -1 if there's none */
+static int guitar_find_channel(GuitarState *g, int channel, int note) {
+    if(guitar_get_mode(g) != GuitarModeSingleChannel) {
+        return(guitar_channel_string(g, g->shared->state.strings, channel));
+    }
+
+    if(note < 0) {
+        return(g->last_string);
+    }
+    if(note >= GUITAR_NOTES) {
+        return(-1);
     }
+
+    return(g->note_string[note]);
 }
 
-int guitar_find_channel(GuitarState *g, int channel, int note) {
+/* the string a new note goes on, -1 if there's none */
+static int guitar_voice_alloc(GuitarState *g, int channel, int note) {
     unsigned int i;
-    int foundChannel = -1;
+    int string;
 
-    switch(guitar_get_mode(g)) {
-        case GuitarModeSingleChannel:
-            foundChannel = 0;
-            for(i = 0; i < FIELD_ARRAY_NUM(g->string); i++) {
-               if(g->string[i].note == note) {
-                  foundChannel = i;
-                  break;
-               }
-            }
-            break;
-        case GuitarModeStringPerChannel:
-            foundChannel = channel - g->firstStringChannel;
-            break;
-        case GuitarModeMPE:
-            foundChannel = channel - 1;
-            break;
+    if(guitar_get_mode(g) != GuitarModeSingleChannel) {
+        return(guitar_channel_string(g, g->shared->state.strings, channel));
     }
 
-    return(foundChannel);
+    if(note < 0 || note >= GUITAR_NOTES) {
+        return(-1);
+    }
+
+    /* played again before it was let go of */
+    string = g->note_string[note];
+    if(string >= 0) {
+        return(string);
+    }
+
+    if(g->free_strings != 0) {
+        return(__builtin_ctz(g->free_strings));
+    }
+
+    /* everything's playing, which should only happen when a note off went
+     * missing, so take the one started longest ago */
+    string = 0;
+    for(i = 1; i < g->shared->state.strings; i++) {
+        if(g->string_started[i] < g->string_started[string]) {
+            string = i;
+        }
+    }
+
+    return(string);
 }
 
-void guitar_note_off(GuitarState *g, int channel, int note, int velocity) {
-    int foundChannel = guitar_find_channel(g, channel, note);
-    if(foundChannel < 0 ||
-       (unsigned long)foundChannel > FIELD_ARRAY_NUM(g->string) - 1) {
-        print_note_simple(g, channel, note, velocity, 0);
+/* keep the voice table up to date in every mode, so it's right on switching
+ * to single channel mode with notes held */
+static void guitar_voice_stop(GuitarState *g, int string) {
+    int note = g->shared->state.string[string].note;
+
+    if(note >= 0 && note < GUITAR_NOTES && g->note_string[note] == string) {
+        g->note_string[note] = -1;
+    }
+    g->free_strings |= 1 << string;
+}
+
+static void guitar_voice_start(GuitarState *g, int string, int note) {
+    /* whatever it was playing is cut off */
+    guitar_voice_stop(g, string);
+
+    if(note >= 0 && note < GUITAR_NOTES) {
+        g->note_string[note] = string;
+    }
+    g->free_strings &= ~(1 << string);
+    g->last_string = string;
+    g->started++;
+    g->string_started[string] = g->started;
+}
+
+/* only from the thread tracking events.  Strings which went away are let go
+ * of and ones which were added are free */
+static void guitar_apply_tuning(GuitarState *g, unsigned int strings, const int *tuning) {
+    GuitarSnapshot *state = &(g->shared->state);
+    unsigned int i;
+
+    guitar_write_begin(g);
+    for(i = strings; i < state->strings; i++) {
+        guitar_voice_stop(g, i);
+        state->string[i].open = 0;
+        state->string[i].note = -1;
+        state->string[i].velocity = 0;
+        state->string[i].bend = 0;
+        state->string[i].expression = 0;
+    }
+    for(i = state->strings; i < strings; i++) {
+        g->free_strings |= 1 << i;
+    }
+    g->free_strings &= GUITAR_STRINGS_MASK(strings);
+    if((unsigned int)g->last_string >= strings) {
+        g->last_string = 0;
+    }
+    for(i = 0; i < strings; i++) {
+        state->string[i].open = tuning[i];
+    }
+    state->strings = strings;
+    guitar_write_end(g, -1, midi_time_ns());
+
+    guitar_mark_dirty(g, GUITAR_DIRTY_MODE);
+}
+
+/* pick up a tuning set from the main thread, if it can be had without
+ * waiting, otherwise it's tried again next period */
+static void guitar_check_tuning(GuitarState *g) {
+    if(!atomic_load_explicit(&(g->tuning_pending), memory_order_acquire)) {
+        return;
+    }
+    if(pthread_mutex_trylock(&(g->tuning_lock)) != 0) {
         return;
     }
 
-    g->string[foundChannel].note = -1;
-    g->string[foundChannel].velocity = velocity;
-    g->string[foundChannel].bend = 0;
-    g->string[foundChannel].expression = 0;
+    guitar_apply_tuning(g, g->pending_strings, g->pending_tuning);
+    atomic_store_explicit(&(g->tuning_pending), 0, memory_order_relaxed);
 
-    if(term_print_mode()) {
-        print_note_simple(g, channel, note, velocity, 0);
-    } else {
-        guitar_print(g);
+    pthread_mutex_unlock(&(g->tuning_lock));
+}
+
+/* change how many strings there are and what they're tuned to.  Once
+ * attached, it's handed over to the process callback which puts it in place
+ * at the start of the next period */
+void guitar_set_tuning(GuitarState *g, unsigned int strings, const int *tuning) {
+    if(strings == 0 || strings > GUITAR_MAX_STRINGS) {
+        term_print("Can't have %u strings, only 1 to %d.",
+                   strings, GUITAR_MAX_STRINGS);
+        return;
     }
+
+    g->strings = strings;
+    if(!g->attached) {
+        guitar_apply_tuning(g, strings, tuning);
+        return;
+    }
+
+    pthread_mutex_lock(&(g->tuning_lock));
+    g->pending_strings = strings;
+    memcpy(g->pending_tuning, tuning, sizeof(int) * strings);
+    atomic_store_explicit(&(g->tuning_pending), 1, memory_order_release);
+    pthread_mutex_unlock(&(g->tuning_lock));
 }
 
-int guitar_calc_bend(GuitarState *g, int bend) {
+static int guitar_calc_bend(GuitarState *g, int bend) {
     return((int)((long long int)bend *
                  MIDI_CMD_PITCHBEND_OFFSET /
                  ((long long int)(g->bendRangeSemitones) * 100 + (long long int)(g->bendRangeCents))));
 }
 
-void guitar_bend(GuitarState *g, int channel, int bend) {
+/* these change the state and return the string which changed or -1 if none
+ * did.  They may run in the process callback, so they can't print */
+static int guitar_track_note_on(GuitarState *g, uint64_t ns,
+                                int channel, int note, int velocity) {
+    int foundChannel = guitar_voice_alloc(g, channel, note);
+    if(foundChannel < 0) {
+        return(-1);
+    }
+
+    guitar_voice_start(g, foundChannel, note);
+
+    guitar_write_begin(g);
+    g->shared->state.string[foundChannel].note = note;
+    g->shared->state.string[foundChannel].velocity = velocity;
+    guitar_write_end(g, foundChannel, ns);
+    guitar_mark_dirty(g, 1 << foundChannel);
+
+    return(foundChannel);
+}
+
+static int guitar_track_note_off(GuitarState *g, uint64_t ns,
+                                 int channel, int note, int velocity) {
+    int foundChannel = guitar_find_channel(g, channel, note);
+    if(foundChannel < 0) {
+        return(-1);
+    }
+
+    guitar_voice_stop(g, foundChannel);
+
+    guitar_write_begin(g);
+    g->shared->state.string[foundChannel].note = -1;
+    g->shared->state.string[foundChannel].velocity = velocity;
+    g->shared->state.string[foundChannel].bend = 0;
+    g->shared->state.string[foundChannel].expression = 0;
+    guitar_write_end(g, foundChannel, ns);
+    guitar_mark_dirty(g, 1 << foundChannel);
+
+    return(foundChannel);
+}
+
+static int guitar_track_bend(GuitarState *g, uint64_t ns, int channel, int bend) {
     int foundChannel = guitar_find_channel(g, channel, -1);
-    if(foundChannel < 0 ||
-       (unsigned long)foundChannel > FIELD_ARRAY_NUM(g->string) - 1) {
-        term_print("Got invalid string channel %d for bend of %d!",
-                   channel, bend);
-        return;
+    if(foundChannel < 0) {
+        return(-1);
     }
 
+    guitar_write_begin(g);
     /* do this calculation on probably overly large variables to not lose
      * precision */
-    g->string[foundChannel].bend = guitar_calc_bend(g, bend);
+    g->shared->state.string[foundChannel].bend = guitar_calc_bend(g, bend);
+    guitar_write_end(g, foundChannel, ns);
+    guitar_mark_dirty(g, 1 << foundChannel);
 
-    if(term_print_mode()) {
-        term_print("Pitch bend (%d): %d", foundChannel, bend);
+    return(foundChannel);
+}
+
+static int guitar_track_expression_lsb(GuitarState *g, uint64_t ns,
+                                       int channel, int value) {
+    int foundChannel = guitar_find_channel(g, channel, -1);
+    if(foundChannel < 0) {
+        return(-1);
+    }
+
+    guitar_write_begin(g);
+    g->shared->state.string[foundChannel].expression =
+        (g->shared->state.string[foundChannel].expression & 0xFF00) |
+        (value & 0x00FF);
+    guitar_write_end(g, foundChannel, ns);
+    /* LSB seems to always indicate a change ? */
+    guitar_mark_dirty(g, 1 << foundChannel);
+
+    return(foundChannel);
+}
+
+static int guitar_track_expression_msb(GuitarState *g, uint64_t ns,
+                                       int channel, int value) {
+    int foundChannel = guitar_find_channel(g, channel, -1);
+    if(foundChannel < 0) {
+        return(-1);
+    }
+
+    guitar_write_begin(g);
+    g->shared->state.string[foundChannel].expression =
+        (g->shared->state.string[foundChannel].expression & 0x00FF) |
+        ((value & 0x00FF) << 16);
+    guitar_write_end(g, foundChannel, ns);
+
+    return(foundChannel);
+}
+
+/* the event hook, in the process callback */
+/* a tuning waiting is put in place before any events in the period */
+static void guitar_track_period(void *priv) {
+    guitar_check_tuning(priv);
+}
+
+static void guitar_track_event(void *priv, const midi_timestamp *ts,
+                               const unsigned char *buffer, size_t size) {
+    GuitarState *g = priv;
+    int channel = buffer[MIDI_CMD] & MIDI_CHANNEL_MASK;
+
+    switch(buffer[MIDI_CMD] & MIDI_CMD_MASK) {
+        case MIDI_CMD_NOTE_OFF:
+            if(size >= MIDI_CMD_NOTE_SIZE) {
+                guitar_track_note_off(g, ts->ns, channel,
+                                      buffer[MIDI_CMD_NOTE],
+                                      buffer[MIDI_CMD_NOTE_VEL]);
+            }
+            break;
+        case MIDI_CMD_NOTE_ON:
+            if(size < MIDI_CMD_NOTE_SIZE) {
+                break;
+            }
+            /* velocity 0 is a note off, so running status can carry both */
+            if(buffer[MIDI_CMD_NOTE_VEL] == 0) {
+                guitar_track_note_off(g, ts->ns, channel,
+                                      buffer[MIDI_CMD_NOTE], 0);
+            } else {
+                guitar_track_note_on(g, ts->ns, channel,
+                                     buffer[MIDI_CMD_NOTE],
+                                     buffer[MIDI_CMD_NOTE_VEL]);
+            }
+            break;
+        case MIDI_CMD_CC:
+            if(size < MIDI_CMD_CC_SIZE) {
+                break;
+            }
+            if(buffer[MIDI_CMD_CC_CONTROL] == MIDI_CC_EXPRESSION_LSB) {
+                guitar_track_expression_lsb(g, ts->ns, channel,
+                                            buffer[MIDI_CMD_CC_VALUE]);
+            } else if(buffer[MIDI_CMD_CC_CONTROL] == MIDI_CC_EXPRESSION_MSB) {
+                guitar_track_expression_msb(g, ts->ns, channel,
+                                            buffer[MIDI_CMD_CC_VALUE]);
+            }
+            break;
+        case MIDI_CMD_PITCHBEND:
+            if(size >= MIDI_CMD_PITCHBEND_SIZE) {
+                guitar_track_bend(g, ts->ns, channel,
+                                  MIDI_2BYTE_WORD(buffer[MIDI_CMD_PITCHBEND_HIGH],
+                                                  buffer[MIDI_CMD_PITCHBEND_LOW]) -
+                                  MIDI_CMD_PITCHBEND_OFFSET);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* track notes, bends and expression in the process callback as they arrive
+ * instead of when the main thread gets to them, the functions below are then
+ * left to just print them.  Must be called before midi_setup() */
+void guitar_attach(GuitarState *g) {
+    g->attached = 1;
+    midi_set_event_hook(guitar_track_event, g);
+    midi_set_period_hook(guitar_track_period, g);
+}
+
+void guitar_note_on(GuitarState *g, int channel, int note, int velocity) {
+    int foundChannel;
+
+    if(g->attached) {
+        foundChannel = guitar_channel_string(g, g->strings, channel);
+    } else if(velocity == 0) {
+        foundChannel = guitar_track_note_off(g, midi_time_ns(), channel, note, velocity);
+    } else {
+        foundChannel = guitar_track_note_on(g, midi_time_ns(), channel, note, velocity);
+    }
+
+    if(foundChannel < 0 || term_print_mode()) {
+        print_note_simple(g, channel, note, velocity, 1);
+    }
+}
+
+void guitar_note_off(GuitarState *g, int channel, int note, int velocity) {
+    int foundChannel;
+
+    if(g->attached) {
+        foundChannel = guitar_channel_string(g, g->strings, channel);
     } else {
-        guitar_print(g);
+        foundChannel = guitar_track_note_off(g, midi_time_ns(), channel, note, velocity);
+    }
+
+    if(foundChannel < 0 || term_print_mode()) {
+        print_note_simple(g, channel, note, velocity, 0);
+    }
+}
+
+void guitar_bend(GuitarState *g, int channel, int bend) {
+    int foundChannel;
+
+    if(g->attached) {
+        foundChannel = guitar_channel_string(g, g->strings, channel);
+    } else {
+        foundChannel = guitar_track_bend(g, midi_time_ns(), channel, bend);
+    }
+
+    if(foundChannel < 0) {
+        term_print("Got invalid string channel %d for bend of %d!",
+                   channel, bend);
+    } else if(term_print_mode()) {
+        term_print("Pitch bend (%d): %d", foundChannel, bend);
     }
 }
 
 void guitar_set_expression_lsb(GuitarState *g, int channel, int value) {
-    int foundChannel = guitar_find_channel(g, channel, -1);
-    if(foundChannel < 0 ||
-       (unsigned long)foundChannel > FIELD_ARRAY_NUM(g->string) - 1) {
+    int foundChannel;
+
+    if(g->attached) {
+        foundChannel = guitar_channel_string(g, g->strings, channel);
+    } else {
+        foundChannel = guitar_track_expression_lsb(g, midi_time_ns(), channel, value);
+    }
+
+    if(foundChannel < 0) {
         term_print("Got invalid string channel %d for expression LSB of %d!",
                    channel, value);
-        return;
+    } else if(term_print_mode()) {
+        term_print("Expression (%d): %d", foundChannel, value);
     }
+}
 
-    g->string[foundChannel].expression =
-        (g->string[foundChannel].expression & 0xFF00) |
-        (value & 0x00FF);
+void guitar_set_expression_msb(GuitarState *g, int channel, int value) {
+    int foundChannel;
 
-    /* LSB seems to always indicate a change ? */
-    if(term_print_mode()) {
-        term_print("Expression (%d): %d", foundChannel, value);
+    if(g->attached) {
+        foundChannel = guitar_channel_string(g, g->strings, channel);
     } else {
-        guitar_print(g);
+        foundChannel = guitar_track_expression_msb(g, midi_time_ns(), channel, value);
     }
-}
 
-void guitar_set_expression_msb(GuitarState *g, int channel, int value) {
-    int foundChannel = guitar_find_channel(g, channel, -1);
-    if(foundChannel < 0 ||
-       (unsigned long)foundChannel > FIELD_ARRAY_NUM(g->string) - 1) {
+    if(foundChannel < 0) {
         term_print("Got invalid string channel %d for expression MSB of %d!",
                    channel, value);
-        return;
     }
-
-    g->string[foundChannel].expression =
-        (g->string[foundChannel].expression & 0x00FF) |
-        ((value & 0x00FF) << 16);
 }
@@ -1,20 +1,145 @@
+#ifndef _GUITAR_H
+#define _GUITAR_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+
+/* how many times a second the state is redrawn at most */
+#define GUITAR_DEFAULT_RENDER_RATE (60)
+
+/* room for this many is set aside, how many there are comes from the
+ * instrument.  String config names only have 1 digit for the string */
+#define GUITAR_MAX_STRINGS (10)
+
 typedef struct {
-    int note;
-    int velocity;
-    int bend;
-    int expression;
+    /* open note the instrument says it's tuned to */
+    int32_t open;
+    int32_t note;
+    int32_t velocity;
+    int32_t bend;
+    int32_t expression;
+    /* events which changed this string and midi_time_ns() of the last one */
+    uint64_t events;
+    uint64_t event_ns;
 } GuitarString;
 
+/* a consistent copy of what the strings are doing, from guitar_read() */
+typedef struct {
+    /* counts every event which changed a string, so a reader can tell if
+     * anything happened since it last looked */
+    uint64_t events;
+    /* midi_time_ns() of when the last one arrived */
+    uint64_t event_ns;
+    /* how many of string are used */
+    uint32_t strings;
+    GuitarString string[GUITAR_MAX_STRINGS];
+} GuitarSnapshot;
+
+#define GUITAR_SHARED_MAGIC (0x4B54534A) /* JSTK */
+#define GUITAR_SHARED_VERSION (2)
+
+/* where the state is published, in the GuitarState or in shared memory for
+ * other processes to read, see guitar_shm.h.  Only fixed size types, so it's
+ * laid out the same for anything reading it.  It's only written by the
+ * thread tracking events, seq is odd while it's being changed */
 typedef struct {
-    int MPEOn;
-    int singleChannelMode;
-    int firstStringChannel;
-    int bendRangeSemitones;
-    int bendRangeCents;
-    GuitarString string[6];
+    /* set last, once the rest is there */
+    atomic_uint magic;
+    uint32_t version;
+    /* sizeof(GuitarShared) */
+    uint32_t size;
+    atomic_uint seq;
+    GuitarSnapshot state;
+} GuitarShared;
+
+typedef struct {
+    /* set from the main thread, read by whichever thread tracks events */
+    atomic_int MPEOn;
+    atomic_int singleChannelMode;
+    atomic_int firstStringChannel;
+    atomic_int bendRangeSemitones;
+    atomic_int bendRangeCents;
+
+    /* written by the thread tracking events, the process callback once
+     * guitar_attach() is called.  shared is local unless it's been exported */
+    GuitarShared *shared;
+    GuitarShared local;
+    char *shm_name;
+    int attached;
+
+    /* a tuning from guitar_set_tuning() waiting for the thread tracking
+     * events to pick it up, which it only tries to lock so it never waits.
+     * strings is the count last set, for the main thread */
+    pthread_mutex_t tuning_lock;
+    atomic_int tuning_pending;
+    unsigned int pending_strings;
+    int pending_tuning[GUITAR_MAX_STRINGS];
+    unsigned int strings;
+
+    /* which string notes go to in single channel mode, only touched by the
+     * thread tracking events.  A bit for each string with nothing playing,
+     * the string each note is playing on or -1, and the string played last,
+     * which bends and expression for the whole channel go to.  When they're
+     * all playing, the one started longest ago is taken */
+    unsigned int free_strings;
+    int8_t note_string[128];
+    int last_string;
+    uint64_t started;
+    uint64_t string_started[GUITAR_MAX_STRINGS];
+
+    /* what's changed since it was last drawn, a bit for each string and
+     * GUITAR_DIRTY_MODE for everything else */
+    atomic_uint dirty;
+    uint64_t render_interval_ns;
+    uint64_t last_render_ns;
 } GuitarState;
 
-GuitarState *guitar_init();
+/* a copy of the strings which is never half way through a change, without
+ * taking a lock or waiting on the thread changing them */
+static inline void guitar_shared_read(GuitarShared *shared, GuitarSnapshot *snap) {
+    unsigned int seq;
+
+    do {
+        /* it's odd while it's being changed, which only takes a moment */
+        while((seq = atomic_load_explicit(&(shared->seq), memory_order_acquire)) & 1);
+        memcpy(snap, &(shared->state), sizeof(GuitarSnapshot));
+        atomic_thread_fence(memory_order_acquire);
+    } while(atomic_load_explicit(&(shared->seq), memory_order_relaxed) != seq);
+}
+
+/* about how many tries a reader in another process could give it, a change
+ * is only a few stores */
+#define GUITAR_SHARED_READ_TRIES (100000)
+
+/* like guitar_shared_read(), for readers in other processes which can't know
+ * whether the writer is still there.  If it died part way through a change
+ * this would never stop, so it gives up after tries attempts.
+ * returns 0 on success or -1 if it was always being changed */
+static inline int guitar_shared_try_read(GuitarShared *shared, GuitarSnapshot *snap,
+                                         unsigned int tries) {
+    unsigned int seq;
+
+    for(; tries > 0; tries--) {
+        seq = atomic_load_explicit(&(shared->seq), memory_order_acquire);
+        if(seq & 1) {
+            continue;
+        }
+        memcpy(snap, &(shared->state), sizeof(GuitarSnapshot));
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&(shared->seq), memory_order_relaxed) == seq) {
+            return(0);
+        }
+    }
+
+    return(-1);
+}
+
+GuitarState *guitar_init(unsigned int strings, const int *tuning);
+void guitar_attach(GuitarState *g);
+void guitar_set_tuning(GuitarState *g, unsigned int strings, const int *tuning);
+void guitar_read(GuitarState *g, GuitarSnapshot *snap);
 void guitar_set_single_channel_mode(GuitarState *g, int single);
 void guitar_set_mpe_mode(GuitarState *g, int MPEOn);
 void guitar_set_channel(GuitarState *g, int channel);
@@ -25,3 +150,8 @@ void guitar_note_off(GuitarState *g, int channel, int note, int velocity);
 void guitar_bend(GuitarState *g, int channel, int bend);
 void guitar_set_expression_lsb(GuitarState *g, int channel, int value);
 void guitar_set_expression_msb(GuitarState *g, int channel, int value);
+void guitar_set_render_rate(GuitarState *g, unsigned int rate);
+void guitar_render(GuitarState *g);
+int guitar_render_timeout_ms(GuitarState *g);
+
+#endif
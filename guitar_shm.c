@@ -0,0 +1,153 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "terminal.h"
+#include "midi.h"
+#include "guitar_shm.h"
+
+/* move the state in to a new shared memory segment called name, which it's
+ * written to from then on.  Must be called before midi_setup().
+ * returns 0 on success or -1 on failure */
+int guitar_shm_export(GuitarState *g, const char *name) {
+    GuitarShared *shared;
+    int fd;
+
+    if(g->shm_name != NULL) {
+        term_print("Guitar state is already exported to %s.", g->shm_name);
+        return(-1);
+    }
+
+    g->shm_name = midi_copy_string(name);
+    if(g->shm_name == NULL) {
+        term_print("Failed to allocate memory!");
+        return(-1);
+    }
+
+    /* one left behind by a run which didn't exit cleanly may still be mapped
+     * by readers, truncating it would zero it under them.  They're left with
+     * the old one and a new one is made */
+    if(shm_unlink(name) < 0 && errno != ENOENT) {
+        term_print("Failed to remove old shared memory %s: %s", name, strerror(errno));
+        goto error_free_name;
+    }
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0) {
+        term_print("Failed to open shared memory %s: %s", name, strerror(errno));
+        goto error_free_name;
+    }
+    if(ftruncate(fd, sizeof(GuitarShared)) < 0) {
+        term_print("Failed to size shared memory %s: %s", name, strerror(errno));
+        goto error_close;
+    }
+    shared = mmap(NULL, sizeof(GuitarShared), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, fd, 0);
+    if(shared == MAP_FAILED) {
+        term_print("Failed to map shared memory %s: %s", name, strerror(errno));
+        goto error_close;
+    }
+    close(fd);
+
+    /* it starts out zeroed and readers check the magic number, so it goes in
+     * once the rest is there */
+    shared->version = g->shared->version;
+    shared->size = g->shared->size;
+    atomic_store_explicit(&(shared->seq),
+                          atomic_load_explicit(&(g->shared->seq), memory_order_relaxed),
+                          memory_order_relaxed);
+    memcpy(&(shared->state), &(g->shared->state), sizeof(GuitarSnapshot));
+    atomic_store_explicit(&(shared->magic), GUITAR_SHARED_MAGIC, memory_order_release);
+
+    g->shared = shared;
+
+    return(0);
+
+error_close:
+    close(fd);
+    shm_unlink(name);
+error_free_name:
+    free(g->shm_name);
+    g->shm_name = NULL;
+    return(-1);
+}
+
+/* move the state back and remove the segment, readers which still have it
+ * mapped are left with the last state.  Only after midi_cleanup(), once
+ * nothing is writing to it any more */
+void guitar_shm_unexport(GuitarState *g) {
+    if(g->shm_name == NULL) {
+        return;
+    }
+
+    memcpy(&(g->local.state), &(g->shared->state), sizeof(GuitarSnapshot));
+    munmap(g->shared, sizeof(GuitarShared));
+    g->shared = &(g->local);
+
+    shm_unlink(g->shm_name);
+    free(g->shm_name);
+    g->shm_name = NULL;
+}
+
+/* for readers, map a segment made by guitar_shm_export() read only.
+ * returns NULL if it isn't there or isn't this version, errno says which */
+GuitarShared *guitar_shm_map(const char *name) {
+    GuitarShared *shared;
+    struct stat st;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0) {
+        return(NULL);
+    }
+    if(fstat(fd, &st) < 0) {
+        close(fd);
+        return(NULL);
+    }
+    if(st.st_size < (off_t)sizeof(GuitarShared)) {
+        close(fd);
+        errno = EPROTO;
+        return(NULL);
+    }
+    shared = mmap(NULL, sizeof(GuitarShared), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(shared == MAP_FAILED) {
+        return(NULL);
+    }
+
+    if(atomic_load_explicit(&(shared->magic), memory_order_acquire) != GUITAR_SHARED_MAGIC ||
+       shared->version != GUITAR_SHARED_VERSION ||
+       shared->size != sizeof(GuitarShared)) {
+        munmap(shared, sizeof(GuitarShared));
+        errno = EPROTO;
+        return(NULL);
+    }
+
+    return(shared);
+}
+
+void guitar_shm_unmap(GuitarShared *shared) {
+    munmap(shared, sizeof(GuitarShared));
+}
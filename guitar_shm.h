@@ -0,0 +1,42 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GUITAR_SHM_H
+#define _GUITAR_SHM_H
+
+#include "guitar.h"
+
+/* the live state of the strings published in a POSIX shared memory segment,
+ * for visualizers and such running as their own processes.  It's the
+ * GuitarShared the process callback writes to directly, so it's as current as
+ * it gets and readers cost the writer nothing no matter how many there are or
+ * how often they read.  A reader maps it with guitar_shm_map() and calls
+ * guitar_shared_try_read() for a consistent copy, that's only memory reads and
+ * can be done as often as it likes.  It fails instead of waiting forever if
+ * jamstikctl died part way through a change.  snap.events or a string's events
+ * changing says something happened. */
+
+#define GUITAR_SHM_DEFAULT_NAME "/jamstikctl"
+
+int guitar_shm_export(GuitarState *g, const char *name);
+void guitar_shm_unexport(GuitarState *g);
+GuitarShared *guitar_shm_map(const char *name);
+void guitar_shm_unmap(GuitarShared *shared);
+
+#endif
@@ -0,0 +1,242 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "terminal.h"
+#include "instrument.h"
+
+/* in the schema the string is the digit after the S */
+#define INSTRUMENT_SCHEMA_NOTE "S0__NOTE"
+#define INSTRUMENT_SCHEMA_STRING_OFFSET (1)
+
+const Instrument INSTRUMENTS[] = {
+    { "guitar", 6, { 40, 45, 50, 55, 59, 64 } },
+    { "guitar7", 7, { 35, 40, 45, 50, 55, 59, 64 } },
+    { "guitar8", 8, { 30, 35, 40, 45, 50, 55, 59, 64 } },
+    { "bass", 4, { 28, 33, 38, 43 } },
+    { "bass5", 5, { 23, 28, 33, 38, 43 } },
+    { "bass6", 6, { 23, 28, 33, 38, 43, 48 } },
+    { "", 0, { 0 } }
+};
+
+const Instrument *instrument_find(const char *name) {
+    unsigned int i;
+
+    for(i = 0; INSTRUMENTS[i].strings != 0; i++) {
+        if(strcmp(INSTRUMENTS[i].name, name) == 0) {
+            return(&(INSTRUMENTS[i]));
+        }
+    }
+
+    return(NULL);
+}
+
+/* the first one with this many strings */
+const Instrument *instrument_find_strings(unsigned int strings) {
+    unsigned int i;
+
+    for(i = 0; INSTRUMENTS[i].strings != 0; i++) {
+        if(INSTRUMENTS[i].strings == strings) {
+            return(&(INSTRUMENTS[i]));
+        }
+    }
+
+    return(NULL);
+}
+
+static int instrument_parse_tuning(Instrument *inst, char *pos,
+                                   const char *path, unsigned int lineno) {
+    char *end;
+    long note;
+
+    inst->strings = 0;
+    for(;;) {
+        while(isspace(*pos)) {
+            pos++;
+        }
+        if(*pos == '\0') {
+            break;
+        }
+
+        if(inst->strings == INSTRUMENT_MAX_STRINGS) {
+            term_print("%s:%u: More than %d strings.",
+                       path, lineno, INSTRUMENT_MAX_STRINGS);
+            return(-1);
+        }
+        errno = 0;
+        note = strtol(pos, &end, 10);
+        if(end == pos || errno != 0 || note < 0 || note > 127 ||
+           (*end != '\0' && !isspace(*end))) {
+            term_print("%s:%u: Expected a note number from 0 to 127.",
+                       path, lineno);
+            return(-1);
+        }
+        inst->tuning[inst->strings] = note;
+        inst->strings++;
+        pos = end;
+    }
+
+    if(inst->strings == 0) {
+        term_print("%s:%u: No strings.", path, lineno);
+        return(-1);
+    }
+
+    return(0);
+}
+
+/* returns 0 on success or -1 on failure */
+int instrument_load(Instrument *inst, const char *path) {
+    FILE *in;
+    char line[INSTRUMENT_MAX_LINE];
+    char *pos;
+    char *key;
+    size_t len;
+    unsigned int lineno = 0;
+
+    in = fopen(path, "r");
+    if(in == NULL) {
+        term_print("Failed to open instrument %s.", path);
+        return(-1);
+    }
+
+    snprintf(inst->name, sizeof(inst->name), "%.*s",
+             (int)sizeof(inst->name) - 1, path);
+    inst->strings = 0;
+
+    while(fgets(line, sizeof(line), in) != NULL) {
+        lineno++;
+
+        pos = line;
+        while(isspace(*pos)) {
+            pos++;
+        }
+        if(*pos == '\0' || *pos == '#') {
+            continue;
+        }
+
+        key = pos;
+        while(*pos != '\0' && !isspace(*pos)) {
+            pos++;
+        }
+        if(*pos != '\0') {
+            *pos = '\0';
+            pos++;
+        }
+
+        if(strcmp(key, "name") == 0) {
+            while(isspace(*pos)) {
+                pos++;
+            }
+            len = strlen(pos);
+            while(len > 0 && isspace(pos[len - 1])) {
+                len--;
+            }
+            pos[len] = '\0';
+            snprintf(inst->name, sizeof(inst->name), "%.*s",
+                     (int)sizeof(inst->name) - 1, pos);
+        } else if(strcmp(key, "tuning") == 0) {
+            if(instrument_parse_tuning(inst, pos, path, lineno) < 0) {
+                goto error;
+            }
+        } else {
+            term_print("%s:%u: Unknown setting %s.", path, lineno, key);
+            goto error;
+        }
+    }
+    if(ferror(in)) {
+        term_print("Failed to read instrument %s.", path);
+        goto error;
+    }
+    if(inst->strings == 0) {
+        term_print("Instrument %s has no tuning.", path);
+        goto error;
+    }
+
+    fclose(in);
+
+    return(0);
+
+error:
+    fclose(in);
+    return(-1);
+}
+
+/* a built in one by name, or otherwise a file.
+ * returns 0 on success or -1 on failure */
+int instrument_get(Instrument *inst, const char *name) {
+    const Instrument *builtin;
+
+    builtin = instrument_find(name);
+    if(builtin != NULL) {
+        *inst = *builtin;
+        return(0);
+    }
+
+    return(instrument_load(inst, name));
+}
+
+/* one string for each of S0__NOTE, S1__NOTE and on in the schema, tuned to
+ * their values where they've been read, otherwise to a built in instrument with
+ * as many strings, if there is one.
+ * returns the number of strings or -1 if the schema has none */
+int instrument_from_schema(Instrument *inst, JsInfo *js) {
+    char name[] = INSTRUMENT_SCHEMA_NOTE;
+    const Instrument *builtin;
+    JsConfig *config;
+    unsigned int i;
+
+    for(i = 0; i < INSTRUMENT_MAX_STRINGS; i++) {
+        name[INSTRUMENT_SCHEMA_STRING_OFFSET] = '0' + i;
+        if(js_config_find(js, name) == NULL) {
+            break;
+        }
+    }
+    if(i == 0) {
+        return(-1);
+    }
+
+    builtin = instrument_find_strings(i);
+    if(builtin != NULL) {
+        *inst = *builtin;
+    } else {
+        snprintf(inst->name, sizeof(inst->name), "%u string", i);
+        memset(inst->tuning, 0, sizeof(inst->tuning));
+        inst->strings = i;
+    }
+
+    for(i = 0; i < inst->strings; i++) {
+        name[INSTRUMENT_SCHEMA_STRING_OFFSET] = '0' + i;
+        config = js_config_find(js, name);
+        if(!config->validValue) {
+            continue;
+        }
+        if(js_config_get_type_is_signed(config->Typ)) {
+            inst->tuning[i] = config->val.sint;
+        } else {
+            inst->tuning[i] = config->val.uint;
+        }
+    }
+
+    return(inst->strings);
+}
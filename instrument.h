@@ -0,0 +1,54 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _INSTRUMENT_H
+#define _INSTRUMENT_H
+
+#include "guitar.h"
+#include "json_schema.h"
+
+/* how many strings and what they're tuned to.  One is picked by name from the
+ * built in ones, loaded from a file, or made from the Sx__NOTE entries in the
+ * schema.  A file has a "name" line and a "tuning" line of the open note of
+ * each string as MIDI note numbers, lowest string first, blank lines and lines
+ * starting with # are ignored:
+ * name 7 string
+ * tuning 35 40 45 50 55 59 64 */
+
+#define INSTRUMENT_MAX_STRINGS GUITAR_MAX_STRINGS
+#define INSTRUMENT_MAX_NAME (32)
+#define INSTRUMENT_MAX_LINE (128)
+#define INSTRUMENT_DEFAULT "guitar"
+
+typedef struct {
+    char name[INSTRUMENT_MAX_NAME];
+    unsigned int strings;
+    int tuning[INSTRUMENT_MAX_STRINGS];
+} Instrument;
+
+/* ends with one with no strings */
+extern const Instrument INSTRUMENTS[];
+
+const Instrument *instrument_find(const char *name);
+const Instrument *instrument_find_strings(unsigned int strings);
+int instrument_load(Instrument *inst, const char *path);
+int instrument_get(Instrument *inst, const char *name);
+int instrument_from_schema(Instrument *inst, JsInfo *js);
+
+#endif
@@ -18,8 +18,17 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef JS_SCHEMA_JSONC
 #include <json-c/json.h>
+#endif
 
 #include "terminal.h"
 #include "json_schema.h"
@@ -34,75 +43,76 @@ typedef enum {
     ttReadOnlyDecimal
 } JsControlType;
 
-#define SF_ENGINEERING (1)
-#define SF_ADVANCED (2)
-#define SF_CRITICAL (4)
-#define SF_BETA (8)
-#define SF_NEVERSHOW (16)
-#define SF_WIFIONLY (32)
-#define SF_BTONLY (64)
-#define SF_MAX_FLAG SF_BTONLY
-
-const size_t JS_VALUE_SIZES[] = {
-    1, 2, 5, 5, 0, 0, 3, 3, 10, 10
+const char JS_FINGERPRINT_NAMES[JS_FINGERPRINT_ITEMS][JS_CONFIG_NAME_LEN+1] = {
+    "HWDEVTYP",
+    "FWREVMAJ",
+    "FWREVMIN",
+    "FWDSPMAJ",
+    "FWDSPMIN"
 };
 
+#define JS_CACHE_MAGIC "JSSCHEMA"
+#define JS_CACHE_VERSION (1)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    /* refuse caches from builds with a different layout */
+    uint32_t config_size;
+    uint32_t meta_size;
+    uint32_t config_count;
+    uint32_t category_count;
+    uint32_t arena_used;
+    uint64_t fingerprint[JS_FINGERPRINT_ITEMS];
+    unsigned int categories[JS_MAX_CATEGORIES];
+} JsCacheHeader;
+
+/* numeric codecs for JS_TYPES, each with its width constant so the packed
+ * value kernel unrolls */
+#define JS_TYPE_CODEC(CODEC, BITS, SIGNED) \
+    static uint64_t js_decode_##CODEC(const unsigned char *buf) { \
+        uint64_t val = decode_packed(buf, (BITS)); \
+        return((SIGNED) ? (uint64_t)packed_sign_extend(val, (BITS)) : val); \
+    } \
+    static void js_encode_##CODEC(uint64_t val, unsigned char *buf) { \
+        encode_packed(val, buf, (BITS)); \
+    }
+
+JS_TYPE_CODEC(uint7, 7, 0)
+JS_TYPE_CODEC(uint8, 8, 0)
+JS_TYPE_CODEC(uint16, 16, 0)
+JS_TYPE_CODEC(int16, 16, 1)
+JS_TYPE_CODEC(uint32, 32, 0)
+JS_TYPE_CODEC(int32, 32, 1)
+JS_TYPE_CODEC(uint64, 64, 0)
+JS_TYPE_CODEC(int64, 64, 1)
+
+/* text goes in the arena instead */
+#define js_decode_text NULL
+#define js_encode_text NULL
+
+#define JS_TYPE_INFO_ENTRY(TYPE, SHORT, NAME, SIZE, BITS, NUMERIC, SIGNED, CODEC) \
+    [JsType##TYPE] = {SHORT, NAME, SIZE, BITS, NUMERIC, SIGNED, \
+                      js_decode_##CODEC, js_encode_##CODEC},
+const JsTypeInfo JS_TYPE_INFO[JsTypeMax] = {
+    JS_TYPES(JS_TYPE_INFO_ENTRY)
+};
+#undef JS_TYPE_INFO_ENTRY
+
 const char *js_config_type_to_name(JsType type) {
-    switch(type) {
-        case JsTypeUInt7:
-            return("unsigned 7 bit");
-        case JsTypeUInt8:
-            return("unsigned 8 bit (2 byte packed)");
-        case JsTypeUInt32:
-            return("unsigned 32 bit (5 byte packed)");
-        case JsTypeInt32:
-            return("signed 32 bit (5 byte packed)");
-        case JsTypeASCII7:
-            return("7 bit ASCII");
-        case JsTypeASCII8:
-            return("8 bit ASCII (packed)");
-        case JsTypeInt16:
-            return("signed 16 bit (3 byte packed)");
-        case JsTypeUInt16:
-            return("unsigned 16 bit (3 byte packed)");
-        case JsTypeInt64:
-            return("signed 64 bit (9 byte packed ?)");
-        case JsTypeUInt64:
-            return("unsigned 64 bit (9 byte packed ?)");
-        default:
-            break;
+    if(!js_config_get_type_is_valid(type)) {
+        return("unknown");
     }
 
-    return("unknown");
+    return(JS_TYPE_INFO[type].name);
 }
 
 const char *js_config_type_to_short_name(JsType type) {
-    switch(type) {
-        case JsTypeUInt7:
-            return("uint7");
-        case JsTypeUInt8:
-            return("uint8");
-        case JsTypeUInt32:
-            return("uint32");
-        case JsTypeInt32:
-            return("int32");
-        case JsTypeASCII7:
-            return("ascii7");
-        case JsTypeASCII8:
-            return("ascii8");
-        case JsTypeInt16:
-            return("int16");
-        case JsTypeUInt16:
-            return("uint16");
-        case JsTypeInt64:
-            return("int64");
-        case JsTypeUInt64:
-            return("uint64");
-        default:
-            break;
+    if(!js_config_get_type_is_valid(type)) {
+        return("unknown");
     }
 
-    return("unknown");
+    return(JS_TYPE_INFO[type].short_name);
 }
 
 const char *js_config_control_to_name(JsControlType control) {
@@ -145,129 +155,67 @@ const char *js_config_flag_to_name(int flag) {
     return("unknown");
 }
 
-int js_config_get_type_is_valid(JsType type) {
-    if(type < 0 || type >= JsTypeMax) {
-        return(0);
-    }
-
-    return(1);
+void default_config(JsConfig *config, JsConfigMeta *meta) {
+    config->CC.key = 0;
+    config->Typ = -1;
+    config->validValue = 0;
+    config->val.uint = 0;
+    meta->Desc = 0;
+    meta->Lo.uint = 0;
+    meta->Hi.uint = 0;
+    meta->Step = 0;
+    meta->TT = -1;
+    meta->Cat = -1;
+    meta->F = -1;
 }
 
-size_t js_config_get_type_size(JsType type) {
-    if(!js_config_get_type_is_valid(type)) {
-        return(-1);
-    }
+/* make sure there's room for at least size more bytes */
+static int js_cache_unmap(JsInfo *js);
 
-    return(JS_VALUE_SIZES[type]);
-}
+static int js_arena_reserve(JsInfo *js, size_t size) {
+    char *arena;
+    size_t newsize;
 
-int js_config_get_type_bits(JsType type) {
-    switch(type) {
-        case JsTypeUInt7:
-            return(7);
-        case JsTypeUInt8:
-            return(8);
-        case JsTypeUInt32:
-        case JsTypeInt32:
-            return(32);
-        case JsTypeASCII7:
-            return(0);
-        case JsTypeASCII8:
-            return(0);
-        case JsTypeInt16:
-        case JsTypeUInt16:
-            return(16);
-        case JsTypeInt64:
-        case JsTypeUInt64:
-            return(64);
-        default:
-            break;
+    if(js->arena_used + size <= js->arena_size) {
+        return(0);
     }
 
-    return(-1);
-}
-
-int js_config_get_type_is_numeric(JsType type) {
-    switch(type) {
-        case JsTypeUInt7:
-        case JsTypeUInt8:
-        case JsTypeUInt16:
-        case JsTypeUInt32:
-        case JsTypeUInt64:
-        case JsTypeInt16:
-        case JsTypeInt32:
-        case JsTypeInt64:
-            return(1);
-        case JsTypeASCII7:
-        case JsTypeASCII8:
-            return(0);
-        default:
-            break;
+    if(js_cache_unmap(js) < 0) {
+        return(-1);
     }
+    newsize = js->arena_size;
 
-    return(-1);
-}
-
-int js_config_get_type_is_signed(JsType type) {
-    switch(type) {
-        case JsTypeUInt7:
-        case JsTypeUInt8:
-        case JsTypeUInt16:
-        case JsTypeUInt32:
-        case JsTypeUInt64:
-            return(0);
-        case JsTypeInt16:
-        case JsTypeInt32:
-        case JsTypeInt64:
-            return(1);
-        default:
-            break;
+    while(js->arena_used + size > newsize) {
+        newsize *= 2;
     }
+    arena = realloc(js->arena, newsize);
+    if(arena == NULL) {
+        term_print("Failed to allocate memory!");
+        return(-1);
+    }
+    js->arena = arena;
+    js->arena_size = newsize;
 
-    return(-1);
+    return(0);
 }
 
-json_object *json_tokenize_whole_string(size_t len, const unsigned char *buf) {
-    json_tokener *tok = json_tokener_new();
-    json_object *jobj = NULL;
-    enum json_tokener_error jerr;
-    size_t parsed = 0;
-
-    do {
-        jobj = json_tokener_parse_ex(tok, (char *)&(buf[parsed]), len);
-        jerr = json_tokener_get_error(tok);
-        parsed = json_tokener_get_parse_end(tok);
-    } while(jerr == json_tokener_continue);
-    if(jerr != json_tokener_success) {
-        term_print("Error: %s", json_tokener_error_desc(jerr));
-        return(NULL);
-    }
-
-    if(parsed < len) {
-        term_print("Extra chars %lu  parsed %lu", len - parsed, parsed);
+/* strings are never freed individually, so replacing a text value leaves
+ * the old one behind, but they're rare and small */
+static int js_arena_add(JsInfo *js, const char *str, size_t len, unsigned int *offset) {
+    if(js_arena_reserve(js, len + 1) < 0) {
+        return(-1);
     }
 
-    json_tokener_free(tok);
-
-    return(jobj);
-}
+    memcpy(&(js->arena[js->arena_used]), str, len);
+    js->arena[js->arena_used + len] = '\0';
+    *offset = js->arena_used;
+    js->arena_used += len + 1;
 
-void default_config(JsConfig *config) {
-    config->CC = NULL;
-    config->Desc = NULL;
-    config->Typ = -1;
-    config->Lo.uint = 0;
-    config->Hi.uint = 0;
-    config->Step = 0;
-    config->TT = -1;
-    config->Cat = -1;
-    config->F = -1;
-    config->validValue = 0;
+    return(0);
 }
 
 int find_category(JsInfo *js, const char *name) {
     unsigned int i;
-    char **categories;
 
     if(strlen(name) != JS_SCHEMA_NAME_LEN) {
         term_print("Get category in schema that's the wrong length, should be JSON_SCHEMA_NAME_LEN!");
@@ -275,24 +223,83 @@ int find_category(JsInfo *js, const char *name) {
     }
 
     for(i = 0; i < js->category_count; i++) {
-        if(strncmp(js->categories[i], name, JS_SCHEMA_NAME_LEN+1) == 0) {
+        if(strncmp(&(js->arena[js->categories[i]]), name, JS_SCHEMA_NAME_LEN+1) == 0) {
             return(i);
         }
     }
 
-    categories = realloc(js->categories, sizeof(char **) * (js->category_count + 1));
-    if(categories == NULL) {
-        term_print("Failed to allocate memory!");
+    if(js->category_count == JS_MAX_CATEGORIES) {
+        term_print("Too many categories in schema!");
         return(-1);
     }
-    js->categories = categories;
 
-    js->categories[js->category_count] = midi_copy_string(name);
+    if(js_arena_add(js, name, JS_SCHEMA_NAME_LEN,
+                    &(js->categories[js->category_count])) < 0) {
+        return(-1);
+    }
     js->category_count++;
 
     return(js->category_count-1);
 }
 
+static uint64_t js_config_key(const char *name) {
+    JsName key;
+
+    memcpy(key.name, name, sizeof(key.name));
+
+    return(key.key);
+}
+
+static unsigned int js_index_slot(JsInfo *js, uint64_t key) {
+    /* fibonacci hashing, the names are all uppercase letters and
+     * underscores so the low bits on their own are poor */
+    return(((key * 0x9E3779B97F4A7C15ull) >> 32) & (js->index_size - 1));
+}
+
+static void js_index_insert(JsInfo *js, unsigned int i) {
+    uint64_t key = js->config[i].CC.key;
+    unsigned int slot = js_index_slot(js, key);
+
+    while(js->index[slot].config != 0) {
+        if(js->index[slot].key == key) {
+            /* keep the first, same as a linear search would find */
+            return;
+        }
+        slot = (slot + 1) & (js->index_size - 1);
+    }
+
+    js->index[slot].key = key;
+    js->index[slot].config = i + 1;
+}
+
+/* (re)build the index with room for at least count items */
+static int js_index_build(JsInfo *js, unsigned int count) {
+    JsIndexEntry *index;
+    unsigned int size = 16;
+    unsigned int i;
+
+    /* keep it at most half full */
+    while(size < count * 2) {
+        size *= 2;
+    }
+
+    index = calloc(size, sizeof(JsIndexEntry));
+    if(index == NULL) {
+        term_print("Failed to allocate memory for config index.");
+        return(-1);
+    }
+
+    free(js->index);
+    js->index = index;
+    js->index_size = size;
+
+    for(i = 0; i < js->config_count; i++) {
+        js_index_insert(js, i);
+    }
+
+    return(0);
+}
+
 JsInfo *js_init() {
     JsInfo *js;
 
@@ -304,211 +311,874 @@ JsInfo *js_init() {
 
     js->config_count = 0;
     js->config = NULL;
+    js->meta = NULL;
+    js->index_size = 0;
+    js->index = NULL;
     js->category_count = 0;
-    js->categories = NULL;
+
+    js->arena_size = 256;
+    js->arena = malloc(js->arena_size);
+    if(js->arena == NULL) {
+        term_print("Failed to allocate memory!");
+        free(js);
+        return(NULL);
+    }
+    js->arena[0] = '\0';
+    js->arena_used = 1;
+
+    js->cache_map = NULL;
+    js->cache_map_size = 0;
+    memset(js->cache_fingerprint, 0, sizeof(js->cache_fingerprint));
+
+    js->stream.tok = NULL;
+    js->stream.config_alloc = 0;
 
     return(js);
 }
 
-int js_parse_json_schema(JsInfo *js, size_t size, unsigned char *buf) {
-    json_object *jobj;
-    json_object *schema;
-    json_object *json_item;
+typedef enum {
+    JsLexNone = 0,
+    JsLexString,
+    JsLexNumber,
+    JsLexLiteral
+} JsLex;
+
+typedef enum {
+    JsStrSkip = 0,
+    JsStrKey,
+    JsStrValue
+} JsStrDest;
+
+typedef enum {
+    JsFieldUnknown = 0,
+    JsFieldCC,
+    JsFieldDesc,
+    JsFieldTyp,
+    JsFieldLo,
+    JsFieldHi,
+    JsFieldStep,
+    JsFieldTT,
+    JsFieldCat,
+    JsFieldF
+} JsField;
+
+const char *JS_FIELD_NAMES[] = {
+    "unknown", "CC", "Desc", "Typ", "Lo", "Hi", "Step", "TT", "Cat", "F"
+};
+
+static JsSchemaParser js_schema_parser = JsSchemaParserBuiltin;
+
+/* json-c is only kept around to compare against or fall back on if the
+ * built in parser chokes on something */
+int js_set_schema_parser(JsSchemaParser parser) {
+#ifndef JS_SCHEMA_JSONC
+    if(parser == JsSchemaParserJsonC) {
+        term_print("Built without json-c.");
+        return(-1);
+    }
+#endif
+    js_schema_parser = parser;
+
+    return(0);
+}
+
+/* make room for and set up the next config, which isn't counted until
+ * it's finished */
+static int js_schema_item_begin(JsInfo *js) {
+    void *tmp;
+    unsigned int alloc;
+
+    if(js->config_count == js->stream.config_alloc) {
+        alloc = js->stream.config_alloc == 0 ? 64 : js->stream.config_alloc * 2;
+        tmp = realloc(js->config, sizeof(JsConfig) * alloc);
+        if(tmp == NULL) {
+            term_print("Failed to allocate memory for schema list.");
+            return(-1);
+        }
+        js->config = tmp;
+        tmp = realloc(js->meta, sizeof(JsConfigMeta) * alloc);
+        if(tmp == NULL) {
+            term_print("Failed to allocate memory for schema list.");
+            return(-1);
+        }
+        js->meta = tmp;
+        js->stream.config_alloc = alloc;
+    }
+    default_config(&(js->config[js->config_count]), &(js->meta[js->config_count]));
+
+    return(0);
+}
+
+static int js_schema_item_end(JsInfo *js) {
+    /* it can be looked up right away, before the rest arrives */
+    if((js->config_count + 1) * 2 > js->index_size &&
+       js_index_build(js, js->config_count + 1) < 0) {
+        return(-1);
+    }
+    js->config_count++;
+    js_index_insert(js, js->config_count - 1);
+
+    return(0);
+}
+
+#ifdef JS_SCHEMA_JSONC
+/* fill in the next config from one object in the schema array */
+static int js_schema_item_jsonc(JsInfo *js, json_object *json_item) {
     struct json_object_iterator schema_iter, schema_iter_end;
     const char *item_name;
     json_object *item_value;
-    json_bool json_got;
     const char *json_string;
     int category;
-    unsigned int i;
+    JsConfig *config = &(js->config[js->config_count]);
+    JsConfigMeta *meta = &(js->meta[js->config_count]);
 
-    json_object *lo_value;
-    json_object *hi_value;
+    json_object *lo_value = NULL;
+    json_object *hi_value = NULL;
 
-    /* make it safe to pass to json-c */
-    buf[size - MIDI_SYSEX_TAIL] = '\0';
-    buf = &(buf[JS_SCHEMA_START]);
+    if(json_object_get_type(json_item) != json_type_object) {
+        term_print("Schema item type isn't object.");
+        return(-1);
+    }
 
-    jobj = json_tokenize_whole_string(size - JS_SCHEMA_START - MIDI_SYSEX_TAIL, buf);
-    if(jobj == NULL) {
-        term_print("Couldn't parse JSON string.");
-        goto error;
+    schema_iter = json_object_iter_begin(json_item);
+    schema_iter_end = json_object_iter_end(json_item);
+    while(!json_object_iter_equal(&schema_iter, &schema_iter_end)) {
+        item_name = json_object_iter_peek_name(&schema_iter);
+        item_value = json_object_iter_peek_value(&schema_iter);
+        if(strcmp(item_name, "CC") == 0) {
+            if(json_object_get_type(item_value) != json_type_string) {
+                term_print("Item CC is not string.");
+                return(-1);
+            }
+            json_string = json_object_get_string(item_value);
+            if(strlen(json_string) != JS_SCHEMA_NAME_LEN) {
+                term_print("Get name in schema that's the wrong length, should be JSON_SCHEMA_NAME_LEN!");
+                return(-1);
+            }
+            memcpy(config->CC.name, json_string, JS_CONFIG_NAME_LEN);
+        } else if(strcmp(item_name, "Desc") == 0) {
+            if(json_object_get_type(item_value) != json_type_string) {
+                term_print("Item Desc is not string.");
+                return(-1);
+            }
+            json_string = json_object_get_string(item_value);
+            if(js_arena_add(js, json_string, strlen(json_string), &(meta->Desc)) < 0) {
+                return(-1);
+            }
+        } else if(strcmp(item_name, "Typ") == 0) {
+            if(json_object_get_type(item_value) != json_type_int) {
+                term_print("Item Typ is not int.");
+                return(-1);
+            }
+            config->Typ = json_object_get_int(item_value);
+            if(!js_config_get_type_is_valid(config->Typ)) {
+                term_print("Got unknown/invalid type %i!",
+                           config->Typ);
+                return(-1);
+            }
+        } else if(strcmp(item_name, "Lo") == 0) {
+            lo_value = item_value;
+        } else if(strcmp(item_name, "Hi") == 0) {
+            hi_value = item_value;
+        } else if(strcmp(item_name, "Step") == 0) {
+            if(json_object_get_type(item_value) != json_type_int) {
+                term_print("Item Step is not int.");
+                return(-1);
+            }
+            meta->Step = json_object_get_int(item_value);
+        } else if(strcmp(item_name, "TT") == 0) {
+            if(json_object_get_type(item_value) != json_type_int) {
+                term_print("Item TT is not int.");
+                return(-1);
+            }
+            meta->TT = json_object_get_int(item_value);
+        } else if(strcmp(item_name, "Cat") == 0) {
+            if(json_object_get_type(item_value) != json_type_string) {
+                term_print("Item Cat is not string.");
+                return(-1);
+            }
+            json_string = json_object_get_string(item_value);
+            category = find_category(js, json_string);
+            if(category < 0) {
+                return(-1);
+            }
+            meta->Cat = category;
+        } else if(strcmp(item_name, "F") == 0) {
+            if(json_object_get_type(item_value) != json_type_int) {
+                term_print("Item F is not int.");
+                return(-1);
+            }
+            meta->F = json_object_get_int(item_value);
+        } else {
+            term_print("Unknown field %s type %s.",
+                       item_name, json_type_to_name(json_object_get_type(item_value)));
+        }
+        json_object_iter_next(&schema_iter);
+    }
+    if(lo_value != NULL) {
+        if(js_config_get_type_is_signed(config->Typ)) {
+            meta->Lo.sint = json_object_get_int64(lo_value);
+        } else {
+            meta->Lo.uint = json_object_get_uint64(lo_value);
+        }
+    }
+    if(hi_value != NULL) {
+        if(js_config_get_type_is_signed(config->Typ)) {
+            meta->Hi.sint = json_object_get_int64(hi_value);
+        } else {
+            meta->Hi.uint = json_object_get_uint64(hi_value);
+        }
     }
 
-    json_got = json_object_object_get_ex(jobj, "Schema", &schema);
-    if(!json_got) {
-        term_print("Couldn't get schema.");
-        goto error_put_json;
+    return(js_schema_item_end(js));
+}
+
+/* hand a piece of the current item to json-c, if it completes the item it's
+ * added to the schema */
+static int js_schema_stream_jsonc(JsInfo *js, size_t size, const unsigned char *buf) {
+    json_object *jobj;
+    enum json_tokener_error jerr;
+    int ret;
+
+    jobj = json_tokener_parse_ex(js->stream.tok, (const char *)buf, size);
+    jerr = json_tokener_get_error(js->stream.tok);
+    if(jerr == json_tokener_continue) {
+        return(0);
     }
-    if(json_object_get_type(schema) != json_type_array) {
-        term_print("Schema type isn't array.");
-        goto error_put_json;
+    if(jerr != json_tokener_success) {
+        term_print("Error: %s", json_tokener_error_desc(jerr));
+        return(-1);
     }
-    js->config_count = json_object_array_length(schema);
-    js->config = malloc(sizeof(JsConfig) * js->config_count);
-    if(js->config == NULL) {
-        term_print("Failed to allocate memory for schema list.");
-        goto error_put_json;
+
+    ret = js_schema_item_jsonc(js, jobj);
+    json_object_put(jobj);
+    json_tokener_reset(js->stream.tok);
+
+    return(ret);
+}
+#endif
+
+/* keys are all different in the first character or the length */
+static JsField js_schema_field(const char *key, unsigned int len) {
+    switch(key[0]) {
+        case 'C':
+            if(len == 2 && key[1] == 'C') {
+                return(JsFieldCC);
+            } else if(len == 3 && key[1] == 'a' && key[2] == 't') {
+                return(JsFieldCat);
+            }
+            break;
+        case 'D':
+            if(len == 4 && memcmp(key, "Desc", 4) == 0) {
+                return(JsFieldDesc);
+            }
+            break;
+        case 'T':
+            if(len == 2 && key[1] == 'T') {
+                return(JsFieldTT);
+            } else if(len == 3 && key[1] == 'y' && key[2] == 'p') {
+                return(JsFieldTyp);
+            }
+            break;
+        case 'L':
+            if(len == 2 && key[1] == 'o') {
+                return(JsFieldLo);
+            }
+            break;
+        case 'H':
+            if(len == 2 && key[1] == 'i') {
+                return(JsFieldHi);
+            }
+            break;
+        case 'S':
+            if(len == 4 && memcmp(key, "Step", 4) == 0) {
+                return(JsFieldStep);
+            }
+            break;
+        case 'F':
+            if(len == 1) {
+                return(JsFieldF);
+            }
+            break;
+        default:
+            break;
     }
-    for(i = 0; i < js->config_count; i++) {
-        default_config(&(js->config[i]));
 
-        json_item = json_object_array_get_idx(schema, i);
-        if(json_object_get_type(json_item) != json_type_object) {
-            term_print("Schema item type isn't object.");
-            goto error_free_memory;
+    return(JsFieldUnknown);
+}
+
+static int js_schema_int(JsSchemaStream *st) {
+    int val = st->num > INT_MAX ? INT_MAX : (int)st->num;
+
+    return(st->num_neg ? -val : val);
+}
+
+/* same as json-c gives, negative values are 0 unsigned and values too big
+ * are clamped signed */
+static void js_schema_bound(JsType type, int neg, uint64_t val,
+                            int64_t *sint, uint64_t *uint) {
+    if(js_config_get_type_is_signed(type)) {
+        if(val > INT64_MAX) {
+            *sint = neg ? INT64_MIN : INT64_MAX;
+        } else {
+            *sint = neg ? -(int64_t)val : (int64_t)val;
         }
-        lo_value = NULL;
-        hi_value = NULL;
-        schema_iter = json_object_iter_begin(json_item);
-        schema_iter_end = json_object_iter_end(json_item);
-        while(!json_object_iter_equal(&schema_iter, &schema_iter_end)) {
-            item_name = json_object_iter_peek_name(&schema_iter);
-            item_value = json_object_iter_peek_value(&schema_iter);
-            if(strcmp(item_name, "CC") == 0) {
-                if(json_object_get_type(item_value) != json_type_string) {
-                    term_print("Item CC is not string.");
-                    goto error_free_memory;
+    } else {
+        *uint = neg ? 0 : val;
+    }
+}
+
+/* a value has been read, lex is the kind of token it was */
+static int js_schema_value(JsInfo *js, JsLex lex) {
+    JsSchemaStream *st = &(js->stream);
+    JsConfig *config = &(js->config[js->config_count]);
+    JsConfigMeta *meta = &(js->meta[js->config_count]);
+    char *str = &(js->arena[js->arena_used]);
+    char name[JS_SCHEMA_NAME_LEN+1];
+    int category;
+
+    if(!st->in_item || st->depth != 3 || !st->after_colon) {
+        /* not part of an item */
+        return(0);
+    }
+    st->after_colon = 0;
+
+    switch(st->field) {
+        case JsFieldCC:
+        case JsFieldDesc:
+        case JsFieldCat:
+            if(lex != JsLexString) {
+                term_print("Item %s is not string.", JS_FIELD_NAMES[st->field]);
+                return(-1);
+            }
+            break;
+        case JsFieldTyp:
+        case JsFieldStep:
+        case JsFieldTT:
+        case JsFieldF:
+            if(lex != JsLexNumber || !st->num_int) {
+                term_print("Item %s is not int.", JS_FIELD_NAMES[st->field]);
+                return(-1);
+            }
+            break;
+        case JsFieldLo:
+        case JsFieldHi:
+            if(lex != JsLexNumber) {
+                term_print("Item %s is not number.", JS_FIELD_NAMES[st->field]);
+                return(-1);
+            }
+            break;
+        default:
+            term_print("Unknown field %.*s.",
+                       st->key_len < sizeof(st->key) ? (int)st->key_len : (int)sizeof(st->key),
+                       st->key);
+            return(0);
+    }
+
+    switch(st->field) {
+        case JsFieldCC:
+            if(st->str_len != JS_SCHEMA_NAME_LEN) {
+                term_print("Get name in schema that's the wrong length, should be JSON_SCHEMA_NAME_LEN!");
+                return(-1);
+            }
+            memcpy(config->CC.name, str, JS_CONFIG_NAME_LEN);
+            break;
+        case JsFieldDesc:
+            /* already in the arena, just keep it */
+            if(js_arena_reserve(js, st->str_len + 1) < 0) {
+                return(-1);
+            }
+            str = &(js->arena[js->arena_used]);
+            str[st->str_len] = '\0';
+            meta->Desc = js->arena_used;
+            js->arena_used += st->str_len + 1;
+            break;
+        case JsFieldTyp:
+            config->Typ = js_schema_int(st);
+            if(!js_config_get_type_is_valid(config->Typ)) {
+                term_print("Got unknown/invalid type %i!",
+                           config->Typ);
+                return(-1);
+            }
+            break;
+        case JsFieldLo:
+            st->lo_set = 1;
+            st->lo_neg = st->num_neg;
+            st->lo = st->num;
+            break;
+        case JsFieldHi:
+            st->hi_set = 1;
+            st->hi_neg = st->num_neg;
+            st->hi = st->num;
+            break;
+        case JsFieldStep:
+            meta->Step = js_schema_int(st);
+            break;
+        case JsFieldTT:
+            meta->TT = js_schema_int(st);
+            break;
+        case JsFieldCat:
+            /* adding a category may move the arena */
+            if(st->str_len != JS_SCHEMA_NAME_LEN) {
+                term_print("Get category in schema that's the wrong length, should be JSON_SCHEMA_NAME_LEN!");
+                return(-1);
+            }
+            memcpy(name, str, JS_SCHEMA_NAME_LEN);
+            name[JS_SCHEMA_NAME_LEN] = '\0';
+            category = find_category(js, name);
+            if(category < 0) {
+                return(-1);
+            }
+            meta->Cat = category;
+            break;
+        case JsFieldF:
+            meta->F = js_schema_int(st);
+            break;
+        default:
+            break;
+    }
+
+    return(0);
+}
+
+static int js_schema_string_add(JsInfo *js, unsigned int c) {
+    JsSchemaStream *st = &(js->stream);
+
+    switch(st->str_dest) {
+        case JsStrKey:
+            if(st->key_len < sizeof(st->key)) {
+                st->key[st->key_len] = c;
+            }
+            st->key_len++;
+            break;
+        case JsStrValue:
+            /* room for the longest UTF-8 sequence plus a terminator */
+            if(js_arena_reserve(js, st->str_len + 4) < 0) {
+                return(-1);
+            }
+            if(c < 0x80) {
+                js->arena[js->arena_used + st->str_len++] = c;
+            } else if(c < 0x800) {
+                js->arena[js->arena_used + st->str_len++] = 0xC0 | (c >> 6);
+                js->arena[js->arena_used + st->str_len++] = 0x80 | (c & 0x3F);
+            } else {
+                /* surrogate pairs aren't put back together, nothing in a
+                 * schema should need them */
+                js->arena[js->arena_used + st->str_len++] = 0xE0 | (c >> 12);
+                js->arena[js->arena_used + st->str_len++] = 0x80 | ((c >> 6) & 0x3F);
+                js->arena[js->arena_used + st->str_len++] = 0x80 | (c & 0x3F);
+            }
+            break;
+        default:
+            break;
+    }
+
+    return(0);
+}
+
+static int js_hex_value(unsigned char c) {
+    if(c >= '0' && c <= '9') {
+        return(c - '0');
+    } else if(c >= 'a' && c <= 'f') {
+        return(c - 'a' + 10);
+    } else if(c >= 'A' && c <= 'F') {
+        return(c - 'A' + 10);
+    }
+
+    return(-1);
+}
+
+/* escape is 1 after a backslash, then 2 to 5 for each digit of a \u */
+static int js_schema_string_char(JsInfo *js, unsigned char c) {
+    JsSchemaStream *st = &(js->stream);
+    int hex;
+
+    if(st->escape == 0) {
+        if(c == '\\') {
+            st->escape = 1;
+            return(0);
+        } else if(c != '"') {
+            return(js_schema_string_add(js, c));
+        }
+
+        /* end of the string */
+        st->lex = JsLexNone;
+        if(st->str_dest == JsStrKey && st->in_item && st->depth == 3) {
+            st->field = js_schema_field(st->key, st->key_len);
+        } else if(st->str_dest == JsStrValue) {
+            return(js_schema_value(js, JsLexString));
+        }
+        return(0);
+    }
+
+    if(st->escape == 1) {
+        st->escape = 0;
+        switch(c) {
+            case 'b':
+                return(js_schema_string_add(js, '\b'));
+            case 'f':
+                return(js_schema_string_add(js, '\f'));
+            case 'n':
+                return(js_schema_string_add(js, '\n'));
+            case 'r':
+                return(js_schema_string_add(js, '\r'));
+            case 't':
+                return(js_schema_string_add(js, '\t'));
+            case 'u':
+                st->escape = 2;
+                st->unicode = 0;
+                return(0);
+            default:
+                /* \" \\ \/ and anything else is just the character */
+                return(js_schema_string_add(js, c));
+        }
+    }
+
+    hex = js_hex_value(c);
+    if(hex < 0) {
+        term_print("Bad \\u escape in schema.");
+        return(-1);
+    }
+    st->unicode = (st->unicode << 4) | hex;
+    st->escape++;
+    if(st->escape == 6) {
+        st->escape = 0;
+        return(js_schema_string_add(js, st->unicode));
+    }
+
+    return(0);
+}
+
+/* start taking a schema in pieces with js_schema_stream_feed() */
+int js_schema_stream_begin(JsInfo *js) {
+    JsSchemaStream *st = &(js->stream);
+
+    if(js_cache_unmap(js) < 0) {
+        return(-1);
+    }
+
+    st->parser = js_schema_parser;
+#ifdef JS_SCHEMA_JSONC
+    if(st->parser == JsSchemaParserJsonC) {
+        if(st->tok == NULL) {
+            st->tok = json_tokener_new();
+            if(st->tok == NULL) {
+                term_print("Failed to allocate JSON tokener.");
+                return(-1);
+            }
+        }
+        json_tokener_reset(st->tok);
+    }
+#endif
+
+    st->depth = 0;
+    st->in_schema = 0;
+    st->in_item = 0;
+    st->found_schema = 0;
+    st->done = 0;
+    st->config_alloc = js->config_count;
+    st->lex = JsLexNone;
+    st->key_len = 0;
+    st->after_colon = 0;
+
+    return(0);
+}
+
+/* a single pass, a byte at a time, with all the state kept between pieces so
+ * a token can be split anywhere.  Nothing is allocated besides growing the
+ * config list and arena, strings which are kept are read straight in to the
+ * end of the arena.  With the json-c parser, only the item boundaries are
+ * found here and the bytes of each are handed to an incremental tokener.
+ * Anything after the end of the JSON (the end of the sysex) is ignored. */
+int js_schema_stream_feed(JsInfo *js, size_t size, const unsigned char *buf) {
+    JsSchemaStream *st = &(js->stream);
+    int builtin = st->parser == JsSchemaParserBuiltin;
+#ifdef JS_SCHEMA_JSONC
+    size_t item_start = 0;
+#endif
+    size_t i;
+    unsigned char c;
+
+    for(i = 0; i < size && !st->done; i++) {
+        c = buf[i];
+
+        switch(st->lex) {
+            case JsLexString:
+                if(js_schema_string_char(js, c) < 0) {
+                    return(-1);
                 }
-                json_string = json_object_get_string(item_value);
-                if(strlen(json_string) != JS_SCHEMA_NAME_LEN) {
-                    term_print("Get name in schema that's the wrong length, should be JSON_SCHEMA_NAME_LEN!");
-                    goto error_free_memory;
+                continue;
+            case JsLexNumber:
+                if(c >= '0' && c <= '9') {
+                    if(st->num_int) {
+                        if(st->num > (UINT64_MAX - (c - '0')) / 10) {
+                            st->num = UINT64_MAX;
+                        } else {
+                            st->num = st->num * 10 + (c - '0');
+                        }
+                    }
+                    continue;
+                } else if(c == '.' || c == 'e' || c == 'E' ||
+                          c == '+' || c == '-') {
+                    /* fractions are dropped, Lo and Hi are only ever
+                     * integers */
+                    st->num_int = 0;
+                    continue;
                 }
-                js->config[i].CC = midi_copy_string(json_string);
-            } else if(strcmp(item_name, "Desc") == 0) {
-                if(json_object_get_type(item_value) != json_type_string) {
-                    term_print("Item Desc is not string.");
-                    goto error_free_memory;
+                st->lex = JsLexNone;
+                if(builtin && js_schema_value(js, JsLexNumber) < 0) {
+                    return(-1);
                 }
-                js->config[i].Desc = midi_copy_string(json_object_get_string(item_value));
-            } else if(strcmp(item_name, "Typ") == 0) {
-                if(json_object_get_type(item_value) != json_type_int) {
-                    term_print("Item Typ is not int.");
-                    goto error_free_memory;
+                /* this character still needs to be looked at */
+                break;
+            case JsLexLiteral:
+                if(c >= 'a' && c <= 'z') {
+                    continue;
                 }
-                js->config[i].Typ = json_object_get_int(item_value);
-                if(!js_config_get_type_is_valid(js->config[i].Typ)) {
-                    term_print("Got unknown/invalid type %i!",
-                               js->config[i].Typ);
-                    goto error_free_memory;
+                st->lex = JsLexNone;
+                if(builtin && js_schema_value(js, JsLexLiteral) < 0) {
+                    return(-1);
                 }
-            } else if(strcmp(item_name, "Lo") == 0) {
-                lo_value = item_value;
-            } else if(strcmp(item_name, "Hi") == 0) {
-                hi_value = item_value;
-            } else if(strcmp(item_name, "Step") == 0) {
-                if(json_object_get_type(item_value) != json_type_int) {
-                    term_print("Item Step is not int.");
-                    goto error_free_memory;
+                break;
+            default:
+                break;
+        }
+
+        switch(c) {
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\n':
+                break;
+            case '"':
+                st->lex = JsLexString;
+                st->escape = 0;
+                st->str_len = 0;
+                st->str_dest = JsStrSkip;
+                if(st->depth == 1) {
+                    st->str_dest = JsStrKey;
+                    st->key_len = 0;
+                } else if(builtin && st->in_item && st->depth == 3) {
+                    if(st->after_colon) {
+                        st->str_dest = JsStrValue;
+                    } else {
+                        st->str_dest = JsStrKey;
+                        st->key_len = 0;
+                    }
                 }
-                js->config[i].Step = json_object_get_int(item_value);
-            } else if(strcmp(item_name, "TT") == 0) {
-                if(json_object_get_type(item_value) != json_type_int) {
-                    term_print("Item TT is not int.");
-                    goto error_free_memory;
+                break;
+            case ':':
+                if(st->depth == 3) {
+                    st->after_colon = 1;
                 }
-                js->config[i].TT = json_object_get_int(item_value);
-            } else if(strcmp(item_name, "Cat") == 0) {
-                if(json_object_get_type(item_value) != json_type_string) {
-                    term_print("Item Cat is not string.");
-                    goto error_free_memory;
+                break;
+            case ',':
+                if(st->depth == 3) {
+                    st->after_colon = 0;
                 }
-                json_string = json_object_get_string(item_value);
-                category = find_category(js, json_string);
-                if(category < 0) {
-                    goto error_free_memory;
+                break;
+            case '{':
+            case '[':
+                if(st->depth == 2 && st->in_schema && c == '{') {
+                    if(js_schema_item_begin(js) < 0) {
+                        return(-1);
+                    }
+                    st->in_item = 1;
+                    st->after_colon = 0;
+                    st->lo_set = 0;
+                    st->hi_set = 0;
+#ifdef JS_SCHEMA_JSONC
+                    item_start = i;
+#endif
+                } else if(st->depth == 1 && c == '[' &&
+                          st->key_len == 6 && memcmp(st->key, "Schema", 6) == 0) {
+                    st->in_schema = 1;
+                    st->found_schema = 1;
                 }
-                js->config[i].Cat = category;
-            } else if(strcmp(item_name, "F") == 0) {
-                if(json_object_get_type(item_value) != json_type_int) {
-                    term_print("Item F is not int.");
-                    goto error_free_memory;
+                st->depth++;
+                break;
+            case '}':
+            case ']':
+                if(st->depth == 0) {
+                    term_print("Unbalanced JSON in schema.");
+                    return(-1);
                 }
-                js->config[i].F = json_object_get_int(item_value);
-            } else {
-                term_print("Unknown field %s type %s.",
-                           item_name, json_type_to_name(json_object_get_type(item_value)));
-            }
-            json_object_iter_next(&schema_iter);
-        }
-        if(lo_value != NULL) {
-            if(js_config_get_type_is_signed(js->config[i].Typ)) {
-                js->config[i].Lo.sint = json_object_get_int64(lo_value);
-            } else {
-                js->config[i].Lo.uint = json_object_get_uint64(lo_value);
-            }
-        }
-        if(hi_value != NULL) {
-            if(js_config_get_type_is_signed(js->config[i].Typ)) {
-                js->config[i].Hi.sint = json_object_get_int64(hi_value);
-            } else {
-                js->config[i].Hi.uint = json_object_get_uint64(hi_value);
-            }
+                st->depth--;
+                if(st->depth == 2 && st->in_item) {
+                    st->in_item = 0;
+#ifdef JS_SCHEMA_JSONC
+                    if(!builtin) {
+                        if(js_schema_stream_jsonc(js, i + 1 - item_start,
+                                                  &(buf[item_start])) < 0) {
+                            return(-1);
+                        }
+                        break;
+                    }
+#endif
+                    if(st->lo_set) {
+                        js_schema_bound(js->config[js->config_count].Typ,
+                                        st->lo_neg, st->lo,
+                                        &(js->meta[js->config_count].Lo.sint),
+                                        &(js->meta[js->config_count].Lo.uint));
+                    }
+                    if(st->hi_set) {
+                        js_schema_bound(js->config[js->config_count].Typ,
+                                        st->hi_neg, st->hi,
+                                        &(js->meta[js->config_count].Hi.sint),
+                                        &(js->meta[js->config_count].Hi.uint));
+                    }
+                    if(js_schema_item_end(js) < 0) {
+                        return(-1);
+                    }
+                } else if(st->depth == 3 && st->in_item && builtin) {
+                    /* an object or array value isn't anything known */
+                    if(js_schema_value(js, JsLexLiteral) < 0) {
+                        return(-1);
+                    }
+                } else if(st->depth == 1) {
+                    st->in_schema = 0;
+                } else if(st->depth == 0) {
+                    st->done = 1;
+                }
+                break;
+            default:
+                if(c == '-' || (c >= '0' && c <= '9')) {
+                    st->lex = JsLexNumber;
+                    st->num_neg = c == '-';
+                    st->num_int = 1;
+                    st->num = c == '-' ? 0 : c - '0';
+                } else if(c >= 'a' && c <= 'z') {
+                    st->lex = JsLexLiteral;
+                } else {
+                    term_print("Unexpected character %02X in schema.", c);
+                    return(-1);
+                }
+                break;
         }
     }
 
-    json_object_put(jobj);
+#ifdef JS_SCHEMA_JSONC
+    /* pass on the start of an item which is finished in a later piece */
+    if(!builtin && st->in_item &&
+       js_schema_stream_jsonc(js, i - item_start, &(buf[item_start])) < 0) {
+        return(-1);
+    }
+#endif
 
     return(0);
-
-error_free_memory:
-    free(js->config);
-error_put_json:
-    json_object_put(jobj);
-error:
-    return(-1);
 }
 
-void js_free(JsInfo *js) {
-    unsigned int i;
+int js_schema_stream_end(JsInfo *js) {
+    JsSchemaStream *st = &(js->stream);
+    void *tmp;
 
-    if(js->categories != NULL) {
-        for(i = 0; i < js->category_count; i++) {
-            free(js->categories[i]);
-        }
-        free(js->categories);
+    if(!st->done) {
+        term_print("Schema JSON ended early.");
+        return(-1);
+    }
+    if(!st->found_schema) {
+        term_print("Couldn't get schema.");
+        return(-1);
     }
 
-    if(js->config != NULL) {
-        for(i = 0; i < js->config_count; i++) {
-            free(js->config[i].CC);
-            free(js->config[i].Desc);
+    /* give back what was grown in to but not used */
+    if(js->config_count > 0 && js->config_count < st->config_alloc) {
+        tmp = realloc(js->config, sizeof(JsConfig) * js->config_count);
+        if(tmp != NULL) {
+            js->config = tmp;
+        }
+        tmp = realloc(js->meta, sizeof(JsConfigMeta) * js->config_count);
+        if(tmp != NULL) {
+            js->meta = tmp;
         }
-        free(js->config);
     }
+    st->config_alloc = 0;
 
+    return(0);
+}
+
+int js_parse_json_schema(JsInfo *js, size_t size, const unsigned char *buf) {
+    if(size < JS_SCHEMA_START) {
+        term_print("Schema message too short.");
+        return(-1);
+    }
+
+    if(js_schema_stream_begin(js) < 0 ||
+       js_schema_stream_feed(js, size - JS_SCHEMA_START, &(buf[JS_SCHEMA_START])) < 0 ||
+       js_schema_stream_end(js) < 0) {
+        return(-1);
+    }
+
+    return(0);
+}
+
+void js_free(JsInfo *js) {
+#ifdef JS_SCHEMA_JSONC
+    if(js->stream.tok != NULL) {
+        json_tokener_free(js->stream.tok);
+    }
+#endif
+    /* nothing is allocated per item */
+    if(js->cache_map != NULL) {
+        munmap(js->cache_map, js->cache_map_size);
+    } else {
+        free(js->config);
+        free(js->meta);
+        free(js->arena);
+    }
+    free(js->index);
     free(js);
 }
 
+JsConfigMeta *js_config_meta(JsInfo *js, JsConfig *config) {
+    return(&(js->meta[config - js->config]));
+}
+
+const char *js_config_desc(JsInfo *js, JsConfig *config) {
+    return(&(js->arena[js_config_meta(js, config)->Desc]));
+}
+
+const char *js_config_text(JsInfo *js, JsConfig *config) {
+    return(&(js->arena[config->val.text]));
+}
+
+const char *js_category_name(JsInfo *js, unsigned int category) {
+    if(category >= js->category_count) {
+        return(NULL);
+    }
+
+    return(&(js->arena[js->categories[category]]));
+}
+
 void js_config_print(JsInfo *js, JsConfig *config) {
     unsigned int i;
     const char *category = "(uncategorized)";
+    JsConfigMeta *meta = js_config_meta(js, config);
     /* This will probably be more of a debug function in the future, so just
      * hard code this for convenience for now. */
     const char *flags[7];
 
-    if(config->Cat >= 0 || (unsigned int)config->Cat <= js->category_count) {
-        category = js->categories[config->Cat];
+    if(meta->Cat >= 0 && (unsigned int)meta->Cat < js->category_count) {
+        category = js_category_name(js, meta->Cat);
     }
 
     for(i = 0; i < 7; i++) {
-        flags[i] = js_config_flag_to_name(config->F & (1 << i));
+        flags[i] = js_config_flag_to_name(meta->F & (1 << i));
     }
 
     if(js_config_get_type_is_signed(config->Typ)) {
-        term_print("Category: %s  Name: %s  Description: %s  Type: %s  Lo: %ld  Hi: %ld  Step: %ld  Control: %s  Flags: %u (%s %s %s %s %s %s %s)",
-                   category, config->CC, config->Desc,
+        term_print("Category: %s  Name: %.8s  Description: %s  Type: %s  Lo: %ld  Hi: %ld  Step: %d  Control: %s  Flags: %u (%s %s %s %s %s %s %s)",
+                   category, config->CC.name, js_config_desc(js, config),
                    js_config_type_to_name(config->Typ),
-                   config->Lo.sint, config->Hi.sint, config->Step,
-                   js_config_control_to_name(config->TT), config->F,
+                   meta->Lo.sint, meta->Hi.sint, meta->Step,
+                   js_config_control_to_name(meta->TT), meta->F,
                    flags[0], flags[1], flags[2], flags[3], flags[4], flags[5], flags[6]);
     } else {
-        term_print("Category: %s  Name: %s  Description: %s  Type: %s  Lo: %lu  Hi: %lu  Step: %ld  Control: %s  Flags: %u (%s %s %s %s %s %s %s)",
-                   category, config->CC, config->Desc,
+        term_print("Category: %s  Name: %.8s  Description: %s  Type: %s  Lo: %lu  Hi: %lu  Step: %d  Control: %s  Flags: %u (%s %s %s %s %s %s %s)",
+                   category, config->CC.name, js_config_desc(js, config),
                    js_config_type_to_name(config->Typ),
-                   config->Lo.uint, config->Hi.uint, config->Step,
-                   js_config_control_to_name(config->TT), config->F,
+                   meta->Lo.uint, meta->Hi.uint, meta->Step,
+                   js_config_control_to_name(meta->TT), meta->F,
                    flags[0], flags[1], flags[2], flags[3], flags[4], flags[5], flags[6]);
     }
 
@@ -522,18 +1192,26 @@ void js_config_print(JsInfo *js, JsConfig *config) {
                 term_print("Value: %lu", config->val.uint);
             }
         } else {
-            term_print("Value: \"%s\"", config->val.text);
+            term_print("Value: \"%s\"", js_config_text(js, config));
         }
     }
 }
 
 JsConfig *js_config_find(JsInfo *js, const char *name) {
-    unsigned int i;
+    uint64_t key;
+    unsigned int slot;
 
-    for(i = 0; i < js->config_count; i++) {
-        if(memcmp(js->config[i].CC, name, JS_CONFIG_NAME_LEN) == 0) {
-            return(&(js->config[i]));
+    if(js->index == NULL) {
+        return(NULL);
+    }
+
+    key = js_config_key(name);
+    slot = js_index_slot(js, key);
+    while(js->index[slot].config != 0) {
+        if(js->index[slot].key == key) {
+            return(&(js->config[js->index[slot].config - 1]));
         }
+        slot = (slot + 1) & (js->index_size - 1);
     }
 
     return(NULL);
@@ -564,29 +1242,48 @@ JsConfig *js_decode_config_value(JsInfo *js, size_t size, const unsigned char *b
         return(NULL);
     }
 
+    /* text values go in the arena which might need to grow, so get out of
+     * the cache mapping first so config doesn't move underneath */
+    if(!js_config_get_type_is_numeric(buf[JS_CONFIG_TYPE]) &&
+       js_cache_unmap(js) < 0) {
+        return(NULL);
+    }
+
     JsConfig *config = js_config_find(js, (const char *)&(buf[JS_CONFIG_NAME]));
     if(config == NULL) {
-        term_print("WARNING: Got config for item \"%s\" not in schema!", &(buf[JS_CONFIG_NAME]));
+        term_print("WARNING: Got config for item \"%.8s\" not in schema!", &(buf[JS_CONFIG_NAME]));
         term_print("  New value will be added to schema.");
-        JsConfig *tmp = malloc(sizeof(JsConfig) * (js->config_count + 1));
+        if(js_cache_unmap(js) < 0) {
+            return(NULL);
+        }
+        JsConfig *tmp = realloc(js->config, sizeof(JsConfig) * (js->config_count + 1));
         if(tmp == NULL) {
             term_print("Failed to allocate memory!");
             return(NULL);
         }
         js->config = tmp;
+        JsConfigMeta *tmpmeta = realloc(js->meta, sizeof(JsConfigMeta) * (js->config_count + 1));
+        if(tmpmeta == NULL) {
+            term_print("Failed to allocate memory!");
+            return(NULL);
+        }
+        js->meta = tmpmeta;
+        /* the index refers to items by number so it survives the move */
+        if((js->config_count + 1) * 2 > js->index_size &&
+           js_index_build(js, js->config_count + 1) < 0) {
+            return(NULL);
+        }
         js->config_count++;
         config = &(js->config[js->config_count-1]);
-        default_config(config);
-        config->CC = malloc(JS_SCHEMA_NAME_LEN + 1);
-        if(config->CC == NULL) {
-            term_print("Failed to allocate memory!");
+        default_config(config, &(js->meta[js->config_count-1]));
+        memcpy(config->CC.name, &(buf[JS_CONFIG_NAME]), JS_CONFIG_NAME_LEN);
+        if(js_arena_add(js, config->CC.name, JS_CONFIG_NAME_LEN,
+                        &(js->meta[js->config_count-1].Desc)) < 0) {
             return(NULL);
         }
-        memcpy(config->CC, &(buf[JS_CONFIG_NAME]), JS_CONFIG_NAME_LEN);
-        config->CC[JS_CONFIG_NAME_LEN] = '\0';
-        config->Desc = midi_copy_string(config->CC);
         /* type is already validated earlier */
         config->Typ = buf[JS_CONFIG_TYPE];
+        js_index_insert(js, js->config_count - 1);
     }
 
     if(config->Typ != buf[JS_CONFIG_TYPE]) {
@@ -597,43 +1294,15 @@ JsConfig *js_decode_config_value(JsInfo *js, size_t size, const unsigned char *b
         term_print("  New type will be recorded.");
     }
 
-    switch(buf[JS_CONFIG_TYPE]) {
-        case JsTypeUInt7:
-            config->val.uint = buf[JS_CONFIG_VALUE];
-            break;
-        case JsTypeUInt8:
-            config->val.uint = decode_packed_uint8(&(buf[JS_CONFIG_VALUE]));
-            break;
-        case JsTypeUInt32:
-            config->val.uint = decode_packed_uint32(&(buf[JS_CONFIG_VALUE]));
-            break;
-        case JsTypeInt32:
-            config->val.sint = decode_packed_int32(&(buf[JS_CONFIG_VALUE]));
-            break;
-        case JsTypeASCII7:
-        case JsTypeASCII8:
-            /* no clue how ascii8 is formatted because there's no values returned of this type */
-            config->val.text = malloc(size - JS_CONFIG_VALUE - MIDI_SYSEX_TAIL + 1);
-            if(config->val.text == NULL) {
-                return(NULL);
-            }
-            memcpy(config->val.text, &(buf[JS_CONFIG_VALUE]), size - JS_CONFIG_VALUE - MIDI_SYSEX_TAIL);
-            config->val.text[size - JS_CONFIG_VALUE - MIDI_SYSEX_TAIL] = '\0';
-            break;
-        case JsTypeInt16:
-            config->val.sint = decode_packed_int16(&(buf[JS_CONFIG_VALUE]));
-            break;
-        case JsTypeUInt16:
-            config->val.uint = decode_packed_uint16(&(buf[JS_CONFIG_VALUE]));
-            break;
-        case JsTypeInt64:
-            config->val.sint = decode_packed_int64(&(buf[JS_CONFIG_VALUE]));
-            break;
-        case JsTypeUInt64:
-            config->val.uint = decode_packed_uint64(&(buf[JS_CONFIG_VALUE]));
-            break;
-        default:
+    if(JS_TYPE_INFO[buf[JS_CONFIG_TYPE]].decode != NULL) {
+        config->val.uint = JS_TYPE_INFO[buf[JS_CONFIG_TYPE]].decode(&(buf[JS_CONFIG_VALUE]));
+    } else {
+        /* no clue how ascii8 is formatted because there's no values returned of this type */
+        if(js_arena_add(js, (const char *)&(buf[JS_CONFIG_VALUE]),
+                        size - JS_CONFIG_VALUE - MIDI_SYSEX_TAIL,
+                        &(config->val.text)) < 0) {
             return(NULL);
+        }
     }
 
     config->Typ = buf[JS_CONFIG_TYPE];
@@ -663,3 +1332,290 @@ int js_config_get_bool_value(JsConfig *config) {
 
     return(-1);
 }
+
+int js_fingerprint_category(JsInfo *js) {
+    JsConfig *config;
+
+    config = js_config_find(js, JS_FINGERPRINT_NAMES[0]);
+    if(config == NULL) {
+        return(-1);
+    }
+
+    return(js_config_meta(js, config)->Cat);
+}
+
+static int js_get_fingerprint(JsInfo *js, uint64_t *fingerprint) {
+    JsConfig *config;
+    unsigned int i;
+
+    for(i = 0; i < JS_FINGERPRINT_ITEMS; i++) {
+        config = js_config_find(js, JS_FINGERPRINT_NAMES[i]);
+        if(config == NULL || !config->validValue ||
+           !js_config_get_type_is_numeric(config->Typ)) {
+            return(-1);
+        }
+        fingerprint[i] = config->val.uint;
+    }
+
+    return(0);
+}
+
+/* 1 if the values read from the guitar match the cache, 0 if not, -1 if
+ * they haven't all been read */
+int js_cache_check(JsInfo *js) {
+    uint64_t fingerprint[JS_FINGERPRINT_ITEMS];
+
+    if(js_get_fingerprint(js, fingerprint) < 0) {
+        return(-1);
+    }
+
+    if(memcmp(fingerprint, js->cache_fingerprint, sizeof(fingerprint)) != 0) {
+        return(0);
+    }
+
+    return(1);
+}
+
+/* move everything out of the mapping so it can be changed and grown */
+static int js_cache_unmap(JsInfo *js) {
+    JsConfig *config;
+    JsConfigMeta *meta;
+    char *arena;
+
+    if(js->cache_map == NULL) {
+        return(0);
+    }
+
+    config = malloc(sizeof(JsConfig) * js->config_count);
+    meta = malloc(sizeof(JsConfigMeta) * js->config_count);
+    arena = malloc(js->arena_size);
+    if(config == NULL || meta == NULL || arena == NULL) {
+        term_print("Failed to allocate memory!");
+        free(config);
+        free(meta);
+        free(arena);
+        return(-1);
+    }
+    memcpy(config, js->config, sizeof(JsConfig) * js->config_count);
+    memcpy(meta, js->meta, sizeof(JsConfigMeta) * js->config_count);
+    memcpy(arena, js->arena, js->arena_used);
+
+    munmap(js->cache_map, js->cache_map_size);
+    js->cache_map = NULL;
+    js->cache_map_size = 0;
+
+    js->config = config;
+    js->meta = meta;
+    js->arena = arena;
+
+    return(0);
+}
+
+static size_t js_cache_config_offset() {
+    return(sizeof(JsCacheHeader));
+}
+
+static size_t js_cache_meta_offset(unsigned int config_count) {
+    return(js_cache_config_offset() + sizeof(JsConfig) * config_count);
+}
+
+static size_t js_cache_arena_offset(unsigned int config_count) {
+    return(js_cache_meta_offset(config_count) + sizeof(JsConfigMeta) * config_count);
+}
+
+/* the cache is used in place, so every offset and index in it has to be
+ * checked before anything reads through one.
+ * returns 0 if it's all in range or -1 if not */
+static int js_cache_check_offsets(const JsCacheHeader *header, const JsConfig *config,
+                                  const JsConfigMeta *meta, const char *arena) {
+    unsigned int i;
+
+    /* every string ends before the end of the arena */
+    if(arena[header->arena_used - 1] != '\0') {
+        return(-1);
+    }
+
+    for(i = 0; i < header->category_count; i++) {
+        if(header->categories[i] >= header->arena_used) {
+            return(-1);
+        }
+    }
+
+    for(i = 0; i < header->config_count; i++) {
+        /* an item the schema gave no type stays JsTypeInvalid */
+        if((config[i].Typ != JsTypeInvalid &&
+            !js_config_get_type_is_valid(config[i].Typ)) ||
+           meta[i].Desc >= header->arena_used ||
+           meta[i].Cat < -1 ||
+           (meta[i].Cat >= 0 &&
+            (unsigned int)meta[i].Cat >= header->category_count)) {
+            return(-1);
+        }
+        if(config[i].Typ != JsTypeInvalid &&
+           JS_TYPE_INFO[config[i].Typ].decode == NULL &&
+           config[i].val.text >= header->arena_used) {
+            return(-1);
+        }
+    }
+
+    return(0);
+}
+
+/* the layout has no pointers so the file is used in place */
+int js_cache_load(JsInfo *js, const char *path) {
+    int fd;
+    struct stat st;
+    void *map;
+    JsCacheHeader *header;
+    unsigned int i;
+
+    if(js->config_count != 0) {
+        term_print("Tried to load a schema cache over a schema.");
+        return(-1);
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        /* not having one is normal */
+        return(-1);
+    }
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(JsCacheHeader)) {
+        close(fd);
+        return(-1);
+    }
+
+    /* private so values can be written in without touching the file */
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        term_print("Failed to map schema cache %s.", path);
+        return(-1);
+    }
+
+    header = (JsCacheHeader *)map;
+    if(memcmp(header->magic, JS_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+       header->version != JS_CACHE_VERSION ||
+       header->config_size != sizeof(JsConfig) ||
+       header->meta_size != sizeof(JsConfigMeta) ||
+       header->category_count > JS_MAX_CATEGORIES ||
+       header->arena_used == 0 ||
+       js_cache_arena_offset(header->config_count) + header->arena_used !=
+           (size_t)st.st_size ||
+       js_cache_check_offsets(header,
+                              (JsConfig *)((char *)map + js_cache_config_offset()),
+                              (JsConfigMeta *)((char *)map + js_cache_meta_offset(header->config_count)),
+                              (char *)map + js_cache_arena_offset(header->config_count)) < 0) {
+        term_print("Schema cache %s is invalid, ignoring it.", path);
+        munmap(map, st.st_size);
+        return(-1);
+    }
+
+    free(js->arena);
+    js->cache_map = map;
+    js->cache_map_size = st.st_size;
+    js->config_count = header->config_count;
+    js->config = (JsConfig *)((char *)map + js_cache_config_offset());
+    js->meta = (JsConfigMeta *)((char *)map + js_cache_meta_offset(js->config_count));
+    js->arena = (char *)map + js_cache_arena_offset(js->config_count);
+    js->arena_size = header->arena_used;
+    js->arena_used = header->arena_used;
+    js->category_count = header->category_count;
+    memcpy(js->categories, header->categories, sizeof(js->categories));
+    memcpy(js->cache_fingerprint, header->fingerprint, sizeof(js->cache_fingerprint));
+
+    /* values have to be read fresh */
+    for(i = 0; i < js->config_count; i++) {
+        js->config[i].validValue = 0;
+    }
+
+    if(js_index_build(js, js->config_count) < 0) {
+        goto error_unmap;
+    }
+
+    return(0);
+
+error_unmap:
+    /* back to empty, like from js_init() */
+    munmap(map, st.st_size);
+    js->cache_map = NULL;
+    js->cache_map_size = 0;
+    js->config_count = 0;
+    js->config = NULL;
+    js->meta = NULL;
+    js->category_count = 0;
+    js->arena_size = 256;
+    js->arena = malloc(js->arena_size);
+    if(js->arena == NULL) {
+        term_print("Failed to allocate memory!");
+        js->arena_size = 0;
+        js->arena_used = 0;
+        return(-1);
+    }
+    js->arena[0] = '\0';
+    js->arena_used = 1;
+    return(-1);
+}
+
+int js_cache_save(JsInfo *js, const char *path) {
+    JsCacheHeader header;
+    FILE *out;
+    char *temp;
+    size_t len;
+
+    memset(&header, 0, sizeof(header));
+    if(js_get_fingerprint(js, header.fingerprint) < 0) {
+        term_print("Firmware version isn't known, not saving schema cache.");
+        return(-1);
+    }
+    memcpy(header.magic, JS_CACHE_MAGIC, sizeof(header.magic));
+    header.version = JS_CACHE_VERSION;
+    header.config_size = sizeof(JsConfig);
+    header.meta_size = sizeof(JsConfigMeta);
+    header.config_count = js->config_count;
+    header.category_count = js->category_count;
+    header.arena_used = js->arena_used;
+    memcpy(header.categories, js->categories, sizeof(header.categories));
+
+    /* write to a temporary name then rename so a reader never sees half a
+     * file */
+    len = strlen(path) + 5;
+    temp = malloc(len);
+    if(temp == NULL) {
+        term_print("Failed to allocate memory!");
+        return(-1);
+    }
+    snprintf(temp, len, "%s.tmp", path);
+
+    out = fopen(temp, "wb");
+    if(out == NULL) {
+        term_print("Failed to open %s for writing.", temp);
+        goto error;
+    }
+    if(fwrite(&header, sizeof(header), 1, out) != 1 ||
+       fwrite(js->config, sizeof(JsConfig), js->config_count, out) != js->config_count ||
+       fwrite(js->meta, sizeof(JsConfigMeta), js->config_count, out) != js->config_count ||
+       fwrite(js->arena, 1, js->arena_used, out) != js->arena_used) {
+        term_print("Failed to write schema cache %s.", temp);
+        fclose(out);
+        goto error_unlink;
+    }
+    if(fclose(out) != 0) {
+        term_print("Failed to write schema cache %s.", temp);
+        goto error_unlink;
+    }
+    if(rename(temp, path) < 0) {
+        term_print("Failed to rename %s to %s.", temp, path);
+        goto error_unlink;
+    }
+
+    free(temp);
+    memcpy(js->cache_fingerprint, header.fingerprint, sizeof(js->cache_fingerprint));
+
+    return(0);
+
+error_unlink:
+    unlink(temp);
+error:
+    free(temp);
+    return(-1);
+}
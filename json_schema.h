@@ -20,7 +20,8 @@
 #ifndef _JSON_SCHEMA_H
 #define _JSON_SCHEMA_H
 
-#include <json-c/json.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "midi.h"
 
@@ -58,33 +59,91 @@
         (VAR) = (TYPE)((CONFIG)->val.uint); \
     }
 
-#define JS_GET_TEXT_VALUE(TYPE, VAR, CONFIG) (VAR) = (TYPE)((CONFIG)->val.text);
+#define JS_GET_TEXT_VALUE(TYPE, VAR, JS, CONFIG) (VAR) = (TYPE)js_config_text((JS), (CONFIG));
 
+/* item flags, F in the schema */
+#define SF_ENGINEERING (1)
+#define SF_ADVANCED (2)
+#define SF_CRITICAL (4)
+#define SF_BETA (8)
+#define SF_NEVERSHOW (16)
+#define SF_WIFIONLY (32)
+#define SF_BTONLY (64)
+#define SF_MAX_FLAG SF_BTONLY
+
+#define JS_MAX_CATEGORIES (64)
+
+/* items which identify a firmware, and so a schema */
+#define JS_FINGERPRINT_ITEMS (5)
+
+/* everything about each value type, in the order the guitar numbers them.
+ * X(type, short name, name, packed size, bits, numeric, signed, codec)
+ * text has no fixed size and isn't signed or unsigned, the codec names the
+ * decoder and encoder functions, js_decode_<codec>/js_encode_<codec> */
+#define JS_TYPES(X) \
+    X(UInt7,  "uint7",  "unsigned 7 bit",                     1,  7, 1,  0, uint7) \
+    X(UInt8,  "uint8",  "unsigned 8 bit (2 byte packed)",     2,  8, 1,  0, uint8) \
+    X(UInt32, "uint32", "unsigned 32 bit (5 byte packed)",    5, 32, 1,  0, uint32) \
+    X(Int32,  "int32",  "signed 32 bit (5 byte packed)",      5, 32, 1,  1, int32) \
+    X(ASCII7, "ascii7", "7 bit ASCII",                        0,  0, 0, -1, text) \
+    X(ASCII8, "ascii8", "8 bit ASCII (packed)",               0,  0, 0, -1, text) \
+    X(Int16,  "int16",  "signed 16 bit (3 byte packed)",      3, 16, 1,  1, int16) \
+    X(UInt16, "uint16", "unsigned 16 bit (3 byte packed)",    3, 16, 1,  0, uint16) \
+    X(Int64,  "int64",  "signed 64 bit (10 byte packed)",    10, 64, 1,  1, int64) \
+    X(UInt64, "uint64", "unsigned 64 bit (10 byte packed)",  10, 64, 1,  0, uint64)
+
+#define JS_TYPE_ENUM(TYPE, SHORT, NAME, SIZE, BITS, NUMERIC, SIGNED, CODEC) JsType##TYPE,
 typedef enum {
     JsTypeInvalid = -1,
-    JsTypeUInt7 = 0,
-    JsTypeUInt8,
-    JsTypeUInt32,
-    JsTypeInt32,
-    JsTypeASCII7,
-    JsTypeASCII8,
-    JsTypeInt16,
-    JsTypeUInt16,
-    JsTypeInt64,
-    JsTypeUInt64,
+    JS_TYPES(JS_TYPE_ENUM)
     JsTypeMax
 } JsType;
+#undef JS_TYPE_ENUM
 
+/* numeric values are decoded to and encoded from the bits of the uint
+ * member of the value union, signed values sign extended.  text has neither */
 typedef struct {
-    char *CC;
-    char *Desc;
+    const char *short_name;
+    const char *name;
+    size_t size;
+    int bits;
+    int numeric;
+    int is_signed;
+    uint64_t (*decode)(const unsigned char *buf);
+    void (*encode)(uint64_t val, unsigned char *buf);
+} JsTypeInfo;
+
+extern const JsTypeInfo JS_TYPE_INFO[JsTypeMax];
+
+/* every name is JS_CONFIG_NAME_LEN bytes so they're used as a 64 bit key,
+ * they aren't terminated */
+typedef union {
+    uint64_t key;
+    char name[JS_CONFIG_NAME_LEN];
+} JsName;
+
+/* what's looked at whenever a value comes in or goes out, the rest is in
+ * JsConfigMeta at the same index */
+typedef struct {
+    JsName CC;
     JsType Typ;
+    unsigned int validValue;
+    union {
+        int64_t sint;
+        uint64_t uint;
+        /* offset in to the arena */
+        unsigned int text;
+    } val;
+} JsConfig;
+
+typedef struct {
+    /* offset in to the arena */
+    unsigned int Desc;
     int Step;
     int TT;
     int Cat;
     unsigned int F;
 
-    unsigned int validValue;
     union {
         int64_t sint;
         uint64_t uint;
@@ -93,32 +152,130 @@ typedef struct {
         int64_t sint;
         uint64_t uint;
     } Hi;
-    union {
-        int64_t sint;
-        uint64_t uint;
-        char *text;
-    } val;
-} JsConfig;
+} JsConfigMeta;
+
+typedef struct {
+    uint64_t key;
+    /* index in to config + 1, 0 for an empty slot */
+    unsigned int config;
+} JsIndexEntry;
+
+typedef enum {
+    JsSchemaParserBuiltin = 0,
+    /* only if built with JS_SCHEMA_JSONC */
+    JsSchemaParserJsonC
+} JsSchemaParser;
+
+/* where a schema arriving in pieces is up to, see js_schema_stream_feed() */
+typedef struct {
+    JsSchemaParser parser;
+    /* only used by the json-c parser */
+    struct json_tokener *tok;
+
+    unsigned int depth;
+    int in_schema;
+    int in_item;
+    int found_schema;
+    int done;
+    /* config and meta have room for this many while streaming */
+    unsigned int config_alloc;
+
+    /* token being read, strings being kept are built at the end of the
+     * arena */
+    int lex;
+    int str_dest;
+    int escape;
+    unsigned int unicode;
+    size_t str_len;
+    int num_neg;
+    int num_int;
+    uint64_t num;
+
+    /* last key seen, in the top level object to find "Schema", or in an
+     * item to say which field the value is for */
+    char key[8];
+    unsigned int key_len;
+    int field;
+    int after_colon;
+
+    /* Lo and Hi depend on Typ, which may come after them */
+    int lo_set;
+    int lo_neg;
+    uint64_t lo;
+    int hi_set;
+    int hi_neg;
+    uint64_t hi;
+} JsSchemaStream;
 
 typedef struct {
     unsigned int config_count;
     JsConfig *config;
+    JsConfigMeta *meta;
+
+    /* open addressed hash of config names, always a power of 2 in size */
+    unsigned int index_size;
+    JsIndexEntry *index;
 
     unsigned int category_count;
-    char **categories;
+    /* offsets in to the arena */
+    unsigned int categories[JS_MAX_CATEGORIES];
+
+    /* all strings, offset 0 is always an empty string */
+    char *arena;
+    size_t arena_size;
+    size_t arena_used;
+
+    /* when loaded from a cache, config, meta and arena point in to this
+     * until something needs to grow */
+    void *cache_map;
+    size_t cache_map_size;
+    uint64_t cache_fingerprint[JS_FINGERPRINT_ITEMS];
+
+    JsSchemaStream stream;
 } JsInfo;
 
+extern const char JS_FINGERPRINT_NAMES[JS_FINGERPRINT_ITEMS][JS_CONFIG_NAME_LEN+1];
+
 JsInfo *js_init();
 void js_free(JsInfo *js);
-int js_parse_json_schema(JsInfo *js, size_t size, unsigned char *buf);
+int js_set_schema_parser(JsSchemaParser parser);
+int js_parse_json_schema(JsInfo *js, size_t size, const unsigned char *buf);
+int js_schema_stream_begin(JsInfo *js);
+int js_schema_stream_feed(JsInfo *js, size_t size, const unsigned char *buf);
+int js_schema_stream_end(JsInfo *js);
 JsConfig *js_decode_config_value(JsInfo *js, size_t size, const unsigned char *buf);
 void js_config_print(JsInfo *js, JsConfig *config);
 JsConfig *js_config_find(JsInfo *js, const char *name);
-int js_config_get_type_is_valid(JsType type);
-size_t js_config_get_type_size(JsType type);
-int js_config_get_type_bits(JsType type);
-int js_config_get_type_is_numeric(JsType type);
-int js_config_get_type_is_signed(JsType type);
+JsConfigMeta *js_config_meta(JsInfo *js, JsConfig *config);
+const char *js_config_desc(JsInfo *js, JsConfig *config);
+const char *js_config_text(JsInfo *js, JsConfig *config);
+const char *js_category_name(JsInfo *js, unsigned int category);
+int js_fingerprint_category(JsInfo *js);
+int js_cache_check(JsInfo *js);
+int js_cache_load(JsInfo *js, const char *path);
+int js_cache_save(JsInfo *js, const char *path);
 int js_config_get_bool_value(JsConfig *config);
- 
+
+/* these are looked at for every value in and out, so they're just table
+ * lookups, -1 for an invalid type */
+static inline int js_config_get_type_is_valid(JsType type) {
+    return(type >= 0 && type < JsTypeMax);
+}
+
+static inline size_t js_config_get_type_size(JsType type) {
+    return(js_config_get_type_is_valid(type) ? JS_TYPE_INFO[type].size : (size_t)-1);
+}
+
+static inline int js_config_get_type_bits(JsType type) {
+    return(js_config_get_type_is_valid(type) ? JS_TYPE_INFO[type].bits : -1);
+}
+
+static inline int js_config_get_type_is_numeric(JsType type) {
+    return(js_config_get_type_is_valid(type) ? JS_TYPE_INFO[type].numeric : -1);
+}
+
+static inline int js_config_get_type_is_signed(JsType type) {
+    return(js_config_get_type_is_valid(type) ? JS_TYPE_INFO[type].is_signed : -1);
+}
+
 #endif
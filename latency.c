@@ -0,0 +1,146 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "terminal.h"
+#include "latency.h"
+
+/* counters are written by one thread and read by another, relaxed atomics
+ * keep that well defined without making recording any more expensive */
+#define LOAD(X) __atomic_load_n(&(X), __ATOMIC_RELAXED)
+#define STORE(X, V) __atomic_store_n(&(X), (V), __ATOMIC_RELAXED)
+
+static unsigned int latency_bucket(uint64_t ns) {
+    unsigned int shift;
+
+    if(ns < LATENCY_SUB_COUNT) {
+        return(ns);
+    }
+
+    shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+
+    return(((shift + 1) << LATENCY_SUB_BITS) |
+           ((ns >> shift) & (LATENCY_SUB_COUNT - 1)));
+}
+
+/* highest value which would land in a bucket */
+static uint64_t latency_bucket_value(unsigned int bucket) {
+    unsigned int shift;
+
+    if(bucket < LATENCY_SUB_COUNT) {
+        return(bucket);
+    }
+
+    shift = (bucket >> LATENCY_SUB_BITS) - 1;
+
+    return(((((uint64_t)bucket & (LATENCY_SUB_COUNT - 1)) | LATENCY_SUB_COUNT) << shift) +
+           (((uint64_t)1 << shift) - 1));
+}
+
+void latency_init(LatencyHist *h, const char *name) {
+    memset(h, 0, sizeof(LatencyHist));
+    h->name = name;
+}
+
+void latency_record(LatencyHist *h, uint64_t ns) {
+    unsigned int bucket = latency_bucket(ns);
+
+    STORE(h->bucket[bucket], LOAD(h->bucket[bucket]) + 1);
+    STORE(h->sum, LOAD(h->sum) + ns);
+    if(ns > LOAD(h->max)) {
+        STORE(h->max, ns);
+    }
+    STORE(h->count, LOAD(h->count) + 1);
+}
+
+uint64_t latency_percentile(const LatencyHist *h, double percent) {
+    uint64_t count = LOAD(h->count);
+    uint64_t max = LOAD(h->max);
+    uint64_t target;
+    uint64_t seen = 0;
+    uint64_t value;
+    unsigned int i;
+
+    if(count == 0) {
+        return(0);
+    }
+
+    target = (uint64_t)(percent / 100.0 * (double)count + 0.5);
+    if(target < 1) {
+        target = 1;
+    }
+
+    for(i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += LOAD(h->bucket[i]);
+        if(seen >= target) {
+            value = latency_bucket_value(i);
+            /* don't report more than was ever actually seen */
+            return(value > max ? max : value);
+        }
+    }
+
+    return(max);
+}
+
+void latency_print(const LatencyHist *h) {
+    uint64_t count = LOAD(h->count);
+
+    if(count == 0) {
+        term_print("%s: no samples", h->name);
+        return;
+    }
+
+    term_print("%s: n=%lu mean=%.1fus p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus",
+               h->name, count, (double)LOAD(h->sum) / count / 1000.0,
+               latency_percentile(h, 50.0) / 1000.0,
+               latency_percentile(h, 99.0) / 1000.0,
+               latency_percentile(h, 99.9) / 1000.0,
+               LOAD(h->max) / 1000.0);
+}
+
+/* one summary line, then a line for each non-empty bucket with its highest
+ * value and count, all in nanoseconds */
+int latency_write(const LatencyHist *h, FILE *out) {
+    unsigned int i;
+    uint64_t count;
+
+    if(fprintf(out, "%s count %lu sum %lu p50 %lu p99 %lu p999 %lu max %lu\n",
+               h->name, LOAD(h->count), LOAD(h->sum),
+               latency_percentile(h, 50.0),
+               latency_percentile(h, 99.0),
+               latency_percentile(h, 99.9),
+               LOAD(h->max)) < 0) {
+        return(-1);
+    }
+
+    for(i = 0; i < LATENCY_BUCKETS; i++) {
+        count = LOAD(h->bucket[i]);
+        if(count > 0) {
+            if(fprintf(out, "%s bucket %lu %lu\n",
+                       h->name, latency_bucket_value(i), count) < 0) {
+                return(-1);
+            }
+        }
+    }
+
+    return(0);
+}
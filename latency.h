@@ -0,0 +1,48 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* values below 2^LATENCY_SUB_BITS are exact, above that each power of 2 is
+ * split in to 2^LATENCY_SUB_BITS buckets, so about 6% precision */
+#define LATENCY_SUB_BITS (4)
+#define LATENCY_SUB_COUNT (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_COUNT)
+
+/* only one thread may record in to a histogram, any thread may read it but
+ * it might be slightly inconsistent while being recorded to */
+typedef struct {
+    const char *name;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t bucket[LATENCY_BUCKETS];
+} LatencyHist;
+
+void latency_init(LatencyHist *h, const char *name);
+void latency_record(LatencyHist *h, uint64_t ns);
+uint64_t latency_percentile(const LatencyHist *h, double percent);
+void latency_print(const LatencyHist *h);
+int latency_write(const LatencyHist *h, FILE *out);
+
+#endif
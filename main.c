@@ -25,22 +25,52 @@
 #include <signal.h>
 #include <string.h>
 #include <stdarg.h>
-#include <pthread.h>
 #include <limits.h>
+#include <getopt.h>
 
 #include "terminal.h"
 #include "midi.h"
 #include "json_schema.h"
 #include "packed_values.h"
 #include "guitar.h"
-
-const char JACK_NAME[] = "jamstikctl";
+#include "guitar_shm.h"
+#include "instrument.h"
+#include "latency.h"
+#include "midi_loopback.h"
+#include "emulator.h"
+#include "fetch.h"
+#include "batch.h"
+#include "profile.h"
+
+const char CLIENT_NAME[] = "jamstikctl";
+const char DEFAULT_BACKEND[] = "jack";
+const char DEFAULT_PORT_PATTERN[] = ".*Jamstik MIDI IN$";
+const char DEFAULT_EMU_SCHEMA[] = "test.json";
 const char INPORT_NAME[] = "Guitar In";
 const char OUTPORT_NAME[] = "Guitar Out";
 const char THRUPORT_NAME[] = "Guitar Thru";
 
+const char LATENCY_FILE[] = "jamstikctl-latency.txt";
+const char SCHEMA_CACHE_FILE[] = "jamstikctl-schema.cache";
+/* filled in with the entered number */
+#define PROFILE_FILE "jamstikctl-profile-%llu.txt"
+
 unsigned char buffer[MIDI_MAX_BUFFER_SIZE];
 
+/* time events spent in the input ring and time spent handling them */
+LatencyHist dwell_latency;
+LatencyHist handler_latency;
+
+ConfigFetch fetch;
+ConfigBatch batch;
+
+/* the strings, from -I or otherwise whatever the schema says there are */
+Instrument instrument;
+int instrument_given = 0;
+
+/* keys which select strings 1 and up */
+#define STRING_KEYS "zxcvbnm,./"
+
 /* TODO: Some kind of table of declarations of parameters, names, descriptions, hotkeys, and handler callbacks */
 #define JS_PARAM_STRING_OFFSET (1)
 #define JS_PARAM_STRING_CHAR 'x'
@@ -98,8 +128,10 @@ JsParamIndex lookup_param(const char *name) {
     }
 
     /* try for one of the string parameters */
-    char param_name[sizeof(JS_PARAM_NAMES[0])];
-    memcpy(param_name, name, sizeof(JS_PARAM_NAMES[0]));
+    /* names from the guitar aren't terminated */
+    char param_name[JS_CONFIG_NAME_LEN + 1];
+    memcpy(param_name, name, JS_CONFIG_NAME_LEN);
+    param_name[JS_CONFIG_NAME_LEN] = '\0';
     param_name[JS_PARAM_STRING_OFFSET] = JS_PARAM_STRING_CHAR;
 
     return(do_lookup_param(param_name));
@@ -133,102 +165,56 @@ int build_schema_query(unsigned char *buf, const char *name) {
     return(JS_SCHEMA_QUERY_LEN);
 }
 
-int build_config_set_sint(unsigned char *buf, const char *name,
-                          JsType type, long long int value) {
+/* the value has to fit the type, then the type's encoder packs it */
+static int build_config_set(unsigned char *buf, const char *name,
+                            JsType type, uint64_t value) {
     int size;
 
-    if(!js_config_get_type_is_valid(type) ||
-       !js_config_get_type_is_numeric(type)) {
-        return(-1);
-    }
-
-    size = JS_CONFIG_VALUE + js_config_get_type_size(type) + MIDI_SYSEX_TAIL;
+    size = JS_CONFIG_VALUE + JS_TYPE_INFO[type].size + MIDI_SYSEX_TAIL;
 
     build_js_sysex(buf, size);
     buf[JS_CMD] = JS_CONFIG_SET;
     buf[JS_CONFIG_TYPE] = type;
     memcpy(&(buf[JS_CONFIG_NAME]), name, JS_CONFIG_NAME_LEN);
+    JS_TYPE_INFO[type].encode(value, &(buf[JS_CONFIG_VALUE]));
 
-    switch(js_config_get_type_bits(type)) {
-        case 16:
-            if(value < SHRT_MIN || value > SHRT_MAX) {
-                return(-1);
-            }
+    return(size);
+}
 
-            encode_packed_int16(value, &(buf[JS_CONFIG_VALUE]));
-            break;
-        case 32:
-            if(value < INT_MIN || value > INT_MAX) {
-                return(-1);
-            }
+int build_config_set_sint(unsigned char *buf, const char *name,
+                          JsType type, long long int value) {
+    int bits;
 
-            encode_packed_int32(value, &(buf[JS_CONFIG_VALUE]));
-            break;
-        case 64:
-            /* long long int is this size */
-            encode_packed_int64(value, &(buf[JS_CONFIG_VALUE]));
-            break;
-        default:
-            return(-1);
+    if(!js_config_get_type_is_valid(type) ||
+       !js_config_get_type_is_numeric(type)) {
+        return(-1);
     }
 
-    return(size);
+    /* it fits if it comes back the same once sign extended from the
+     * type's width, long long int is 64 bits */
+    bits = js_config_get_type_bits(type);
+    if(packed_sign_extend(value, bits) != value) {
+        return(-1);
+    }
+
+    return(build_config_set(buf, name, type, value));
 }
 
 int build_config_set_uint(unsigned char *buf, const char *name,
                           JsType type, long long unsigned int value) {
-    int size;
+    int bits;
 
     if(!js_config_get_type_is_valid(type) ||
        !js_config_get_type_is_numeric(type)) {
         return(-1);
     }
 
-    size = JS_CONFIG_VALUE + js_config_get_type_size(type) + MIDI_SYSEX_TAIL;
-
-    build_js_sysex(buf, size);
-    buf[JS_CMD] = JS_CONFIG_SET;
-    buf[JS_CONFIG_TYPE] = type;
-    memcpy(&(buf[JS_CONFIG_NAME]), name, JS_CONFIG_NAME_LEN);
-
-    switch(js_config_get_type_bits(type)) {
-        case 7:
-            if(value > SCHAR_MAX) {
-                return(-1);
-            }
-
-            buf[JS_CONFIG_VALUE] = value;
-            break;
-        case 8:
-            if(value > UCHAR_MAX) {
-                return(-1);
-            }
-
-            encode_packed_uint8(value, &(buf[JS_CONFIG_VALUE]));
-            break;
-        case 16:
-            if(value > USHRT_MAX) {
-                return(-1);
-            }
-
-            encode_packed_uint16(value, &(buf[JS_CONFIG_VALUE]));
-            break;
-        case 32:
-            if(value > UINT_MAX) {
-                return(-1);
-            }
-
-            encode_packed_uint32(value, &(buf[JS_CONFIG_VALUE]));
-            break;
-        case 64:
-            /* long long int is this size */
-            encode_packed_uint64(value, &(buf[JS_CONFIG_VALUE]));
-            break;
-        default:
-            return(-1);
+    bits = js_config_get_type_bits(type);
+    if(bits < 64 && (value >> bits) != 0) {
+        return(-1);
     }
 
-    return(size);
+    return(build_config_set(buf, name, type, value));
 }
 
 #define BUILD_CONFIG(BUF, NAME, TYPE, VAL) (js_config_get_type_is_signed((TYPE)) ? \
@@ -259,6 +245,26 @@ int print_numeric_value(JsConfig *config, const char *name) {
         term_print(NAME " is OFF."); \
     }
 
+int config_fetch_step(JsInfo *js);
+
+/* values in lazily fetched categories might not be in yet, if so its category
+ * is asked for next.
+ * returns 1 if the value is there, 0 if not */
+int config_value_ready(JsInfo *js, JsConfig *config, const char *name) {
+    if(config->validValue) {
+        return(1);
+    }
+
+    if(fetch_request(&fetch, js_config_meta(js, config)->Cat) > 0) {
+        term_print("%s hasn't been read yet, try again in a moment.", name);
+        config_fetch_step(js);
+    } else {
+        term_print("No value for %s.", name);
+    }
+
+    return(0);
+}
+
 int send_toggle_value(JsInfo *js, unsigned int param_num, const char *name) {
     JsConfig *config;
     int value;
@@ -269,6 +275,9 @@ int send_toggle_value(JsInfo *js, unsigned int param_num, const char *name) {
         term_print("Couldn't find config entry for %s.", name);
         return(-1);
     }
+    if(!config_value_ready(js, config, name)) {
+        return(-1);
+    }
 
     value = js_config_get_bool_value(config);
     if(value == JS_NO) {
@@ -284,19 +293,17 @@ int send_toggle_value(JsInfo *js, unsigned int param_num, const char *name) {
     if(size < 0) {
         term_print("Invalid type!");
         return(-1);
-    } else {
-        if(midi_write_event(size, buffer) < 0) {
-            term_print("Failed to write event.");
-            return(-1);
-        }
     }
 
-    return(0);
+    /* sent from the main loop, along with anything else set before it
+     * gets to it */
+    return(batch_add(&batch, size, buffer));
 }
 
 int do_send_numeric_value(JsInfo *js, const char *param_name, const char *name,
                           unsigned long long int numEntry, int numEntryNeg) {
     JsConfig *config;
+    JsConfigMeta *meta;
     int size;
 
     config = js_config_find(js, param_name);
@@ -304,6 +311,7 @@ int do_send_numeric_value(JsInfo *js, const char *param_name, const char *name,
         term_print("Couldn't find config entry for %s.", name);
         return(-1);
     }
+    meta = js_config_meta(js, config);
     if(!js_config_get_type_is_numeric(config->Typ)) {
         term_print("Tried to set nonnumeric type value with number!");
         return(-1);
@@ -320,9 +328,9 @@ int do_send_numeric_value(JsInfo *js, const char *param_name, const char *name,
             return(-1);
         }
         long long int jsSInt = (long long int)numEntry * numEntryNeg;
-        if(jsSInt < config->Lo.sint || jsSInt > config->Hi.sint) {
+        if(jsSInt < meta->Lo.sint || jsSInt > meta->Hi.sint) {
             term_print("WARNING: Entered value %lld is out of reported range %ld to %ld!",
-                       jsSInt, config->Lo.sint, config->Hi.sint);
+                       jsSInt, meta->Lo.sint, meta->Hi.sint);
         }
         term_print("Setting %s to %lld.", name, jsSInt);
         size = BUILD_CONFIG(buffer, param_name, config->Typ, jsSInt);
@@ -343,9 +351,9 @@ int do_send_numeric_value(JsInfo *js, const char *param_name, const char *name,
             term_print("Entered value would be too big.");
             return(-1);
         }
-        if(numEntry < config->Lo.uint || numEntry > config->Hi.uint) {
+        if(numEntry < meta->Lo.uint || numEntry > meta->Hi.uint) {
             term_print("WARNING: Entered value %llu is out of reported range %lu to %lu!",
-                       numEntry, config->Lo.uint, config->Hi.uint);
+                       numEntry, meta->Lo.uint, meta->Hi.uint);
         }
         term_print("Setting %s to %llu.", name, numEntry);
         size = BUILD_CONFIG(buffer, param_name, config->Typ, numEntry);
@@ -354,13 +362,68 @@ int do_send_numeric_value(JsInfo *js, const char *param_name, const char *name,
     if(size < 0) {
         term_print("Invalid type!");
         return(-1);
-    } else {
-        if(midi_write_event(size, buffer) < 0) {
-            term_print("Failed to write event.");
-            return(-1);
+    }
+
+    /* sent from the main loop, along with anything else set before it
+     * gets to it */
+    return(batch_add(&batch, size, buffer));
+}
+
+/* queue the values in a profile which differ from what the guitar has, so
+ * switching between similar profiles only sends a few sets.
+ * returns the number of values queued or -1 on failure */
+int apply_profile(JsInfo *js, const char *path) {
+    Profile *p;
+    unsigned int i;
+    unsigned int sent = 0;
+    char name[JS_CONFIG_NAME_LEN+1];
+
+    if(!fetch_ready(&fetch)) {
+        term_print("Guitar state hasn't been read yet, try again in a moment.");
+        return(-1);
+    }
+
+    p = profile_load(path);
+    if(p == NULL) {
+        return(-1);
+    }
+
+    name[JS_CONFIG_NAME_LEN] = '\0';
+    for(i = 0; i < p->count; i++) {
+        if(profile_entry_changed(js, &(p->entry[i])) <= 0) {
+            continue;
+        }
+
+        memcpy(name, p->entry[i].CC.name, JS_CONFIG_NAME_LEN);
+        if(do_send_numeric_value(js, name, name, p->entry[i].value, p->entry[i].neg) == 0) {
+            sent++;
         }
     }
 
+    if(sent == 0) {
+        term_print("Guitar already matches profile %s.", path);
+    } else {
+        term_print("Applying profile %s, %u of %u values differ.", path, sent, p->count);
+    }
+    profile_free(p);
+
+    return(sent);
+}
+
+int save_profile(JsInfo *js, const char *path) {
+    int count;
+
+    if(fetch.count == 0 || !fetch_complete(&fetch)) {
+        term_print("Still reading config, try again in a moment.");
+        return(-1);
+    }
+
+    count = profile_save(js, path);
+    if(count < 0) {
+        return(-1);
+    }
+    term_print("Saved %d values to profile %s.", count, path);
+
     return(0);
 }
 
@@ -400,9 +463,251 @@ void print_entry(unsigned long long int numEntry, int numEntryNeg) {
     }
 }
 
+void print_latency() {
+    latency_print(midi_get_thru_latency());
+    latency_print(&dwell_latency);
+    latency_print(&handler_latency);
+    latency_print(&(fetch.latency));
+}
+
+int write_latency(const char *path) {
+    FILE *out;
+
+    out = fopen(path, "w");
+    if(out == NULL) {
+        term_print("Failed to open %s for writing.", path);
+        return(-1);
+    }
+
+    if(latency_write(midi_get_thru_latency(), out) < 0 ||
+       latency_write(&dwell_latency, out) < 0 ||
+       latency_write(&handler_latency, out) < 0 ||
+       latency_write(&(fetch.latency), out) < 0) {
+        term_print("Failed to write latency data to %s.", path);
+        fclose(out);
+        return(-1);
+    }
+
+    fclose(out);
+    term_print("Latency data written to %s.", path);
+
+    return(0);
+}
+
+void schema_instrument(GuitarState *g, JsInfo *js) {
+    if(instrument_given || instrument_from_schema(&instrument, js) <= 0) {
+        return;
+    }
+
+    guitar_set_tuning(g, instrument.strings, instrument.tuning);
+    term_print("Instrument is %s with %u strings.",
+               instrument.name, instrument.strings);
+}
+
+/* keep the strings tuned as the guitar says they are */
+void string_open_note(GuitarState *g, JsConfig *config) {
+    unsigned int string = config->CC.name[JS_PARAM_STRING_OFFSET] - '0';
+
+    if(instrument_given || string >= instrument.strings) {
+        return;
+    }
+
+    if(js_config_get_type_is_signed(config->Typ)) {
+        instrument.tuning[string] = config->val.sint;
+    } else {
+        instrument.tuning[string] = config->val.uint;
+    }
+    guitar_set_tuning(g, instrument.strings, instrument.tuning);
+}
+
+void select_string(char *string, int keypress) {
+    const char *key;
+    unsigned int i;
+    char note[8];
+    int len;
+
+    /* curses gives special keys values past a char */
+    if(keypress <= 0 || keypress > CHAR_MAX) {
+        return;
+    }
+    key = strchr(STRING_KEYS, keypress);
+    if(key == NULL) {
+        return;
+    }
+    i = key - STRING_KEYS;
+    if(i >= instrument.strings) {
+        term_print("There's no string %u.", i + 1);
+        return;
+    }
+
+    len = midi_num_to_note(sizeof(note) - 1, note, instrument.tuning[i], 0);
+    if(len <= 0) {
+        len = snprintf(note, sizeof(note), "%d", instrument.tuning[i]);
+    }
+    note[len] = '\0';
+
+    *string = '0' + i;
+    term_print("String %u (%s) selected.", i + 1, note);
+}
+
+void usage(const char *argv0) {
+    unsigned int i;
+
+    fprintf(stderr, "USAGE: %s [-b backend] [-p port pattern] [-s schema] [-n rate] [-d depth] [-f rate] [-m name] [-I instrument] [-P profile] [-J]\n"
+                    "  -b  MIDI backend, default %s, one of:",
+            argv0, DEFAULT_BACKEND);
+    for(i = 0; MIDI_BACKENDS[i] != NULL; i++) {
+        fprintf(stderr, " %s", MIDI_BACKENDS[i]->name);
+    }
+    fprintf(stderr, "\n"
+                    "  -p  extended regex matching the guitar's port name, "
+                    "default %s\n"
+                    "  -s  with loopback, schema the emulated guitar uses, "
+                    "default %s\n"
+                    "  -n  with loopback, notes per second the emulated guitar "
+                    "plays on each string, default 0\n"
+                    "  -d  config categories to ask for at once, 0 asks for "
+                    "all of them in one query, default %u\n"
+                    "  -f  most times a second the guitar's state is redrawn, "
+                    "0 redraws on every change, default %u\n"
+                    "  -m  publish the strings' state in shared memory with "
+                    "this name, like %s\n"
+                    "  -I  strings and tuning from a file or one of:",
+            DEFAULT_PORT_PATTERN, DEFAULT_EMU_SCHEMA, FETCH_DEFAULT_DEPTH,
+            GUITAR_DEFAULT_RENDER_RATE, GUITAR_SHM_DEFAULT_NAME);
+    for(i = 0; INSTRUMENTS[i].strings != 0; i++) {
+        fprintf(stderr, " %s", INSTRUMENTS[i].name);
+    }
+    fprintf(stderr, "\n"
+                    "      default is what the guitar reports, or %s\n"
+                    "  -P  apply a profile once the guitar's state has been "
+                    "read\n"
+                    "  -J  parse the schema with json-c instead of the built in "
+                    "parser\n",
+            INSTRUMENT_DEFAULT);
+}
+
+/* send whatever queries the fetch allows right now.
+ * returns 0 on success or -1 on failure */
+int config_fetch_step(JsInfo *js) {
+    int category;
+    int size;
+
+    while((category = fetch_next(&fetch)) != FETCH_NONE) {
+        size = build_config_query(buffer, category == FETCH_ALL ?
+                                          NULL : js_category_name(js, category));
+        if(midi_write_event(size, buffer) < 0) {
+            term_print("Failed to write event.");
+            return(-1);
+        }
+    }
+
+    return(0);
+}
+
+/* like midi_read_event_timed(), but a schema is handed to the parser a
+ * chunk at a time as it arrives instead of being put back together first, so
+ * it can be any size.  Once it's all been parsed, just its header is returned
+ * so the caller knows it's done.
+ * returns the size of a message in buffer, 0 if there's none right now, or
+ * -1 if the schema failed to parse */
+int read_message(JsInfo *js, midi_timestamp *ts) {
+    static unsigned char header[JS_SCHEMA_START];
+    static size_t assembled = 0;
+    static int streaming = 0;
+    static int dropping = 0;
+    static midi_timestamp start;
+    unsigned int flags;
+    int size;
+
+    for(;;) {
+        size = midi_read_event_chunk(sizeof(buffer) - assembled,
+                                     &(buffer[assembled]), ts, &flags);
+        if(size == 0) {
+            return(0);
+        }
+        if((size_t)size > sizeof(buffer) - assembled) {
+            /* what's been put together so far won't fit with this, so drop
+             * it and read this again on its own */
+            term_print("WARNING: Dropped a message too big to hold.");
+            assembled = 0;
+            dropping = 1;
+            continue;
+        }
+
+        if(!(flags & MIDI_EVENT_CONTINUED)) {
+            if(assembled > 0) {
+                /* whatever was in progress was cut off */
+                memmove(buffer, &(buffer[assembled]), size);
+                assembled = 0;
+            }
+            streaming = 0;
+            dropping = 0;
+            start = *ts;
+
+            if(buffer[MIDI_CMD] == MIDI_SYSEX &&
+               (size_t)size > JS_SCHEMA_START &&
+               buffer[JS_CMD] == JS_SCHEMA_RETURN) {
+                memcpy(header, buffer, JS_SCHEMA_START);
+                if(js_schema_stream_begin(js) < 0 ||
+                   js_schema_stream_feed(js, size - JS_SCHEMA_START,
+                                         &(buffer[JS_SCHEMA_START])) < 0) {
+                    return(-1);
+                }
+                streaming = 1;
+            }
+        } else if(streaming) {
+            if(js_schema_stream_feed(js, size, buffer) < 0) {
+                streaming = 0;
+                return(-1);
+            }
+        } else if(dropping || assembled == 0) {
+            /* the rest of something dropped or which lost its start */
+            continue;
+        }
+
+        if(flags & MIDI_EVENT_MORE) {
+            if(!streaming) {
+                assembled += size;
+            }
+            continue;
+        }
+
+        *ts = start;
+        if(streaming) {
+            streaming = 0;
+            if(js_schema_stream_end(js) < 0) {
+                return(-1);
+            }
+            memcpy(buffer, header, JS_SCHEMA_START);
+            return(JS_SCHEMA_START);
+        }
+
+        size += assembled;
+        assembled = 0;
+        return(size);
+    }
+}
+
 int main(int argc, char **argv) {
     int size;
+    int opt;
+    const MidiBackend *backend;
+    const char *backend_name = DEFAULT_BACKEND;
+    const char *port_pattern = DEFAULT_PORT_PATTERN;
+    const char *emu_schema = DEFAULT_EMU_SCHEMA;
+    EmuConfig emu_config = {
+        .note_rate = 0,
+        .note_length_ms = 250,
+        .bend_rate = 50,
+        .expression_rate = 50,
+        .channel = 1,
+        .seed = 1
+    };
+    Emulator *emu = NULL;
     unsigned int i;
+    midi_timestamp ts;
+    uint64_t handler_start;
     const char *inport;
     const char *outport;
     int failed_connect = 0;
@@ -427,7 +732,20 @@ int main(int argc, char **argv) {
 		RPNdata[i][MIDI_RPN_CHANNEL_COARSE_TUNING] = MIDI_2BYTE_WORD(0x40, 0);
     }
 
-    unsigned int cur_category;
+    unsigned int fetch_depth = FETCH_DEFAULT_DEPTH;
+    const char *start_profile = NULL;
+    unsigned int render_rate = GUITAR_DEFAULT_RENDER_RATE;
+    const char *shm_name = NULL;
+    int timeout;
+    int render_timeout;
+    char profile_path[sizeof(PROFILE_FILE) + 20];
+    int fetching = 0;
+    int fetch_announced = 0;
+    int fetch_ret;
+    int cache_category = -1;
+    int checking_cache = 0;
+    int cache_match;
+    int schema_cached = 0;
 
     int keypress;
 
@@ -436,38 +754,116 @@ int main(int argc, char **argv) {
 
     char string = '0';
 
+    while((opt = getopt(argc, argv, "b:p:s:n:d:f:m:I:P:J")) != -1) {
+        switch(opt) {
+            case 'b':
+                backend_name = optarg;
+                break;
+            case 'p':
+                port_pattern = optarg;
+                break;
+            case 's':
+                emu_schema = optarg;
+                break;
+            case 'n':
+                emu_config.note_rate = atoi(optarg);
+                break;
+            case 'd':
+                fetch_depth = atoi(optarg);
+                break;
+            case 'f':
+                render_rate = atoi(optarg);
+                break;
+            case 'm':
+                shm_name = optarg;
+                break;
+            case 'I':
+                if(instrument_get(&instrument, optarg) < 0) {
+                    goto error;
+                }
+                instrument_given = 1;
+                break;
+            case 'P':
+                start_profile = optarg;
+                break;
+            case 'J':
+                if(js_set_schema_parser(JsSchemaParserJsonC) < 0) {
+                    goto error;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                goto error;
+        }
+    }
+
+    backend = midi_find_backend(backend_name);
+    if(backend == NULL) {
+        fprintf(stderr, "Unknown backend %s.\n", backend_name);
+        usage(argv[0]);
+        goto error;
+    }
+
+    latency_init(&dwell_latency, "dwell");
+    latency_init(&handler_latency, "handler");
+    latency_init(&(fetch.latency), "category fetch");
+    batch_init(&batch, BATCH_DEFAULT_WINDOW, BATCH_DEFAULT_TIMEOUT_MS,
+               BATCH_DEFAULT_RETRIES);
+
     js = js_init();
     if(js == NULL) {
        goto error;
     }
 
-    g = guitar_init();
+    if(!instrument_given) {
+        instrument = *instrument_find(INSTRUMENT_DEFAULT);
+    }
+    g = guitar_init(instrument.strings, instrument.tuning);
     if(g == NULL) {
         goto error_js_cleanup;
     }
+    guitar_set_render_rate(g, render_rate);
+    /* strings are tracked in the process callback as events arrive, this
+     * thread only prints them */
+    guitar_attach(g);
 
     if(term_setup(1) < 0) {
         fprintf(stderr, "Failed to setup terminal.");
         goto error_guitar_cleanup;
     }
 
-    term_print("Setting up JACK...");
+    if(shm_name != NULL) {
+        if(guitar_shm_export(g, shm_name) < 0) {
+            goto error_term_cleanup;
+        }
+        term_print("Guitar state is published in shared memory %s.", shm_name);
+    }
+
+    if(backend == &midi_backend_loopback) {
+        term_print("Emulating a guitar with schema %s...", emu_schema);
+        emu = emu_init(emu_schema, midi_loopback_get_sample_rate(), &emu_config);
+        if(emu == NULL) {
+            goto error_term_cleanup;
+        }
+        emu_attach(emu);
+    }
+
+    term_print("Setting up %s...", backend->name);
 
     /* default to filtering sysex, otherwise the thru port isn't _that_ useful */
-    if(midi_setup(JACK_NAME, INPORT_NAME, OUTPORT_NAME, THRUPORT_NAME,
-                  1, pthread_self()) < 0) {
-        term_print("Failed to set up JACK.");
-        goto error_term_cleanup;
+    if(midi_setup(backend, CLIENT_NAME, INPORT_NAME, OUTPORT_NAME, THRUPORT_NAME, 1) < 0) {
+        term_print("Failed to set up %s.", backend->name);
+        goto error_emu_cleanup;
     }
 
-    term_print("JACK client activated...");
+    term_print("%s client activated...", backend->name);
 
-    inport = midi_find_port(".*Jamstik MIDI IN$", JackPortIsInput);
+    inport = midi_find_port(port_pattern, MIDI_PORT_IS_INPUT);
     if(inport == NULL) {
         term_print("Failed to find input port.");
         goto error_midi_cleanup;
     }
-    outport = midi_find_port(".*Jamstik MIDI IN$", JackPortIsOutput);
+    outport = midi_find_port(port_pattern, MIDI_PORT_IS_OUTPUT);
     if(outport == NULL) {
         term_print("Failed to find output port.");
         goto error_midi_cleanup;
@@ -477,16 +873,16 @@ int main(int argc, char **argv) {
         term_print("Failed to connect input port.");
         failed_connect = 1;
     } else {
-        /* yield to be interrupted by a signal once connection is complete */
-        usleep(1000000);
+        /* returns early once connection is complete */
+        midi_wait_event(1000, -1);
     }
 
     if(midi_attach_out_port_by_name(inport) < 0) {
         term_print("Failed to connect output port.");
         failed_connect = 1;
     } else {
-        /* yield to be interrupted by a signal once connection is complete */
-        usleep(1000000);
+        /* returns early once connection is complete */
+        midi_wait_event(1000, -1);
     }
 
     if(failed_connect) {
@@ -494,21 +890,38 @@ int main(int argc, char **argv) {
                    "they must be connected manually."
                    "Connect these:\n"
                    "%s\nto\n%s:%s\nand\n%s:%s\nto\n%s",
-                   outport, JACK_NAME, INPORT_NAME,
-                   JACK_NAME, OUTPORT_NAME, inport);
+                   outport, CLIENT_NAME, INPORT_NAME,
+                   CLIENT_NAME, OUTPORT_NAME, inport);
     }
 
     /* wait until connections have been made, but stop if interrupted */
     while(!midi_ready() && midi_activated()) {
-        /* this would be interrupted early when a connection is made */
-        usleep(1000000);
+        /* this returns early when a connection is made */
+        midi_wait_event(1000, -1);
     }
 
     /* TODO: Something here to sync up with something because this doesn't work but adding a delay "fixes" it */
     usleep(1000000);
 
-    /* fetch all state */
-    size = build_schema_query(buffer, NULL);
+    /* fetch all state, a cached schema is only used once the firmware
+     * version is confirmed to be the same */
+    if(js_cache_load(js, SCHEMA_CACHE_FILE) == 0) {
+        cache_category = js_fingerprint_category(js);
+        if(cache_category < 0) {
+            js_free(js);
+            js = js_init();
+            if(js == NULL) {
+                goto error_midi_cleanup;
+            }
+        }
+    }
+    if(cache_category >= 0) {
+        term_print("Loaded cached schema, checking firmware version...");
+        checking_cache = 1;
+        size = build_config_query(buffer, js_category_name(js, cache_category));
+    } else {
+        size = build_schema_query(buffer, NULL);
+    }
     /* should just error if things were interrupted before this point */
     if(midi_write_event(size, buffer) < 0) {
         term_print("Failed to write event.");
@@ -606,65 +1019,61 @@ int main(int argc, char **argv) {
                 case 'f':
                     send_string_value(js, JsParamTrigger, string, "string trigger sensitivity", numEntry, numEntryNeg);
                     break;
-                case 'z':
-                    string = '0';
-                    term_print("String 1 (low E) selected.");
+                case 'g':
+                    snprintf(profile_path, sizeof(profile_path), PROFILE_FILE, numEntry);
+                    apply_profile(js, profile_path);
                     break;
-                case 'x':
-                    string = '1';
-                    term_print("String 2 (A) selected.");
+                case 'G':
+                    snprintf(profile_path, sizeof(profile_path), PROFILE_FILE, numEntry);
+                    save_profile(js, profile_path);
                     break;
-                case 'c':
-                    string = '2';
-                    term_print("String 3 (D) selected.");
+                case 'l':
+                    print_latency();
                     break;
-                case 'v':
-                    string = '3';
-                    term_print("String 4 (G) selected.");
-                    break;
-                case 'b':
-                    string = '4';
-                    term_print("String 5 (B) selected.");
-                    break;
-                case 'n':
-                    string = '5';
-                    term_print("String 6 (high E) selected.");
+                case 'L':
+                    write_latency(LATENCY_FILE);
                     break;
                 case 'q':
                     term_cleanup();
                     midi_cleanup();
                     /* will fall through loop and terminate */
+                    break;
+                default:
+                    select_string(&string, keypress);
             }
         }
 
         for(;;) {
-            size = midi_read_event(sizeof(buffer), buffer);
-            if(size > 0) {
+            size = read_message(js, &ts);
+            if(size < 0) {
+                term_print("Failed to parse schema.");
+                goto error_midi_cleanup;
+            } else if(size > 0) {
+                handler_start = midi_time_ns();
+                latency_record(&dwell_latency, handler_start - ts.ns);
+
                 if(buffer[MIDI_CMD] == MIDI_SYSEX) {
+                    fetch_ret = 0;
                     switch(buffer[JS_CMD]) {
                         case JS_SCHEMA_RETURN:
-                            if(js_parse_json_schema(js, size, buffer) < 0) {
-                                term_print("Failed to parse schema.");
-                                goto error_midi_cleanup;
-                            }
-
-                            cur_category = 0;
-
-                            size = build_config_query(buffer, js->categories[cur_category]);
-                            if(midi_write_event(size, buffer) < 0) {
-                                term_print("Failed to write event.");
-                                goto error_midi_cleanup;
-                            }
+                            /* already parsed as it came in */
+                            schema_instrument(g, js);
+                            fetch_init(&fetch, js, fetch_depth);
+                            fetching = 1;
+                            fetch_announced = 0;
+                            fetch_ret = config_fetch_step(js);
                             break;
-                        case JS_CONFIG_RETURN:
                         case JS_CONFIG_SET_RETURN:
+                            batch_ack(&batch, size, buffer);
+                            /* fall through */
+                        case JS_CONFIG_RETURN:
                             config = js_decode_config_value(js, size, buffer);
                             if(config == NULL) {
                                 term_print("WARNING: Got no value back!");
-                                continue;
+                                break;
                             }
 
-                            switch(lookup_param(config->CC)) {
+                            switch(lookup_param(config->CC.name)) {
                                 case JsParamExpression:
                                     PRINT_BOOL_VALUE(config, "Expression", value)
                                     break;
@@ -712,6 +1121,7 @@ int main(int argc, char **argv) {
                                     print_numeric_value(config, "Maximum velocity");
                                     break;
                                 case JsParamOpenNote:
+                                    string_open_note(g, config);
                                     print_numeric_value(config, "String open note");
                                     break;
                                 case JsParamTrigger:
@@ -726,26 +1136,77 @@ int main(int argc, char **argv) {
 
                             break;
                         case JS_CONFIG_DONE:
-                            if(cur_category < js->category_count) {
-                                size = build_config_query(buffer, js->categories[cur_category]);
-                                if(midi_write_event(size, buffer) < 0) {
-                                    term_print("Failed to write event.");
-                                    goto error_midi_cleanup;
+                            if(checking_cache) {
+                                checking_cache = 0;
+                                cache_match = js_cache_check(js);
+                                if(cache_match == 1) {
+                                    term_print("Firmware matches cached schema.");
+                                    schema_cached = 1;
+                                    schema_instrument(g, js);
+                                    fetch_init(&fetch, js, fetch_depth);
+                                    /* that was just read to check it */
+                                    fetch_mark_done(&fetch, cache_category);
+                                    fetching = 1;
+                                    fetch_announced = 0;
+                                    fetch_ret = config_fetch_step(js);
+                                } else {
+                                    if(cache_match < 0) {
+                                        /* nothing to compare, not a mismatch */
+                                        term_print("Firmware version wasn't all read, fetching schema.");
+                                    } else {
+                                        term_print("Firmware changed, fetching schema.");
+                                    }
+                                    js_free(js);
+                                    js = js_init();
+                                    if(js == NULL) {
+                                        goto error_midi_cleanup;
+                                    }
+                                    size = build_schema_query(buffer, NULL);
+                                    if(midi_write_event(size, buffer) < 0) {
+                                        term_print("Failed to write event.");
+                                        goto error_midi_cleanup;
+                                    }
                                 }
-                                cur_category++;
-                            } else if(cur_category == js->category_count) {
-                                term_print("Done reading config.");
-                                /*
-                                for(i = 0; i < js->config_count; i++) {
-                                    js_config_print(js, &(js->config[i]));
+                            } else if(fetching) {
+                                if(size < JS_CONFIG_QUERY_LEN) {
+                                    /* no name, so it's whichever is oldest */
+                                    memset(&(buffer[JS_CONFIG_NAME]), 0, JS_CONFIG_NAME_LEN);
                                 }
-                                */
-                                cur_category++;
+                                fetch_done(&fetch, js, (const char *)&(buffer[JS_CONFIG_NAME]));
+                                fetch_ret = config_fetch_step(js);
                             }
                             break;
                         default:
                             print_hex(size, buffer);
                     }
+
+                    if(fetch_ret < 0) {
+                        goto error_midi_cleanup;
+                    }
+                    if(fetching && !fetch_announced && fetch_ready(&fetch)) {
+                        fetch_announced = 1;
+                        term_print("Guitar state ready in %.1f ms, %u of %u categories read.",
+                                   fetch_ready_ns(&fetch) / 1000000.0,
+                                   fetch.done, fetch.count);
+                        if(start_profile != NULL) {
+                            apply_profile(js, start_profile);
+                            start_profile = NULL;
+                        }
+                    }
+                    if(fetching && fetch_complete(&fetch)) {
+                        fetching = 0;
+                        term_print("Done reading config, %u categories in %.1f ms.",
+                                   fetch.count, fetch_elapsed_ns(&fetch) / 1000000.0);
+                        if(!schema_cached &&
+                           js_cache_save(js, SCHEMA_CACHE_FILE) == 0) {
+                            schema_cached = 1;
+                        }
+                        /*
+                        for(i = 0; i < js->config_count; i++) {
+                            js_config_print(js, &(js->config[i]));
+                        }
+                        */
+                    }
                 } else {
                     channel = buffer[MIDI_CMD] & MIDI_CHANNEL_MASK;
 
@@ -874,21 +1335,58 @@ int main(int argc, char **argv) {
                             print_hex(size, buffer);
                     }
                 }
+
+                latency_record(&handler_latency, midi_time_ns() - handler_start);
             } else {
-                /* if no packets, sleep for a bit */
+                /* if no packets, wait for more */
                 break;
             }
         }
-        usleep(100000);
+
+        /* send any queued sets now that their acks can't be missed */
+        if(batch_poll(&batch) >= BatchCommitted) {
+            batch_report(&batch);
+            batch_reset(&batch);
+        }
+
+        /* events only mark what they changed, draw it all at once no more
+         * often than the render rate */
+        guitar_render(g);
+
+        /* sleep until there's an event or a keypress, stdin isn't read
+         * through curses in print mode, so don't wake up for it.  wake up
+         * for a set which has been waiting too long for its ack or for
+         * changes which were held back to be drawn */
+        timeout = batch_timeout_ms(&batch);
+        render_timeout = guitar_render_timeout_ms(g);
+        if(render_timeout >= 0 && (timeout < 0 || render_timeout < timeout)) {
+            timeout = render_timeout;
+        }
+        midi_wait_event(timeout, term_print_mode() ? -1 : STDIN_FILENO);
     }
 
+    /* already done on quit, but not if it was interrupted */
+    term_cleanup();
+    midi_cleanup();
+
+    print_latency();
+    if(emu != NULL) {
+        emu_free(emu);
+    }
+    guitar_shm_unexport(g);
+
     return(EXIT_SUCCESS);
 
 error_midi_cleanup:
     midi_cleanup();
+error_emu_cleanup:
+    if(emu != NULL) {
+        emu_free(emu);
+    }
 error_term_cleanup:
     term_cleanup();
 error_guitar_cleanup:
+    guitar_shm_unexport(g);
     free(g);
 error_js_cleanup:
     js_free(js);
@@ -20,43 +20,75 @@
 /* TODO: thru port with optional SYSEX filter */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <errno.h>
 #include <signal.h>
 #include <pthread.h>
-
-#include <jack/jack.h>
-#include <jack/midiport.h>
-#include <jack/ringbuffer.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
 
 #include "terminal.h"
+#include "latency.h"
 #include "midi.h"
+#include "midi_backend.h"
+#include "midi_ring.h"
+
+/* messages from the process callback, which can't format or print anything
+ * itself, so it queues up the arguments and another thread prints them */
+#define MIDI_LOG_SIZE (256) /* must be a power of 2 */
+#define MIDI_LOG_ARGS (4)
+
+typedef enum {
+    MidiLogAddEventFailed = 0,
+    MidiLogWriteFailed,
+    MidiLogThruWriteFailed,
+    MidiLogMax
+} MidiLogID;
+
+/* arguments are always passed as long */
+const char *MIDI_LOG_FORMATS[] = {
+    "Failed to add event. (size %ld)",
+    "Failed to write event. (size %ld at %ld)",
+    "Failed to write thru event. (size %ld at %ld)"
+};
 
-#define MIDI_MAX_EVENTS (256) /* should also be plenty, maybe */
-
-typedef struct midi_event {
-    size_t size;
-    unsigned char buffer[MIDI_MAX_BUFFER_SIZE];
-} midi_event;
+typedef struct {
+    MidiLogID id;
+    long arg[MIDI_LOG_ARGS];
+} MidiLogRecord;
 
-/* probably awful crappy ring buffer but I have no idea how to do these so this
-   will have to do */
 typedef struct {
-    midi_event event[MIDI_MAX_EVENTS];
-    jack_ringbuffer_t *rb;
-    unsigned int next_event;
-    size_t sysex;
-} EventRB;
+    MidiLogRecord rec[MIDI_LOG_SIZE];
+    atomic_uint readpos;
+    atomic_uint writepos;
+    atomic_uint dropped;
+} MidiLogRB;
+
+typedef enum {
+    MidiJoinedNone = 0,
+    MidiJoinedCollecting,
+    MidiJoinedComplete
+} MidiJoinedState;
 
 typedef struct {
-    jack_client_t *jack;
+    const MidiBackend *backend;
     int activated;
     int ready;
     int filter_sysex;
-    pthread_t pid;
+    uint32_t sample_rate;
+
+    /* written to wake up the thread waiting in midi_wait_event() */
+    int wakefd;
+    atomic_int waiting;
 
-    jack_port_t *in;
-    jack_port_t *out;
-    jack_port_t *thru;
+    /* set by the signal handler, the main thread sees it through
+     * midi_activated() and cleans up itself */
+    volatile sig_atomic_t interrupted;
 
     char *this_inport_name;
     char *this_outport_name;
@@ -66,10 +98,30 @@ typedef struct {
 
     EventRB inEv, outEv;
 
+    /* a sysex that arrived in chunks being put back together for
+     * midi_read_event_timed(), only touched by the reader */
+    unsigned char *joined;
+    size_t joined_size;
+    midi_timestamp joined_ts;
+    int joined_state;
+
+    MidiLogRB log;
+    pthread_t log_thread;
+    int log_thread_running;
+    int logfd;
+    atomic_int log_stop;
+
+    /* only recorded to from the process callback */
+    LatencyHist thru_latency;
+
+    MidiEventHook event_hook;
+    void *event_hook_priv;
+    MidiPeriodHook period_hook;
+    void *period_hook_priv;
+
     struct sigaction ohup;
     struct sigaction oint;
     struct sigaction oterm;
-    struct sigaction ousr1;
 } MIDI_ctx_t;
 
 /* must be global so signal handlers work. */
@@ -112,34 +164,189 @@ char *midi_copy_string(const char *src) {
     return(dst);
 }
 
+uint64_t midi_time_ns() {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return((uint64_t)t.tv_sec * 1000000000 + t.tv_nsec);
+}
+
+/* only to be called from the process callback */
+void _midi_log(MidiLogID id, unsigned int nargs, ...) {
+    unsigned int writepos = atomic_load_explicit(&(midictx.log.writepos), memory_order_relaxed);
+    unsigned int readpos = atomic_load_explicit(&(midictx.log.readpos), memory_order_acquire);
+    MidiLogRecord *rec;
+    uint64_t val = 1;
+    unsigned int i;
+    va_list ap;
+
+    if(writepos - readpos >= MIDI_LOG_SIZE) {
+        atomic_fetch_add_explicit(&(midictx.log.dropped), 1, memory_order_relaxed);
+        return;
+    }
+
+    rec = &(midictx.log.rec[writepos & (MIDI_LOG_SIZE - 1)]);
+    rec->id = id;
+    va_start(ap, nargs);
+    for(i = 0; i < MIDI_LOG_ARGS; i++) {
+        rec->arg[i] = i < nargs ? va_arg(ap, long) : 0;
+    }
+    va_end(ap);
+
+    atomic_store_explicit(&(midictx.log.writepos), writepos + 1, memory_order_release);
+
+    if(write(midictx.logfd, &val, sizeof(val)) < 0) {
+        /* counter can't be saturated in practice */
+    }
+}
+
+void _midi_log_drain() {
+    unsigned int readpos = atomic_load_explicit(&(midictx.log.readpos), memory_order_relaxed);
+    unsigned int writepos = atomic_load_explicit(&(midictx.log.writepos), memory_order_acquire);
+    unsigned int dropped;
+    MidiLogRecord *rec;
+
+    for(; readpos != writepos; readpos++) {
+        rec = &(midictx.log.rec[readpos & (MIDI_LOG_SIZE - 1)]);
+        if(rec->id >= 0 && rec->id < MidiLogMax) {
+            term_print(MIDI_LOG_FORMATS[rec->id],
+                       rec->arg[0], rec->arg[1], rec->arg[2], rec->arg[3]);
+        }
+        atomic_store_explicit(&(midictx.log.readpos), readpos + 1, memory_order_release);
+    }
+
+    dropped = atomic_exchange_explicit(&(midictx.log.dropped), 0, memory_order_relaxed);
+    if(dropped > 0) {
+        term_print("%u log messages dropped.", dropped);
+    }
+}
+
+void *_midi_log_thread(void *arg) {
+    struct pollfd pfd;
+    uint64_t val;
+
+    pfd.fd = midictx.logfd;
+    pfd.events = POLLIN;
+
+    while(!atomic_load(&(midictx.log_stop))) {
+        if(poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+            break;
+        }
+        if(read(midictx.logfd, &val, sizeof(val)) < 0) {
+            /* EAGAIN, nothing to do */
+        }
+        _midi_log_drain();
+    }
+
+    /* get anything remaining */
+    _midi_log_drain();
+
+    return(NULL);
+}
+
+int _midi_log_start() {
+    sigset_t set, oset;
+    int err;
+
+    atomic_init(&(midictx.log.readpos), 0);
+    atomic_init(&(midictx.log.writepos), 0);
+    atomic_init(&(midictx.log.dropped), 0);
+    atomic_init(&(midictx.log_stop), 0);
+
+    midictx.logfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(midictx.logfd < 0) {
+        return(-1);
+    }
+
+    /* signals should go to the main thread, so start the thread with them
+     * all blocked */
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &oset);
+    err = pthread_create(&(midictx.log_thread), NULL, _midi_log_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &oset, NULL);
+    if(err != 0) {
+        close(midictx.logfd);
+        midictx.logfd = -1;
+        return(-1);
+    }
+    midictx.log_thread_running = 1;
+
+    return(0);
+}
+
+void _midi_log_stop() {
+    uint64_t val = 1;
+
+    if(midictx.log_thread_running) {
+        atomic_store(&(midictx.log_stop), 1);
+        if(write(midictx.logfd, &val, sizeof(val)) < 0) {
+            /* thread will still be woken up */
+        }
+        pthread_join(midictx.log_thread, NULL);
+        midictx.log_thread_running = 0;
+    }
+
+    if(midictx.logfd >= 0) {
+        close(midictx.logfd);
+        midictx.logfd = -1;
+    }
+}
+
+int _midi_rb_init(EventRB *e) {
+    e->buf = malloc(MIDI_RING_SIZE);
+    if(e->buf == NULL) {
+        return(-1);
+    }
+    atomic_init(&(e->readpos), 0);
+    atomic_init(&(e->writepos), 0);
+    e->high_water = 0;
+    e->pending = NULL;
+    e->pending_pad = 0;
+    e->sysex = 0;
+    e->sysex_dropped = 0;
+    e->sent = 0;
+
+    return(0);
+}
+
+void _midi_rb_free(EventRB *e) {
+    if(e->buf != NULL) {
+        free(e->buf);
+        e->buf = NULL;
+    }
+}
+
+/* 0 once interrupted by a signal, midi_cleanup() should then be called */
 int midi_activated() {
-    return(midictx.activated);
+    return(midictx.activated && !midictx.interrupted);
 }
 
 void midi_cleanup() {
+    if(midictx.backend == NULL) {
+        return;
+    }
+
     if(midictx.activated) {
-        if(jack_deactivate(midictx.jack)) {
-            term_print("Failed to deactivate JACK client.");
-        } else {
-            term_print("JACK client deactivated.");
-        }
+        midictx.backend->deactivate();
     }
 
     midictx.activated = 0;
 
-    if(jack_client_close(midictx.jack)) {
-        term_print("Error closing JACK connection.");
-    } else {
-        term_print("JACK connection closed.");
-    }
+    midictx.backend->close();
+
+    /* process callback won't run any more so there'll be no more messages */
+    _midi_log_stop();
 
     if(sigaction(SIGHUP, &(midictx.ohup), NULL) != 0 ||
        sigaction(SIGINT, &(midictx.oint), NULL) != 0 ||
        sigaction(SIGTERM, &(midictx.oterm), NULL) != 0) {
         term_print("Failed to set signal handler.");
     }
-    if(sigaction(SIGUSR1, &(midictx.ousr1), NULL) != 0) {
-        term_print("Failed to reset signal handlers.");
+
+    if(midictx.wakefd >= 0) {
+        close(midictx.wakefd);
+        midictx.wakefd = -1;
     }
 
     if(midictx.this_inport_name != NULL) {
@@ -159,179 +366,333 @@ void midi_cleanup() {
         midictx.guitar_outport_name = NULL;
     }
 
-    if(midictx.inEv.rb != NULL) {
-        jack_ringbuffer_free(midictx.inEv.rb);
+    _midi_rb_free(&(midictx.inEv));
+    _midi_rb_free(&(midictx.outEv));
+
+    if(midictx.joined != NULL) {
+        free(midictx.joined);
+        midictx.joined = NULL;
     }
 
-    if(midictx.outEv.rb != NULL) {
-        jack_ringbuffer_free(midictx.outEv.rb);
+    midictx.backend = NULL;
+}
+
+static void _midi_chain_handler(const struct sigaction *old, int signum) {
+    if(old->sa_handler != SIG_DFL && old->sa_handler != SIG_IGN) {
+        old->sa_handler(signum);
     }
 }
 
+/* cleaning up joins threads, closes and frees, none of which can be done in
+ * a signal handler, and the log thread may be waiting on the terminal lock
+ * the interrupted thread holds.  Only flag it and wake up the main thread */
 static void _midi_cleanup_handler(int signum) {
-    midi_cleanup();
-    if(signum == SIGHUP && midictx.ohup.sa_handler != NULL) {
-        midictx.ohup.sa_handler(signum);
-    } else if(signum == SIGINT && midictx.oint.sa_handler != NULL) {
-        midictx.oint.sa_handler(signum);
-    } else if(signum == SIGTERM && midictx.oterm.sa_handler != NULL) {
-        midictx.oterm.sa_handler(signum);
+    uint64_t val = 1;
+
+    midictx.interrupted = 1;
+    if(midictx.wakefd >= 0) {
+        if(write(midictx.wakefd, &val, sizeof(val)) < 0) {
+            /* already woken up */
+        }
+    }
+
+    if(signum == SIGHUP) {
+        _midi_chain_handler(&(midictx.ohup), signum);
+    } else if(signum == SIGINT) {
+        _midi_chain_handler(&(midictx.oint), signum);
+    } else if(signum == SIGTERM) {
+        _midi_chain_handler(&(midictx.oterm), signum);
+    }
+}
+
+static void _midi_signal() {
+    uint64_t val = 1;
+
+    if(write(midictx.wakefd, &val, sizeof(val)) < 0) {
+        /* nothing useful to do, the counter could only be saturated which
+         * would wake the waiter anyway */
     }
 }
 
-static void _midi_usr1_handler(int signum) {
+/* only make the syscall if the other thread is actually sleeping, it'll see
+ * anything queued otherwise.  The ring is only release/acquire, so the fence
+ * keeps the commit before it from being ordered after the check of waiting,
+ * pairing with the one in midi_wait_event() */
+static void _midi_wake() {
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_exchange(&(midictx.waiting), 0)) {
+        _midi_signal();
+    }
+}
+
+/* get contiguous space for a record which may hold up to size bytes, it's not
+ * visible to the reader until committed */
+midi_event *_midi_rb_reserve(EventRB *e, size_t size) {
+    size_t writepos = atomic_load_explicit(&(e->writepos), memory_order_relaxed);
+    size_t readpos = atomic_load_explicit(&(e->readpos), memory_order_acquire);
+    size_t pos = writepos & (MIDI_RING_SIZE - 1);
+    size_t record = MIDI_RECORD_SIZE(size);
+    size_t pad = 0;
+
+    if(MIDI_RING_SIZE - pos < record) {
+        /* skip the remainder of the buffer */
+        pad = MIDI_RING_SIZE - pos;
+        pos = 0;
+    }
+
+    if(MIDI_RING_SIZE - (writepos - readpos) < pad + record) {
+        return(NULL);
+    }
+
+    e->pending = (midi_event *)&(e->buf[pos]);
+    e->pending_pad = pad;
+
+    return(e->pending);
+}
+
+/* make the pending record visible to the reader, with its final size */
+void _midi_rb_commit(EventRB *e) {
+    size_t writepos = atomic_load_explicit(&(e->writepos), memory_order_relaxed);
+    size_t readpos;
+
+    if(e->pending_pad > 0) {
+        ((midi_event *)&(e->buf[writepos & (MIDI_RING_SIZE - 1)]))->size = MIDI_RING_PAD;
+    }
+    writepos += e->pending_pad + MIDI_RECORD_SIZE(e->pending->size);
+    e->pending = NULL;
+    e->pending_pad = 0;
+
+    atomic_store_explicit(&(e->writepos), writepos, memory_order_release);
+
+    readpos = atomic_load_explicit(&(e->readpos), memory_order_relaxed);
+    if(writepos - readpos > e->high_water) {
+        e->high_water = writepos - readpos;
+    }
 }
 
 midi_event *_midi_get_event(EventRB *e) {
+    size_t readpos = atomic_load_explicit(&(e->readpos), memory_order_relaxed);
+    size_t writepos = atomic_load_explicit(&(e->writepos), memory_order_acquire);
     midi_event *ev;
 
-    if(jack_ringbuffer_read_space(e->rb) < sizeof(midi_event *)) {
+    if(readpos == writepos) {
         return(NULL);
     }
 
-    if(jack_ringbuffer_peek(e->rb, (char *)(&ev), sizeof(midi_event *))
-       < sizeof(midi_event *)) {
-        return(NULL);
+    ev = (midi_event *)&(e->buf[readpos & (MIDI_RING_SIZE - 1)]);
+    if(ev->size == MIDI_RING_PAD) {
+        /* pad is always followed by a record */
+        readpos += MIDI_RING_SIZE - (readpos & (MIDI_RING_SIZE - 1));
+        atomic_store_explicit(&(e->readpos), readpos, memory_order_release);
+        ev = (midi_event *)e->buf;
     }
 
     return(ev);
 }
 
 int _midi_consume_event(EventRB *e) {
-    if(jack_ringbuffer_read_space(e->rb) < sizeof(midi_event *)) {
+    midi_event *ev;
+
+    ev = _midi_get_event(e);
+    if(ev == NULL) {
         return(-1);
     }
 
-    jack_ringbuffer_read_advance(e->rb, sizeof(midi_event *));
+    atomic_store_explicit(&(e->readpos),
+                          atomic_load_explicit(&(e->readpos), memory_order_relaxed) +
+                          MIDI_RECORD_SIZE(ev->size),
+                          memory_order_release);
 
     return(0);
 }
 
-/* returns 0 on success
+/* each chunk of a sysex is its own record as soon as it arrives, so the
+ * reader can start on a long message before it's all been received and there's
+ * no limit on the size of the whole message, only on each chunk.
+ * returns 0 on success
  *        -1 on failure
  *         1 on sysex message complete
  *         2 on sysex message in progress */
-int _midi_add_event(EventRB *e, size_t size, unsigned char *buf) {
+int _midi_add_event(EventRB *e, size_t size, unsigned char *buf,
+                    const midi_timestamp *ts) {
     midi_event *ev;
+    unsigned int flags = 0;
+    int sysex;
 
-    if(jack_ringbuffer_write_space(e->rb) < sizeof(midi_event *)) {
+    if(size == 0) {
         return(-1);
     }
 
-    ev = &(e->event[e->next_event]);
     if(e->sysex) {
-        ev->size += size;
-        memcpy(&(ev->buffer[e->sysex]), buf, size);
-        /* if the end of the sysex command is not found, there's more */
-        if(buf[size-1] != 0xF7) {
-            /* advance pointer */
-            e->sysex += size;
-            /* indicate success, but a full packet hasn't been received */
-            return(2);
-        }
-    } else {
-        ev->size = size;
-        memcpy(ev->buffer, buf, size);
-        if(buf[0] == 0xF0) {
-            /* if this is part of a sysex, indicate next time to continue ingesting */
-            e->sysex = size;
-            if(buf[size-1] != 0xF7) {
-                /* return now */
-                return(2);
-            }
+        flags |= MIDI_EVENT_CONTINUED;
+    }
+    sysex = e->sysex || buf[0] == MIDI_SYSEX;
+    /* if the end of the sysex command is not found, there's more */
+    if(sysex && buf[size-1] != MIDI_SYSEX_END) {
+        flags |= MIDI_EVENT_MORE;
+    }
+
+    if(e->sysex_dropped) {
+        /* already failed once, quietly drop what's left of it */
+        if(!(flags & MIDI_EVENT_MORE)) {
+            e->sysex = 0;
+            e->sysex_dropped = 0;
+            return(1);
         }
+        return(2);
     }
 
-    if(jack_ringbuffer_write(e->rb, (char *)(&ev), sizeof(midi_event *)) < sizeof(midi_event *)) {
+    if(size > MIDI_MAX_BUFFER_SIZE) {
+        ev = NULL;
+    } else {
+        ev = _midi_rb_reserve(e, size);
+    }
+    if(ev == NULL) {
+        if(flags & MIDI_EVENT_MORE) {
+            /* the reader will see the next message start without this one
+             * having finished and throw away what it has */
+            e->sysex = 1;
+            e->sysex_dropped = 1;
+        } else {
+            e->sysex = 0;
+        }
         return(-1);
     }
+    ev->size = size;
+    ev->flags = flags;
+    ev->ts = *ts;
+    memcpy(ev->buffer, buf, size);
+
+    _midi_rb_commit(e);
 
-    e->next_event += 1;
-    if(e->next_event == MIDI_MAX_EVENTS) {
-        e->next_event = 0;
+    if(flags & MIDI_EVENT_MORE) {
+        /* indicate success, but a full packet hasn't been received */
+        e->sysex = 1;
+        return(2);
     }
+    e->sysex = 0;
 
-    if(e->sysex) {
-        e->sysex = 0;
+    if(sysex) {
         return(1);
     }
 
     return(0);
 }
 
+/* from guitar in to thru out, 1 period plus time spent in the process
+ * callback before it was forwarded */
+const LatencyHist *midi_get_thru_latency() {
+    return(&(midictx.thru_latency));
+}
+
+void _midi_get_ring_stats(EventRB *e, midi_ring_stats *stats) {
+    size_t writepos = atomic_load_explicit(&(e->writepos), memory_order_acquire);
+    size_t readpos = atomic_load_explicit(&(e->readpos), memory_order_acquire);
+
+    stats->size = MIDI_RING_SIZE;
+    stats->used = writepos - readpos;
+    stats->high_water = e->high_water;
+}
+
+void midi_get_ring_stats(midi_ring_stats *in, midi_ring_stats *out) {
+    if(in != NULL) {
+        _midi_get_ring_stats(&(midictx.inEv), in);
+    }
+    if(out != NULL) {
+        _midi_get_ring_stats(&(midictx.outEv), out);
+    }
+}
+
 /* simple function to just transfer data through */
-int _midi_process(jack_nframes_t nframes, void *arg) {
-    jack_midi_event_t jackEvent;
+int midi_backend_process(uint32_t nframes) {
+    const MidiBackend *backend = midictx.backend;
+    MidiBackendEvent inEvent;
     midi_event *event;
+    midi_timestamp ts;
+    uint32_t frame;
+    uint64_t period_ns;
 
-    char *in;
-    char *out;
-    char *thru;
     uint32_t i;
     int has_output = 0;
     int retval;
 
-    thru = jack_port_get_buffer(midictx.thru, nframes);
+    /* everything queued this cycle gets the same wall time, the frame
+     * time distinguishes where in the period it happened */
+    frame = backend->cycle_begin(nframes);
+    ts.ns = midi_time_ns();
+    /* events are delayed by a period going through the backend */
+    if(midictx.sample_rate == 0) {
+        period_ns = 0;
+    } else {
+        period_ns = (uint64_t)nframes * 1000000000 / midictx.sample_rate;
+    }
+
+    if(midictx.period_hook != NULL) {
+        midictx.period_hook(midictx.period_hook_priv);
+    }
 
     /* process queued up input events */
-    in = jack_port_get_buffer(midictx.in, nframes);
     for(i = 0;; i++) {
-        if(jack_midi_event_get(&jackEvent, in, i)) {
+        if(backend->get_in_event(i, &inEvent)) {
             break;
         }
-        retval = _midi_add_event(&(midictx.inEv), jackEvent.size, jackEvent.buffer);
+        ts.frame = frame + inEvent.time;
+        retval = _midi_add_event(&(midictx.inEv), inEvent.size, inEvent.buffer, &ts);
 
         if(retval < 0) {
-            term_print("Failed to add event.");
+            _midi_log(MidiLogAddEventFailed, 1, (long)inEvent.size);
             return(-1);
-        }else if(retval == 0 || retval == 1) {
-            /* 0 is success, 1 is completed a sysex */
-            has_output = 1;
-        } /* 2 indicate a partial sysex packet that is being consumed but not fully received */
+        }
+        /* 0 is success, 1 is completed a sysex, 2 is a chunk of a sysex
+         * that isn't fully received, which can still be read */
+        has_output = 1;
+
+        if(retval == 0 && midictx.event_hook != NULL) {
+            midictx.event_hook(midictx.event_hook_priv, &ts,
+                               inEvent.buffer, inEvent.size);
+        }
 
         /* pass through non-sysex events unconditionally, pass through sysex
          * events if requested */
         if(retval == 0 ||
            ((retval == 1 || retval == 2) && !midictx.filter_sysex)) {
-            /*
-            if(jack_midi_event_write(thru, jackEvent.time,
-                                           jackEvent.buffer,
-                                           jackEvent.size)) {
-                term_print("Failed to write thru event.");
-                return(-3);
+            if(backend->write_thru(inEvent.time,
+                                   inEvent.buffer,
+                                   inEvent.size)) {
+                /* whatever is on the other end missing some events isn't
+                 * worth stopping for */
+                _midi_log(MidiLogThruWriteFailed, 2,
+                          (long)inEvent.size, (long)inEvent.time);
+            } else {
+                latency_record(&(midictx.thru_latency),
+                               period_ns + (midi_time_ns() - ts.ns));
             }
-            */
-            term_print("%d", jack_midi_event_write(thru, jackEvent.time,
-                                           jackEvent.buffer,
-                                           jackEvent.size));
         }
     }
 
     /* process queued up output events */
-    out = jack_port_get_buffer(midictx.out, nframes);
-    jack_midi_clear_buffer(out);
-    off_t offset = 0;
+    uint32_t offset = 0;
     while(offset < nframes) {
         event = _midi_get_event(&(midictx.outEv));
         if(event == NULL) {
             break;
         }
 
-        if(midictx.outEv.sysex) {
+        if(midictx.outEv.sent) {
             /* if actively sending out a packet, continue */
-            size_t to_write = event->size - midictx.outEv.sysex;
+            size_t to_write = event->size - midictx.outEv.sent;
             to_write = nframes < to_write ? nframes : to_write;
-            if(jack_midi_event_write(out, 0,
-                                     &(event->buffer[midictx.outEv.sysex]),
-                                     to_write)) {
-                term_print("Failed to write event.");
+            if(backend->write_out(0,
+                                  &(event->buffer[midictx.outEv.sent]),
+                                  to_write)) {
+                _midi_log(MidiLogWriteFailed, 2, (long)to_write, 0L);
                 return(-3);
             }
-            midictx.outEv.sysex += to_write;
+            midictx.outEv.sent += to_write;
 
             /* if this is the end of the packet, indicate done-ness */
-            if(midictx.outEv.sysex >= event->size) {
-                midictx.outEv.sysex = 0;
+            if(midictx.outEv.sent >= event->size) {
+                midictx.outEv.sent = 0;
                 offset += to_write;
             } else {
                 /* don't consume if not done */
@@ -340,20 +701,20 @@ int _midi_process(jack_nframes_t nframes, void *arg) {
         } else {
             if(offset + event->size > nframes) {
                 /* if the packet doesn't fit, send just enough to fill */
-                midictx.outEv.sysex = nframes - offset;
-                if(jack_midi_event_write(out, offset,
-                                         event->buffer,
-                                         nframes - offset)) {
-                    term_print("Failed to write event.");
+                midictx.outEv.sent = nframes - offset;
+                if(backend->write_out(offset,
+                                      event->buffer,
+                                      nframes - offset)) {
+                    _midi_log(MidiLogWriteFailed, 2, (long)(nframes - offset), (long)offset);
                     return(-3);
                 }
                 /* don't consume the packet that hasn't fully sent */
                 break;
             } else {
-                if(jack_midi_event_write(out, offset,
-                                         event->buffer,
-                                         event->size)) {
-                    term_print("Failed to write event.");
+                if(backend->write_out(offset,
+                                      event->buffer,
+                                      event->size)) {
+                    _midi_log(MidiLogWriteFailed, 2, (long)event->size, (long)offset);
                     return(-3);
                 }
                 offset += event->size;
@@ -364,13 +725,14 @@ int _midi_process(jack_nframes_t nframes, void *arg) {
     }
 
     if(has_output != 0) {
-        pthread_kill(midictx.pid, SIGUSR1);
+        _midi_wake();
     }
 
     return(0);
 }
 
 int midi_write_event(size_t size, unsigned char *buffer) {
+    midi_timestamp ts;
     int ret;
 
     /* if the device closed in another thread, don't try to do anything */
@@ -378,16 +740,35 @@ int midi_write_event(size_t size, unsigned char *buffer) {
         return(-1);
     }
 
-    ret = _midi_add_event(&(midictx.outEv), size, buffer);
     /* don't allow to queue partial sysexes externally */
-    if(ret < 0 || ret > 1) {
+    if(size == 0 ||
+       (buffer[0] == MIDI_SYSEX && buffer[size-1] != MIDI_SYSEX_END)) {
+        return(-1);
+    }
+
+    if(midictx.backend->write_direct != NULL) {
+        return(midictx.backend->write_direct(buffer, size));
+    }
+
+    /* the frame it'll go out on isn't known yet */
+    ts.frame = 0;
+    ts.ns = midi_time_ns();
+
+    ret = _midi_add_event(&(midictx.outEv), size, buffer, &ts);
+    if(ret < 0) {
         return(-1);
     }
 
     return(0);
 }
 
-int midi_read_event(size_t size, unsigned char *buffer) {
+/* read the next record as it was received, which may be only a chunk of a
+ * sysex, flags is set to a mask of MIDI_EVENT_CONTINUED and MIDI_EVENT_MORE
+ * to say where in the message it goes.  Returns the size, or if it's bigger
+ * than size, the size needed without consuming it.
+ * ts and flags may be NULL if they aren't needed */
+int midi_read_event_chunk(size_t size, unsigned char *buffer,
+                          midi_timestamp *ts, unsigned int *flags) {
     midi_event *ev;
     size_t evsize;
 
@@ -405,23 +786,136 @@ int midi_read_event(size_t size, unsigned char *buffer) {
 
     memcpy(buffer, ev->buffer, ev->size);
     evsize = ev->size;
+    if(ts != NULL) {
+        *ts = ev->ts;
+    }
+    if(flags != NULL) {
+        *flags = ev->flags;
+    }
 
     _midi_consume_event(&(midictx.inEv));
 
     return(evsize);
 }
 
-void _midi_print_ports() {
-    const char **search;
-    unsigned int i;
-    jack_port_t *port;
+/* read the next whole message, sysexes which arrive in chunks are put back
+ * together, up to MIDI_MAX_BUFFER_SIZE, anything longer is dropped.
+ * ts may be NULL if the timestamp isn't needed */
+int midi_read_event_timed(size_t size, unsigned char *buffer, midi_timestamp *ts) {
+    midi_event *ev;
+    size_t evsize;
+
+    if(!midictx.activated) {
+        return(0);
+    }
+
+    while(midictx.joined_state != MidiJoinedComplete) {
+        ev = _midi_get_event(&(midictx.inEv));
+        if(ev == NULL) {
+            return(0);
+        }
+
+        if(!(ev->flags & MIDI_EVENT_CONTINUED)) {
+            /* a new message means whatever was in progress was cut off */
+            midictx.joined_state = MidiJoinedNone;
+            if(!(ev->flags & MIDI_EVENT_MORE)) {
+                /* whole message, nothing to put together */
+                return(midi_read_event_chunk(size, buffer, ts, NULL));
+            }
+            midictx.joined_state = MidiJoinedCollecting;
+            midictx.joined_size = 0;
+            midictx.joined_ts = ev->ts;
+        }
+
+        if(midictx.joined_state == MidiJoinedCollecting) {
+            if(midictx.joined_size + ev->size > MIDI_MAX_BUFFER_SIZE) {
+                midictx.joined_state = MidiJoinedNone;
+            } else {
+                memcpy(&(midictx.joined[midictx.joined_size]),
+                       ev->buffer, ev->size);
+                midictx.joined_size += ev->size;
+                if(!(ev->flags & MIDI_EVENT_MORE)) {
+                    midictx.joined_state = MidiJoinedComplete;
+                }
+            }
+        }
+
+        _midi_consume_event(&(midictx.inEv));
+    }
+
+    if(midictx.joined_size > size) {
+        return(midictx.joined_size);
+    }
+
+    memcpy(buffer, midictx.joined, midictx.joined_size);
+    evsize = midictx.joined_size;
+    if(ts != NULL) {
+        *ts = midictx.joined_ts;
+    }
+    midictx.joined_state = MidiJoinedNone;
+
+    return(evsize);
+}
+
+int midi_read_event(size_t size, unsigned char *buffer) {
+    return(midi_read_event_timed(size, buffer, NULL));
+}
+
+/* wait up to timeout milliseconds (negative for forever) for an event to be
+ * available to midi_read_event() or for fd to become readable, fd may be -1
+ * to only wait for events.
+ * returns a mask of MIDI_WAIT_EVENT and MIDI_WAIT_FD, 0 on timeout or
+ * interruption, or -1 on failure */
+int midi_wait_event(int timeout, int fd) {
+    struct pollfd pfd[2];
+    uint64_t val;
+    int ret;
+    int mask = 0;
+
+    if(!midictx.activated) {
+        return(-1);
+    }
+
+    /* announce that a wakeup is needed, then check whether one already
+     * happened so it's not missed */
+    atomic_store(&(midictx.waiting), 1);
+    /* so the ring isn't checked before waiting is seen, see _midi_wake() */
+    atomic_thread_fence(memory_order_seq_cst);
+    if(_midi_get_event(&(midictx.inEv)) != NULL) {
+        atomic_store(&(midictx.waiting), 0);
+        return(MIDI_WAIT_EVENT);
+    }
+
+    pfd[0].fd = midictx.wakefd;
+    pfd[0].events = POLLIN;
+    pfd[0].revents = 0;
+    pfd[1].fd = fd;
+    pfd[1].events = POLLIN;
+    pfd[1].revents = 0;
+
+    ret = poll(pfd, fd < 0 ? 1 : 2, timeout);
+    atomic_store(&(midictx.waiting), 0);
+    if(ret < 0) {
+        if(errno == EINTR) {
+            return(0);
+        }
+        return(-1);
+    }
 
-    search = jack_get_ports(midictx.jack, NULL, NULL, 0);
-    for(i = 0; search[i] != NULL; i++) {
-        port = jack_port_by_name(midictx.jack, search[i]);
-        term_print("%s %02X %s", search[i], jack_port_flags(port), jack_port_type(port));
+    if(pfd[0].revents & POLLIN) {
+        /* just clear the counter */
+        if(read(midictx.wakefd, &val, sizeof(val)) < 0) {
+            /* EAGAIN, somehow already cleared */
+        }
+    }
+    if(_midi_get_event(&(midictx.inEv)) != NULL) {
+        mask |= MIDI_WAIT_EVENT;
     }
-    jack_free(search);
+    if(fd >= 0 && (pfd[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+        mask |= MIDI_WAIT_FD;
+    }
+
+    return(mask);
 }
 
 #define _MIDI_INPORT_MASK  (1 << 0)
@@ -430,14 +924,10 @@ void _midi_print_ports() {
 #define _MIDI_PORT_ID_GUITAR_OUT (2)
 #define _MIDI_PORT_ID_THIS_IN    (3)
 #define _MIDI_PORT_ID_THIS_OUT   (4)
-void _midi_port_connect_cb(jack_port_id_t a, jack_port_id_t b, int connect, void *arg) {
-    const char *namea, *nameb;
+void midi_backend_port_connect(const char *namea, const char *nameb, int connect) {
     int porta_id = 0;
     int portb_id = 0;
 
-    namea = jack_port_name(jack_port_by_id(midictx.jack, a));
-    nameb = jack_port_name(jack_port_by_id(midictx.jack, b));
-
     /* meaningful port identities
      * guitar out, guitar in, this out, this in
      * both a or b could be any of those 4 */
@@ -499,125 +989,113 @@ connected:
         term_print("sequence complete");
     }
 
-    pthread_kill(midictx.pid, SIGUSR1);
+    _midi_signal();
+}
+
+const MidiBackend *MIDI_BACKENDS[] = {
+    &midi_backend_jack,
+    &midi_backend_alsa,
+    &midi_backend_loopback,
+    NULL
+};
+
+const MidiBackend *midi_find_backend(const char *name) {
+    unsigned int i;
+
+    for(i = 0; MIDI_BACKENDS[i] != NULL; i++) {
+        if(strcmp(MIDI_BACKENDS[i]->name, name) == 0) {
+            return(MIDI_BACKENDS[i]);
+        }
+    }
+
+    return(NULL);
 }
 
 int midi_ready() {
     return(midictx.ready == (_MIDI_INPORT_MASK | _MIDI_OUTPORT_MASK));
 }
 
-int midi_setup(const char *client_name, const char *inport_name,
+int midi_setup(const MidiBackend *backend,
+               const char *client_name, const char *inport_name,
                const char *outport_name, const char *thruport_name,
-               int filter_sysex, pthread_t pid) {
-    /* jack stuff */
-    jack_status_t jstatus;
+               int filter_sysex) {
     struct sigaction sa;
     sa.sa_handler = _midi_cleanup_handler;
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = 0;
 
+    midictx.backend = NULL;
     midictx.activated = 0;
+    midictx.interrupted = 0;
     midictx.ready = 0;
     midictx.filter_sysex = filter_sysex;
-    midictx.pid = pid;
+    atomic_init(&(midictx.waiting), 0);
+    midictx.log_thread_running = 0;
+    midictx.logfd = -1;
+    latency_init(&(midictx.thru_latency), "thru");
     midictx.this_inport_name = NULL;
     midictx.this_outport_name = NULL;
     midictx.guitar_inport_name = NULL;
     midictx.guitar_outport_name = NULL;
-    midictx.inEv.next_event = 0;
-    midictx.inEv.rb = NULL;
-    midictx.inEv.sysex = 0;
-    midictx.outEv.next_event = 0;
-    midictx.outEv.rb = NULL;
-    midictx.outEv.sysex = 0;
-
-    midictx.jack = jack_client_open(client_name, JackNoStartServer, &jstatus);
-    if(midictx.jack == NULL) {
-        term_print("Failed to open JACK connection.");
+    midictx.inEv.buf = NULL;
+    midictx.outEv.buf = NULL;
+    midictx.joined = NULL;
+    midictx.joined_state = MidiJoinedNone;
+
+    midictx.wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(midictx.wakefd < 0) {
+        term_print("Failed to create eventfd.");
         return(-1);
     }
 
+    if(backend->open(client_name) < 0) {
+        close(midictx.wakefd);
+        midictx.wakefd = -1;
+        return(-1);
+    }
+    midictx.backend = backend;
+
     if(sigaction(SIGHUP, &sa, &(midictx.ohup)) != 0 ||
        sigaction(SIGINT, &sa, &(midictx.oint)) != 0 ||
        sigaction(SIGTERM, &sa, &(midictx.oterm)) != 0) {
         term_print("Failed to set signal handler.");
     }
-    sa.sa_handler = _midi_usr1_handler;
-    if(sigaction(SIGUSR1, &sa, &(midictx.ousr1)) != 0) {
-        term_print("Failed to set signal handler.");
-    }
-
-    midictx.in = jack_port_register(midictx.jack,
-                                    inport_name,
-                                    JACK_DEFAULT_MIDI_TYPE,
-                                    JackPortIsInput,
-                                    0);
-    if(midictx.in == NULL) {
-        term_print("Failed to register in port.");
-        midi_cleanup();
-        return(-1);
-    }
-    midictx.this_inport_name = midi_copy_string(jack_port_name(midictx.in));
-    if(midictx.this_inport_name == NULL) {
-        midi_cleanup();
-        return(-1);
-    }
 
-    midictx.out = jack_port_register(midictx.jack,
-                                     outport_name,
-                                     JACK_DEFAULT_MIDI_TYPE,
-                                     JackPortIsOutput,
-                                     0);
-    if(midictx.out == NULL) {
-        term_print("Failed to register out port.");
-        midi_cleanup();
-        return(-1);
-    }
-    midictx.this_outport_name = midi_copy_string(jack_port_name(midictx.out));
-    if(midictx.this_outport_name == NULL) {
+    if(backend->register_ports(inport_name, outport_name, thruport_name,
+                               &(midictx.this_inport_name),
+                               &(midictx.this_outport_name)) < 0) {
         midi_cleanup();
         return(-1);
     }
 
-    midictx.thru = jack_port_register(midictx.jack,
-                                      thruport_name,
-                                      JACK_DEFAULT_MIDI_TYPE,
-                                      JackPortIsOutput,
-                                      0);
-    if(midictx.thru == NULL) {
-        term_print("Failed to register thru port.");
-        midi_cleanup();
-        return(-1);
-    }
-
-    midictx.inEv.rb = jack_ringbuffer_create(sizeof(midi_event *) * MIDI_MAX_EVENTS);
-    if(midictx.inEv.rb == NULL) {
+    if(_midi_rb_init(&(midictx.inEv)) < 0) {
         term_print("Failed to create input ringbuffer.");
         midi_cleanup();
         return(-1);
     }
 
-    midictx.outEv.rb = jack_ringbuffer_create(sizeof(midi_event *) * MIDI_MAX_EVENTS);
-    if(midictx.outEv.rb == NULL) {
+    if(_midi_rb_init(&(midictx.outEv)) < 0) {
         term_print("Failed to create output ringbuffer.");
         midi_cleanup();
         return(-1);
     }
 
-    if(jack_set_port_connect_callback(midictx.jack, _midi_port_connect_cb, NULL)) {
-        term_print("Failed to set JACK port connect callback.");
+    midictx.joined = malloc(MIDI_MAX_BUFFER_SIZE);
+    if(midictx.joined == NULL) {
+        term_print("Failed to allocate sysex buffer.");
         midi_cleanup();
         return(-1);
     }
 
-    if(jack_set_process_callback(midictx.jack, _midi_process, NULL)) {
-        term_print("Failed to set JACK process callback.");
+    midictx.sample_rate = backend->get_sample_rate();
+
+    if(_midi_log_start() < 0) {
+        term_print("Failed to start log thread.");
         midi_cleanup();
         return(-1);
     }
 
-    if(jack_activate(midictx.jack)) {
-        term_print("Failed to activate JACK client.");
+    if(backend->activate() < 0) {
         midi_cleanup();
         return(-1);
     }
@@ -626,87 +1104,20 @@ int midi_setup(const char *client_name, const char *inport_name,
     return(0);
 }
 
-char *midi_find_port(const char *pattern, unsigned long flags) {
-    const char **search;
-    char *name;
-
-    search = jack_get_ports(midictx.jack, pattern, NULL, flags);
-    if(search == NULL || search[0] == NULL) {
-        term_print("No ports found for criteria.");
-        goto error;
-    }
-
-    name = midi_copy_string(search[0]);
-    if(name == NULL) {
-        goto error;
-    }
-
-    jack_free(search);
-
-    return(name);
-
-error:
-    jack_free(search);
-    return(NULL);
+/* must be called before midi_setup(), it stays set after midi_cleanup() */
+void midi_set_event_hook(MidiEventHook hook, void *priv) {
+    midictx.event_hook = hook;
+    midictx.event_hook_priv = priv;
 }
 
-int _midi_connect(const char *src, const char *dst) {
-    jack_port_t *srcport, *dstport;
-    int err, srcflags, dstflags;
-    const char *srctype, *dsttype;
-
-    err = jack_connect(midictx.jack, src, dst);
-    if(err == 0) {
-        return(0);
-    }
-
-    term_print("jack_connect() returned error %d (%s)",
-               err, strerror(err));
-
-    if(midictx.jack == NULL) {
-        term_print("Jack client is NULL.");
-        return(err);
-    }
-    if(src == NULL) {
-        term_print("Source port name is NULL.");
-        return(err);
-    }
-    if(dst == NULL) {
-        term_print("Destination port name is NULL.");
-        return(err);
-    }
-    srcport = jack_port_by_name(midictx.jack, src);
-    if(srcport == NULL) {
-        term_print("Got NULL source port.");
-        return(err);
-    }
-    dstport = jack_port_by_name(midictx.jack, dst);
-    if(dstport == NULL) {
-        term_print("Got NULL destination port.");
-        return(err);
-    }
-    srcflags = jack_port_flags(srcport);
-    if(!(srcflags & JackPortIsOutput)) {
-        term_print("Source port isn't an output. Flags: %02X", srcflags);
-        return(err);
-    }
-    dstflags = jack_port_flags(dstport);
-    if(!(dstflags & JackPortIsInput)) {
-        term_print("Destination port isn't an input. Flags: %02X", dstflags);
-        return(err);
-    }
-    srctype = jack_port_type(srcport);
-    dsttype = jack_port_type(dstport);
-    if(strcmp(srctype, dsttype) != 0) {
-        term_print("Different source and destination port types. %s != %s",
-                   srctype, dsttype);
-        return(err);
-    }
-
-    term_print("Unknown error. %s 0x%02X %s, %s 0x%02X %s",
-               src, srcflags, srctype, dst, dstflags, dsttype);
+/* must be called before midi_setup(), it stays set after midi_cleanup() */
+void midi_set_period_hook(MidiPeriodHook hook, void *priv) {
+    midictx.period_hook = hook;
+    midictx.period_hook_priv = priv;
+}
 
-    return(err);
+char *midi_find_port(const char *pattern, unsigned long flags) {
+    return(midictx.backend->find_port(pattern, flags));
 }
 
 int midi_attach_in_port_by_name(const char *name) {
@@ -716,7 +1127,7 @@ int midi_attach_in_port_by_name(const char *name) {
     }
 
     /* source out to this in */
-    if(_midi_connect(midictx.guitar_outport_name, midictx.this_inport_name) != 0) {
+    if(midictx.backend->connect(midictx.guitar_outport_name, midictx.this_inport_name) != 0) {
         return(-1);
     }
 
@@ -730,7 +1141,7 @@ int midi_attach_out_port_by_name(const char *name) {
     }
 
     /* this out to source in */
-    if(_midi_connect(midictx.this_outport_name, midictx.guitar_inport_name) != 0) {
+    if(midictx.backend->connect(midictx.this_outport_name, midictx.guitar_inport_name) != 0) {
         return(-1);
     }
 
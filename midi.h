@@ -17,11 +17,28 @@
  * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#ifndef _MIDI_H
+#define _MIDI_H
+
+#include <stdint.h>
 #include <pthread.h>
 
-#include <jack/jack.h>
+#include "latency.h"
+#include "midi_backend.h"
+
+/* largest single chunk of a message, and the largest sysex which
+ * midi_read_event_timed() will put back together */
+#define MIDI_MAX_BUFFER_SIZE (32768)
+
+#define MIDI_PORT_IS_INPUT  (1 << 0)
+#define MIDI_PORT_IS_OUTPUT (1 << 1)
 
-#define MIDI_MAX_BUFFER_SIZE (32768) /* should be plenty, I guess */
+/* where a record read by midi_read_event_chunk() goes in its message */
+#define MIDI_EVENT_CONTINUED (1 << 0) /* not the first chunk */
+#define MIDI_EVENT_MORE      (1 << 1) /* more chunks follow */
+
+#define MIDI_WAIT_EVENT (1 << 0)
+#define MIDI_WAIT_FD    (1 << 1)
 
 #define MIDI_CMD (0)
 #define MIDI_SYSEX (0xF0)
@@ -218,21 +235,57 @@
 #define MIDI_RPN_3D_ROLL_ANGLE              MIDI_2BYTE_WORD(0x3D, 8)
 #define MIDI_RPN_NULL                       MIDI_2BYTE_WORD(0x7F, 0x7F)
 
+typedef struct {
+    size_t size;
+    size_t used;
+    size_t high_water;
+} midi_ring_stats;
+
+typedef struct {
+    /* backend frame time the event arrived at, 0 for outgoing events */
+    uint32_t frame;
+    /* CLOCK_MONOTONIC time the event was queued */
+    uint64_t ns;
+} midi_timestamp;
+
+/* called from the process callback with every complete event which isn't a
+ * sysex, as it arrives, so it can't block, allocate or print */
+typedef void (*MidiEventHook)(void *priv, const midi_timestamp *ts,
+                              const unsigned char *buffer, size_t size);
+
+/* called from the process callback at the start of every period, before its
+ * events and even if there are none, with the same limits */
+typedef void (*MidiPeriodHook)(void *priv);
+
 void print_hex(size_t size, unsigned char *buffer);
+uint64_t midi_time_ns();
 char *midi_copy_string(const char *src);
 
-int midi_setup(const char *client_name, const char *inport_name,
+extern const MidiBackend *MIDI_BACKENDS[];
+const MidiBackend *midi_find_backend(const char *name);
+int midi_setup(const MidiBackend *backend,
+               const char *client_name, const char *inport_name,
                const char *outport_name, const char *thruport_name,
-               int filter_sysex, pthread_t pid);
+               int filter_sysex);
+void midi_set_event_hook(MidiEventHook hook, void *priv);
+void midi_set_period_hook(MidiPeriodHook hook, void *priv);
 char *midi_find_port(const char *pattern, unsigned long flags);
 int midi_ready();
 void midi_cleanup();
 int midi_activated();
 int midi_read_event(size_t size, unsigned char *buffer);
+int midi_read_event_timed(size_t size, unsigned char *buffer, midi_timestamp *ts);
+int midi_read_event_chunk(size_t size, unsigned char *buffer,
+                          midi_timestamp *ts, unsigned int *flags);
+int midi_wait_event(int timeout, int fd);
 int midi_write_event(size_t size, unsigned char *buffer);
+void midi_get_ring_stats(midi_ring_stats *in, midi_ring_stats *out);
+const LatencyHist *midi_get_thru_latency();
 int midi_attach_in_port_by_name(const char *name);
 int midi_attach_out_port_by_name(const char *name);
 int midi_num_to_note(size_t size, char *buf, unsigned int note, int flat);
 const char *midi_cc_to_string(unsigned int cc);
 const char *midi_rpn_to_string(unsigned short rpn);
 int midi_parse_rpn(unsigned char channel, unsigned short rpn, unsigned short data);
+
+#endif
@@ -0,0 +1,580 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <regex.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include <alsa/asoundlib.h>
+
+#include "terminal.h"
+#include "midi.h"
+#include "midi_backend.h"
+
+/* ALSA sequencer backend.  There's no period here, a reader thread blocks
+ * waiting for events and passes each one through midi_backend_process() as
+ * it arrives, and writes to the guitar go out directly from the thread
+ * calling midi_write_event().  While idle it still goes through with no
+ * event every MIDI_ALSA_IDLE_MS so period hooks run. */
+
+#define MIDI_ALSA_IDLE_MS (10)
+
+typedef struct {
+    snd_seq_t *seq;
+    int client;
+
+    int in;
+    int out;
+    int thru;
+
+    /* the reader thread and writers both send events */
+    pthread_mutex_t outlock;
+    snd_midi_event_t *encoder;
+    snd_midi_event_t *decoder;
+
+    pthread_t thread;
+    int thread_running;
+    int stopfd;
+
+    /* the event being processed */
+    snd_seq_event_t *ev;
+    MidiBackendEvent inEvent;
+    int has_event;
+    uint32_t count;
+    unsigned char inbuf[MIDI_MAX_BUFFER_SIZE];
+} MIDI_alsa_ctx_t;
+
+static MIDI_alsa_ctx_t alsactx;
+
+static char *_midi_alsa_addr_name(int client, int port) {
+    snd_seq_client_info_t *cinfo;
+    snd_seq_port_info_t *pinfo;
+    const char *cname;
+    const char *pname;
+    char *name;
+    size_t len;
+
+    snd_seq_client_info_alloca(&cinfo);
+    snd_seq_port_info_alloca(&pinfo);
+
+    if(snd_seq_get_any_client_info(alsactx.seq, client, cinfo) < 0 ||
+       snd_seq_get_any_port_info(alsactx.seq, client, port, pinfo) < 0) {
+        return(NULL);
+    }
+    cname = snd_seq_client_info_get_name(cinfo);
+    pname = snd_seq_port_info_get_name(pinfo);
+
+    len = strlen(cname) + 1 + strlen(pname) + 1;
+    name = malloc(len);
+    if(name == NULL) {
+        return(NULL);
+    }
+    snprintf(name, len, "%s:%s", cname, pname);
+
+    return(name);
+}
+
+/* call cb for every port with at least caps, stop when it returns nonzero */
+static int _midi_alsa_foreach_port(unsigned int caps,
+                                   int (*cb)(const char *name,
+                                             const snd_seq_addr_t *addr,
+                                             void *priv),
+                                   void *priv) {
+    snd_seq_client_info_t *cinfo;
+    snd_seq_port_info_t *pinfo;
+    char *name;
+    int ret;
+
+    snd_seq_client_info_alloca(&cinfo);
+    snd_seq_port_info_alloca(&pinfo);
+
+    snd_seq_client_info_set_client(cinfo, -1);
+    while(snd_seq_query_next_client(alsactx.seq, cinfo) >= 0) {
+        snd_seq_port_info_set_client(pinfo, snd_seq_client_info_get_client(cinfo));
+        snd_seq_port_info_set_port(pinfo, -1);
+        while(snd_seq_query_next_port(alsactx.seq, pinfo) >= 0) {
+            if((snd_seq_port_info_get_capability(pinfo) & caps) != caps) {
+                continue;
+            }
+
+            name = _midi_alsa_addr_name(snd_seq_port_info_get_client(pinfo),
+                                        snd_seq_port_info_get_port(pinfo));
+            if(name == NULL) {
+                continue;
+            }
+            ret = cb(name, snd_seq_port_info_get_addr(pinfo), priv);
+            free(name);
+            if(ret) {
+                return(ret);
+            }
+        }
+    }
+
+    return(0);
+}
+
+static int _midi_alsa_output(snd_seq_event_t *ev, int port) {
+    int ret;
+
+    snd_seq_ev_set_source(ev, port);
+    snd_seq_ev_set_subs(ev);
+    snd_seq_ev_set_direct(ev);
+
+    pthread_mutex_lock(&(alsactx.outlock));
+    ret = snd_seq_event_output_direct(alsactx.seq, ev);
+    pthread_mutex_unlock(&(alsactx.outlock));
+
+    return(ret < 0 ? -1 : 0);
+}
+
+static void _midi_alsa_handle_event(snd_seq_event_t *ev) {
+    char *namea;
+    char *nameb;
+    long size;
+
+    switch(ev->type) {
+        case SND_SEQ_EVENT_PORT_SUBSCRIBED:
+        case SND_SEQ_EVENT_PORT_UNSUBSCRIBED:
+            namea = _midi_alsa_addr_name(ev->data.connect.sender.client,
+                                         ev->data.connect.sender.port);
+            nameb = _midi_alsa_addr_name(ev->data.connect.dest.client,
+                                         ev->data.connect.dest.port);
+            if(namea != NULL && nameb != NULL) {
+                midi_backend_port_connect(namea, nameb,
+                                          ev->type == SND_SEQ_EVENT_PORT_SUBSCRIBED);
+            }
+            free(namea);
+            free(nameb);
+            return;
+        default:
+            break;
+    }
+
+    if(ev->dest.port != alsactx.in) {
+        return;
+    }
+
+    size = snd_midi_event_decode(alsactx.decoder, alsactx.inbuf,
+                                 sizeof(alsactx.inbuf), ev);
+    if(size <= 0) {
+        /* not something with a MIDI byte representation */
+        return;
+    }
+
+    alsactx.ev = ev;
+    alsactx.inEvent.time = 0;
+    alsactx.inEvent.size = size;
+    alsactx.inEvent.buffer = alsactx.inbuf;
+    alsactx.has_event = 1;
+
+    midi_backend_process(0);
+
+    alsactx.has_event = 0;
+    alsactx.count++;
+}
+
+static void *_midi_alsa_thread(void *arg) {
+    struct pollfd *pfds;
+    int npfds;
+    snd_seq_event_t *ev;
+    int ret;
+
+    npfds = snd_seq_poll_descriptors_count(alsactx.seq, POLLIN);
+    pfds = malloc(sizeof(struct pollfd) * (npfds + 1));
+    if(pfds == NULL) {
+        term_print("Failed to allocate memory for poll descriptors.");
+        return(NULL);
+    }
+    snd_seq_poll_descriptors(alsactx.seq, pfds, npfds, POLLIN);
+    pfds[npfds].fd = alsactx.stopfd;
+    pfds[npfds].events = POLLIN;
+
+    for(;;) {
+        ret = poll(pfds, npfds + 1, MIDI_ALSA_IDLE_MS);
+        if(ret < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if(ret == 0) {
+            midi_backend_process(0);
+            continue;
+        }
+        if(pfds[npfds].revents & POLLIN) {
+            break;
+        }
+
+        do {
+            ret = snd_seq_event_input(alsactx.seq, &ev);
+            if(ret == -ENOSPC) {
+                term_print("ALSA input queue overran, events were lost.");
+                continue;
+            } else if(ret < 0) {
+                break;
+            }
+            _midi_alsa_handle_event(ev);
+        } while(snd_seq_event_input_pending(alsactx.seq, 0) > 0);
+    }
+
+    free(pfds);
+
+    return(NULL);
+}
+
+static int _midi_alsa_open(const char *client_name) {
+    int err;
+
+    alsactx.seq = NULL;
+    alsactx.encoder = NULL;
+    alsactx.decoder = NULL;
+    alsactx.thread_running = 0;
+    alsactx.stopfd = -1;
+    alsactx.has_event = 0;
+    alsactx.count = 0;
+
+    err = snd_seq_open(&(alsactx.seq), "default", SND_SEQ_OPEN_DUPLEX, 0);
+    if(err < 0) {
+        term_print("Failed to open ALSA sequencer: %s", snd_strerror(err));
+        return(-1);
+    }
+    /* the reader thread polls */
+    snd_seq_nonblock(alsactx.seq, 1);
+    snd_seq_set_client_name(alsactx.seq, client_name);
+    alsactx.client = snd_seq_client_id(alsactx.seq);
+
+    if(snd_midi_event_new(MIDI_MAX_BUFFER_SIZE, &(alsactx.encoder)) < 0 ||
+       snd_midi_event_new(MIDI_MAX_BUFFER_SIZE, &(alsactx.decoder)) < 0) {
+        term_print("Failed to create MIDI event parser.");
+        goto error;
+    }
+    /* the rest of the program doesn't deal with running status */
+    snd_midi_event_no_status(alsactx.decoder, 1);
+
+    if(pthread_mutex_init(&(alsactx.outlock), NULL) != 0) {
+        term_print("Failed to create mutex.");
+        goto error;
+    }
+
+    alsactx.stopfd = eventfd(0, EFD_CLOEXEC);
+    if(alsactx.stopfd < 0) {
+        term_print("Failed to create eventfd.");
+        goto error_mutex;
+    }
+
+    return(0);
+
+error_mutex:
+    pthread_mutex_destroy(&(alsactx.outlock));
+error:
+    if(alsactx.encoder != NULL) {
+        snd_midi_event_free(alsactx.encoder);
+    }
+    if(alsactx.decoder != NULL) {
+        snd_midi_event_free(alsactx.decoder);
+    }
+    snd_seq_close(alsactx.seq);
+    alsactx.seq = NULL;
+    return(-1);
+}
+
+static int _midi_alsa_register_ports(const char *inport_name,
+                                     const char *outport_name,
+                                     const char *thruport_name,
+                                     char **this_inport_name,
+                                     char **this_outport_name) {
+    alsactx.in = snd_seq_create_simple_port(alsactx.seq, inport_name,
+                                            SND_SEQ_PORT_CAP_WRITE |
+                                            SND_SEQ_PORT_CAP_SUBS_WRITE,
+                                            SND_SEQ_PORT_TYPE_MIDI_GENERIC |
+                                            SND_SEQ_PORT_TYPE_APPLICATION);
+    if(alsactx.in < 0) {
+        term_print("Failed to register in port.");
+        return(-1);
+    }
+    *this_inport_name = _midi_alsa_addr_name(alsactx.client, alsactx.in);
+    if(*this_inport_name == NULL) {
+        return(-1);
+    }
+
+    alsactx.out = snd_seq_create_simple_port(alsactx.seq, outport_name,
+                                             SND_SEQ_PORT_CAP_READ |
+                                             SND_SEQ_PORT_CAP_SUBS_READ,
+                                             SND_SEQ_PORT_TYPE_MIDI_GENERIC |
+                                             SND_SEQ_PORT_TYPE_APPLICATION);
+    if(alsactx.out < 0) {
+        term_print("Failed to register out port.");
+        return(-1);
+    }
+    *this_outport_name = _midi_alsa_addr_name(alsactx.client, alsactx.out);
+    if(*this_outport_name == NULL) {
+        return(-1);
+    }
+
+    alsactx.thru = snd_seq_create_simple_port(alsactx.seq, thruport_name,
+                                              SND_SEQ_PORT_CAP_READ |
+                                              SND_SEQ_PORT_CAP_SUBS_READ,
+                                              SND_SEQ_PORT_TYPE_MIDI_GENERIC |
+                                              SND_SEQ_PORT_TYPE_APPLICATION);
+    if(alsactx.thru < 0) {
+        term_print("Failed to register thru port.");
+        return(-1);
+    }
+
+    /* subscription changes are announced to the system port, which is how
+     * connections get noticed, including ones made by hand */
+    if(snd_seq_connect_from(alsactx.seq, alsactx.in,
+                            SND_SEQ_CLIENT_SYSTEM,
+                            SND_SEQ_PORT_SYSTEM_ANNOUNCE) < 0) {
+        term_print("Failed to subscribe to ALSA announcements.");
+        return(-1);
+    }
+
+    return(0);
+}
+
+static int _midi_alsa_activate() {
+    sigset_t set, oset;
+    int err;
+
+    /* keep signals going to the main thread */
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &oset);
+    err = pthread_create(&(alsactx.thread), NULL, _midi_alsa_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &oset, NULL);
+    if(err != 0) {
+        term_print("Failed to start ALSA reader thread.");
+        return(-1);
+    }
+    alsactx.thread_running = 1;
+
+    return(0);
+}
+
+static int _midi_alsa_deactivate() {
+    uint64_t val = 1;
+
+    if(alsactx.thread_running) {
+        if(write(alsactx.stopfd, &val, sizeof(val)) < 0) {
+            term_print("Failed to stop ALSA reader thread.");
+            return(-1);
+        }
+        pthread_join(alsactx.thread, NULL);
+        alsactx.thread_running = 0;
+    }
+
+    return(0);
+}
+
+static void _midi_alsa_close() {
+    if(alsactx.seq == NULL) {
+        return;
+    }
+
+    close(alsactx.stopfd);
+    alsactx.stopfd = -1;
+    pthread_mutex_destroy(&(alsactx.outlock));
+    snd_midi_event_free(alsactx.encoder);
+    snd_midi_event_free(alsactx.decoder);
+    snd_seq_close(alsactx.seq);
+    alsactx.seq = NULL;
+}
+
+static uint32_t _midi_alsa_get_sample_rate() {
+    /* no periods */
+    return(0);
+}
+
+static uint32_t _midi_alsa_cycle_begin(uint32_t nframes) {
+    /* nothing to count time in, so count events instead */
+    return(alsactx.count);
+}
+
+static int _midi_alsa_get_in_event(uint32_t i, MidiBackendEvent *ev) {
+    if(i > 0 || !alsactx.has_event) {
+        return(-1);
+    }
+
+    *ev = alsactx.inEvent;
+
+    return(0);
+}
+
+static int _midi_alsa_write_out(uint32_t time, const unsigned char *buffer, size_t size) {
+    /* everything goes out through write_direct */
+    return(-1);
+}
+
+static int _midi_alsa_write_thru(uint32_t time, const unsigned char *buffer, size_t size) {
+    snd_seq_event_t ev = *(alsactx.ev);
+
+    /* pass the event along as it arrived rather than encoding it again */
+    return(_midi_alsa_output(&ev, alsactx.thru));
+}
+
+static int _midi_alsa_write_direct(const unsigned char *buffer, size_t size) {
+    snd_seq_event_t ev;
+    long used;
+
+    snd_midi_event_reset_encode(alsactx.encoder);
+    while(size > 0) {
+        snd_seq_ev_clear(&ev);
+        used = snd_midi_event_encode(alsactx.encoder, buffer, size, &ev);
+        if(used <= 0) {
+            term_print("Failed to encode MIDI event.");
+            return(-1);
+        }
+        buffer += used;
+        size -= used;
+
+        if(ev.type == SND_SEQ_EVENT_NONE) {
+            /* needs more bytes */
+            continue;
+        }
+
+        if(_midi_alsa_output(&ev, alsactx.out) < 0) {
+            term_print("Failed to send MIDI event.");
+            return(-1);
+        }
+    }
+
+    return(0);
+}
+
+typedef struct {
+    const char *name;
+    snd_seq_addr_t addr;
+    int found;
+} MidiAlsaLookup;
+
+static int _midi_alsa_lookup_cb(const char *name, const snd_seq_addr_t *addr, void *priv) {
+    MidiAlsaLookup *lookup = (MidiAlsaLookup *)priv;
+
+    if(strcmp(name, lookup->name) == 0) {
+        lookup->addr = *addr;
+        lookup->found = 1;
+        return(1);
+    }
+
+    return(0);
+}
+
+static int _midi_alsa_connect(const char *src, const char *dst) {
+    snd_seq_port_subscribe_t *sub;
+    MidiAlsaLookup srclookup = { .name = src, .found = 0 };
+    MidiAlsaLookup dstlookup = { .name = dst, .found = 0 };
+    int err;
+
+    _midi_alsa_foreach_port(SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+                            _midi_alsa_lookup_cb, &srclookup);
+    if(!srclookup.found) {
+        term_print("Source port %s not found.", src);
+        return(-1);
+    }
+    _midi_alsa_foreach_port(SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+                            _midi_alsa_lookup_cb, &dstlookup);
+    if(!dstlookup.found) {
+        term_print("Destination port %s not found.", dst);
+        return(-1);
+    }
+
+    snd_seq_port_subscribe_alloca(&sub);
+    snd_seq_port_subscribe_set_sender(sub, &(srclookup.addr));
+    snd_seq_port_subscribe_set_dest(sub, &(dstlookup.addr));
+    err = snd_seq_subscribe_port(alsactx.seq, sub);
+    if(err < 0) {
+        term_print("Failed to connect %s to %s: %s", src, dst, snd_strerror(err));
+        return(-1);
+    }
+
+    return(0);
+}
+
+typedef struct {
+    regex_t re;
+    char *name;
+} MidiAlsaFind;
+
+static int _midi_alsa_find_cb(const char *name, const snd_seq_addr_t *addr, void *priv) {
+    MidiAlsaFind *find = (MidiAlsaFind *)priv;
+
+    if(addr->client == alsactx.client) {
+        return(0);
+    }
+
+    if(regexec(&(find->re), name, 0, NULL, 0) == 0) {
+        find->name = midi_copy_string(name);
+        return(1);
+    }
+
+    return(0);
+}
+
+static char *_midi_alsa_find_port(const char *pattern, unsigned long flags) {
+    MidiAlsaFind find;
+    unsigned int caps = 0;
+
+    /* the names are from the perspective of the other port, so an input
+     * port is one this client can write to */
+    if(flags & MIDI_PORT_IS_INPUT) {
+        caps |= SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE;
+    }
+    if(flags & MIDI_PORT_IS_OUTPUT) {
+        caps |= SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ;
+    }
+
+    if(regcomp(&(find.re), pattern, REG_EXTENDED | REG_NOSUB) != 0) {
+        term_print("Invalid port pattern %s.", pattern);
+        return(NULL);
+    }
+    find.name = NULL;
+
+    _midi_alsa_foreach_port(caps, _midi_alsa_find_cb, &find);
+    regfree(&(find.re));
+
+    if(find.name == NULL) {
+        term_print("No ports found for criteria.");
+    }
+
+    return(find.name);
+}
+
+const MidiBackend midi_backend_alsa = {
+    .name = "alsa",
+    .open = _midi_alsa_open,
+    .register_ports = _midi_alsa_register_ports,
+    .activate = _midi_alsa_activate,
+    .deactivate = _midi_alsa_deactivate,
+    .close = _midi_alsa_close,
+    .get_sample_rate = _midi_alsa_get_sample_rate,
+    .cycle_begin = _midi_alsa_cycle_begin,
+    .get_in_event = _midi_alsa_get_in_event,
+    .write_out = _midi_alsa_write_out,
+    .write_thru = _midi_alsa_write_thru,
+    .write_direct = _midi_alsa_write_direct,
+    .connect = _midi_alsa_connect,
+    .find_port = _midi_alsa_find_port
+};
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MIDI_BACKEND_H
+#define _MIDI_BACKEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* interface between the backend independent parts in midi.c and whatever is
+ * actually moving MIDI data around.  Only one backend is in use at a time so
+ * backends keep their state in their own globals. */
+
+typedef struct {
+    /* offset in frames from the start of the period */
+    uint32_t time;
+    size_t size;
+    unsigned char *buffer;
+} MidiBackendEvent;
+
+typedef struct {
+    const char *name;
+
+    /* connect to whatever server or device, return 0 on success */
+    int (*open)(const char *client_name);
+    /* register ports, the full names of this client's in and out ports are
+     * returned in allocated strings */
+    int (*register_ports)(const char *inport_name, const char *outport_name,
+                          const char *thruport_name,
+                          char **this_inport_name, char **this_outport_name);
+    /* start calling midi_backend_process() every period, or for every
+     * event for backends without periods */
+    int (*activate)();
+    int (*deactivate)();
+    void (*close)();
+    /* 0 for backends without periods */
+    uint32_t (*get_sample_rate)();
+
+    /* these are only called from within midi_backend_process() */
+    /* prepare the port buffers for this period and return the frame time
+     * of its start */
+    uint32_t (*cycle_begin)(uint32_t nframes);
+    /* return nonzero when there's no event i */
+    int (*get_in_event)(uint32_t i, MidiBackendEvent *ev);
+    int (*write_out)(uint32_t time, const unsigned char *buffer, size_t size);
+    int (*write_thru)(uint32_t time, const unsigned char *buffer, size_t size);
+
+    /* if not NULL, midi_write_event() sends through this immediately from
+     * the calling thread instead of queuing for the next period */
+    int (*write_direct)(const unsigned char *buffer, size_t size);
+
+    int (*connect)(const char *src, const char *dst);
+    char *(*find_port)(const char *pattern, unsigned long flags);
+} MidiBackend;
+
+extern const MidiBackend midi_backend_jack;
+extern const MidiBackend midi_backend_alsa;
+extern const MidiBackend midi_backend_loopback;
+
+/* called by backends */
+int midi_backend_process(uint32_t nframes);
+void midi_backend_port_connect(const char *namea, const char *nameb, int connect);
+
+#endif
@@ -0,0 +1,316 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <jack/jack.h>
+#include <jack/midiport.h>
+
+#include "terminal.h"
+#include "midi.h"
+#include "midi_backend.h"
+
+typedef struct {
+    jack_client_t *jack;
+
+    jack_port_t *in;
+    jack_port_t *out;
+    jack_port_t *thru;
+
+    /* buffers for the current period */
+    void *inbuf;
+    void *outbuf;
+    void *thrubuf;
+} MIDI_jack_ctx_t;
+
+static MIDI_jack_ctx_t jackctx;
+
+void _midi_jack_print_ports() {
+    const char **search;
+    unsigned int i;
+    jack_port_t *port;
+
+    search = jack_get_ports(jackctx.jack, NULL, NULL, 0);
+    for(i = 0; search[i] != NULL; i++) {
+        port = jack_port_by_name(jackctx.jack, search[i]);
+        term_print("%s %02X %s", search[i], jack_port_flags(port), jack_port_type(port));
+    }
+    jack_free(search);
+}
+
+static int _midi_jack_process(jack_nframes_t nframes, void *arg) {
+    return(midi_backend_process(nframes));
+}
+
+static void _midi_jack_port_connect_cb(jack_port_id_t a, jack_port_id_t b,
+                                       int connect, void *arg) {
+    midi_backend_port_connect(jack_port_name(jack_port_by_id(jackctx.jack, a)),
+                              jack_port_name(jack_port_by_id(jackctx.jack, b)),
+                              connect);
+}
+
+static int _midi_jack_open(const char *client_name) {
+    jack_status_t jstatus;
+
+    jackctx.in = NULL;
+    jackctx.out = NULL;
+    jackctx.thru = NULL;
+
+    jackctx.jack = jack_client_open(client_name, JackNoStartServer, &jstatus);
+    if(jackctx.jack == NULL) {
+        term_print("Failed to open JACK connection.");
+        return(-1);
+    }
+
+    return(0);
+}
+
+static int _midi_jack_register_ports(const char *inport_name,
+                                     const char *outport_name,
+                                     const char *thruport_name,
+                                     char **this_inport_name,
+                                     char **this_outport_name) {
+    jackctx.in = jack_port_register(jackctx.jack,
+                                    inport_name,
+                                    JACK_DEFAULT_MIDI_TYPE,
+                                    JackPortIsInput,
+                                    0);
+    if(jackctx.in == NULL) {
+        term_print("Failed to register in port.");
+        return(-1);
+    }
+    *this_inport_name = midi_copy_string(jack_port_name(jackctx.in));
+    if(*this_inport_name == NULL) {
+        return(-1);
+    }
+
+    jackctx.out = jack_port_register(jackctx.jack,
+                                     outport_name,
+                                     JACK_DEFAULT_MIDI_TYPE,
+                                     JackPortIsOutput,
+                                     0);
+    if(jackctx.out == NULL) {
+        term_print("Failed to register out port.");
+        return(-1);
+    }
+    *this_outport_name = midi_copy_string(jack_port_name(jackctx.out));
+    if(*this_outport_name == NULL) {
+        return(-1);
+    }
+
+    jackctx.thru = jack_port_register(jackctx.jack,
+                                      thruport_name,
+                                      JACK_DEFAULT_MIDI_TYPE,
+                                      JackPortIsOutput,
+                                      0);
+    if(jackctx.thru == NULL) {
+        term_print("Failed to register thru port.");
+        return(-1);
+    }
+
+    return(0);
+}
+
+static int _midi_jack_activate() {
+    if(jack_set_port_connect_callback(jackctx.jack, _midi_jack_port_connect_cb, NULL)) {
+        term_print("Failed to set JACK port connect callback.");
+        return(-1);
+    }
+
+    if(jack_set_process_callback(jackctx.jack, _midi_jack_process, NULL)) {
+        term_print("Failed to set JACK process callback.");
+        return(-1);
+    }
+
+    if(jack_activate(jackctx.jack)) {
+        term_print("Failed to activate JACK client.");
+        return(-1);
+    }
+
+    return(0);
+}
+
+static int _midi_jack_deactivate() {
+    if(jack_deactivate(jackctx.jack)) {
+        term_print("Failed to deactivate JACK client.");
+        return(-1);
+    }
+
+    term_print("JACK client deactivated.");
+
+    return(0);
+}
+
+static void _midi_jack_close() {
+    if(jackctx.jack == NULL) {
+        return;
+    }
+
+    if(jack_client_close(jackctx.jack)) {
+        term_print("Error closing JACK connection.");
+    } else {
+        term_print("JACK connection closed.");
+    }
+
+    jackctx.jack = NULL;
+}
+
+static uint32_t _midi_jack_get_sample_rate() {
+    return(jack_get_sample_rate(jackctx.jack));
+}
+
+static uint32_t _midi_jack_cycle_begin(uint32_t nframes) {
+    jackctx.inbuf = jack_port_get_buffer(jackctx.in, nframes);
+    jackctx.outbuf = jack_port_get_buffer(jackctx.out, nframes);
+    jack_midi_clear_buffer(jackctx.outbuf);
+    jackctx.thrubuf = jack_port_get_buffer(jackctx.thru, nframes);
+    jack_midi_clear_buffer(jackctx.thrubuf);
+
+    return(jack_last_frame_time(jackctx.jack));
+}
+
+static int _midi_jack_get_in_event(uint32_t i, MidiBackendEvent *ev) {
+    jack_midi_event_t jackEvent;
+
+    if(jack_midi_event_get(&jackEvent, jackctx.inbuf, i)) {
+        return(-1);
+    }
+
+    ev->time = jackEvent.time;
+    ev->size = jackEvent.size;
+    ev->buffer = jackEvent.buffer;
+
+    return(0);
+}
+
+static int _midi_jack_write_out(uint32_t time, const unsigned char *buffer, size_t size) {
+    return(jack_midi_event_write(jackctx.outbuf, time, buffer, size));
+}
+
+static int _midi_jack_write_thru(uint32_t time, const unsigned char *buffer, size_t size) {
+    return(jack_midi_event_write(jackctx.thrubuf, time, buffer, size));
+}
+
+static int _midi_jack_connect(const char *src, const char *dst) {
+    jack_port_t *srcport, *dstport;
+    int err, srcflags, dstflags;
+    const char *srctype, *dsttype;
+
+    err = jack_connect(jackctx.jack, src, dst);
+    if(err == 0) {
+        return(0);
+    }
+
+    term_print("jack_connect() returned error %d (%s)",
+               err, strerror(err));
+
+    if(jackctx.jack == NULL) {
+        term_print("Jack client is NULL.");
+        return(err);
+    }
+    if(src == NULL) {
+        term_print("Source port name is NULL.");
+        return(err);
+    }
+    if(dst == NULL) {
+        term_print("Destination port name is NULL.");
+        return(err);
+    }
+    srcport = jack_port_by_name(jackctx.jack, src);
+    if(srcport == NULL) {
+        term_print("Got NULL source port.");
+        return(err);
+    }
+    dstport = jack_port_by_name(jackctx.jack, dst);
+    if(dstport == NULL) {
+        term_print("Got NULL destination port.");
+        return(err);
+    }
+    srcflags = jack_port_flags(srcport);
+    if(!(srcflags & JackPortIsOutput)) {
+        term_print("Source port isn't an output. Flags: %02X", srcflags);
+        return(err);
+    }
+    dstflags = jack_port_flags(dstport);
+    if(!(dstflags & JackPortIsInput)) {
+        term_print("Destination port isn't an input. Flags: %02X", dstflags);
+        return(err);
+    }
+    srctype = jack_port_type(srcport);
+    dsttype = jack_port_type(dstport);
+    if(strcmp(srctype, dsttype) != 0) {
+        term_print("Different source and destination port types. %s != %s",
+                   srctype, dsttype);
+        return(err);
+    }
+
+    term_print("Unknown error. %s 0x%02X %s, %s 0x%02X %s",
+               src, srcflags, srctype, dst, dstflags, dsttype);
+
+    return(err);
+}
+
+static char *_midi_jack_find_port(const char *pattern, unsigned long flags) {
+    const char **search;
+    unsigned long jackflags = 0;
+    char *name;
+
+    if(flags & MIDI_PORT_IS_INPUT) {
+        jackflags |= JackPortIsInput;
+    }
+    if(flags & MIDI_PORT_IS_OUTPUT) {
+        jackflags |= JackPortIsOutput;
+    }
+
+    search = jack_get_ports(jackctx.jack, pattern, NULL, jackflags);
+    if(search == NULL || search[0] == NULL) {
+        term_print("No ports found for criteria.");
+        goto error;
+    }
+
+    name = midi_copy_string(search[0]);
+    if(name == NULL) {
+        goto error;
+    }
+
+    jack_free(search);
+
+    return(name);
+
+error:
+    jack_free(search);
+    return(NULL);
+}
+
+const MidiBackend midi_backend_jack = {
+    .name = "jack",
+    .open = _midi_jack_open,
+    .register_ports = _midi_jack_register_ports,
+    .activate = _midi_jack_activate,
+    .deactivate = _midi_jack_deactivate,
+    .close = _midi_jack_close,
+    .get_sample_rate = _midi_jack_get_sample_rate,
+    .cycle_begin = _midi_jack_cycle_begin,
+    .get_in_event = _midi_jack_get_in_event,
+    .write_out = _midi_jack_write_out,
+    .write_thru = _midi_jack_write_thru,
+    .connect = _midi_jack_connect,
+    .find_port = _midi_jack_find_port
+};
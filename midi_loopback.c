@@ -0,0 +1,346 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <regex.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "terminal.h"
+#include "midi.h"
+#include "midi_backend.h"
+#include "midi_loopback.h"
+
+typedef struct {
+    uint32_t sample_rate;
+    uint32_t nframes;
+    int realtime;
+    uint32_t frame;
+
+    const char *client_name;
+
+    MidiLoopbackPeer peer;
+    int has_peer;
+
+    char *this_inport_name;
+    char *this_outport_name;
+
+    /* events to be delivered in the coming period */
+    MidiBackendEvent in[MIDI_LOOPBACK_MAX_EVENTS];
+    unsigned int in_count;
+    unsigned char in_buffer[MIDI_LOOPBACK_BUFFER_SIZE];
+    size_t in_used;
+
+    pthread_t thread;
+    int thread_running;
+    atomic_int stop;
+
+    MidiLoopbackStats stats;
+} MIDI_loopback_ctx_t;
+
+static MIDI_loopback_ctx_t loopctx = {
+    .sample_rate = 48000,
+    .nframes = 256,
+    .realtime = 1
+};
+
+void midi_loopback_configure(uint32_t sample_rate, uint32_t nframes, int realtime) {
+    loopctx.sample_rate = sample_rate;
+    loopctx.nframes = nframes;
+    loopctx.realtime = realtime;
+}
+
+void midi_loopback_set_peer(const MidiLoopbackPeer *peer) {
+    if(peer == NULL) {
+        loopctx.has_peer = 0;
+    } else {
+        loopctx.peer = *peer;
+        loopctx.has_peer = 1;
+    }
+}
+
+int midi_loopback_inject(uint32_t time, const unsigned char *buffer, size_t size) {
+    MidiBackendEvent *ev;
+
+    if(loopctx.in_count == MIDI_LOOPBACK_MAX_EVENTS ||
+       loopctx.in_used + size > sizeof(loopctx.in_buffer)) {
+        loopctx.stats.dropped++;
+        return(-1);
+    }
+
+    /* events have to be in order within a period */
+    if(time >= loopctx.nframes) {
+        time = loopctx.nframes - 1;
+    }
+    if(loopctx.in_count > 0 && time < loopctx.in[loopctx.in_count-1].time) {
+        time = loopctx.in[loopctx.in_count-1].time;
+    }
+
+    ev = &(loopctx.in[loopctx.in_count]);
+    ev->time = time;
+    ev->size = size;
+    ev->buffer = &(loopctx.in_buffer[loopctx.in_used]);
+    memcpy(ev->buffer, buffer, size);
+
+    loopctx.in_count++;
+    loopctx.in_used += size;
+
+    return(0);
+}
+
+int midi_loopback_inject_room(size_t size) {
+    return(loopctx.in_count < MIDI_LOOPBACK_MAX_EVENTS &&
+           loopctx.in_used + size <= sizeof(loopctx.in_buffer));
+}
+
+int midi_loopback_step() {
+    int ret;
+
+    if(loopctx.has_peer && loopctx.peer.cycle != NULL) {
+        loopctx.peer.cycle(loopctx.peer.priv, loopctx.frame, loopctx.nframes);
+    }
+
+    ret = midi_backend_process(loopctx.nframes);
+
+    loopctx.stats.in_events += loopctx.in_count;
+    loopctx.in_count = 0;
+    loopctx.in_used = 0;
+    loopctx.frame += loopctx.nframes;
+    loopctx.stats.cycles++;
+
+    return(ret);
+}
+
+uint32_t midi_loopback_get_frame() {
+    return(loopctx.frame);
+}
+
+uint32_t midi_loopback_get_sample_rate() {
+    return(loopctx.sample_rate);
+}
+
+void midi_loopback_get_stats(MidiLoopbackStats *stats) {
+    *stats = loopctx.stats;
+}
+
+static void *_midi_loopback_thread(void *arg) {
+    struct timespec next;
+    uint64_t period_ns = (uint64_t)loopctx.nframes * 1000000000 / loopctx.sample_rate;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while(!atomic_load(&(loopctx.stop))) {
+        if(midi_loopback_step() != 0) {
+            /* a real server would kick the client out */
+            break;
+        }
+
+        next.tv_nsec += period_ns;
+        while(next.tv_nsec >= 1000000000) {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    return(NULL);
+}
+
+static int _midi_loopback_open(const char *client_name) {
+    loopctx.client_name = client_name;
+    loopctx.frame = 0;
+    loopctx.in_count = 0;
+    loopctx.in_used = 0;
+    loopctx.thread_running = 0;
+    loopctx.this_inport_name = NULL;
+    loopctx.this_outport_name = NULL;
+    memset(&(loopctx.stats), 0, sizeof(loopctx.stats));
+
+    return(0);
+}
+
+static char *_midi_loopback_port_name(const char *port_name) {
+    char *name;
+    size_t len = strlen(loopctx.client_name) + 1 + strlen(port_name) + 1;
+
+    name = malloc(len);
+    if(name == NULL) {
+        return(NULL);
+    }
+    snprintf(name, len, "%s:%s", loopctx.client_name, port_name);
+
+    return(name);
+}
+
+static int _midi_loopback_register_ports(const char *inport_name,
+                                         const char *outport_name,
+                                         const char *thruport_name,
+                                         char **this_inport_name,
+                                         char **this_outport_name) {
+    *this_inport_name = _midi_loopback_port_name(inport_name);
+    if(*this_inport_name == NULL) {
+        return(-1);
+    }
+    *this_outport_name = _midi_loopback_port_name(outport_name);
+    if(*this_outport_name == NULL) {
+        return(-1);
+    }
+
+    /* keep them around to recognize connections */
+    loopctx.this_inport_name = *this_inport_name;
+    loopctx.this_outport_name = *this_outport_name;
+
+    return(0);
+}
+
+static int _midi_loopback_activate() {
+    sigset_t set, oset;
+    int err;
+
+    if(!loopctx.realtime) {
+        /* stepped by hand */
+        return(0);
+    }
+
+    atomic_init(&(loopctx.stop), 0);
+
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &oset);
+    err = pthread_create(&(loopctx.thread), NULL, _midi_loopback_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &oset, NULL);
+    if(err != 0) {
+        term_print("Failed to start loopback clock thread.");
+        return(-1);
+    }
+    loopctx.thread_running = 1;
+
+    return(0);
+}
+
+static int _midi_loopback_deactivate() {
+    if(loopctx.thread_running) {
+        atomic_store(&(loopctx.stop), 1);
+        pthread_join(loopctx.thread, NULL);
+        loopctx.thread_running = 0;
+    }
+
+    return(0);
+}
+
+static void _midi_loopback_close() {
+    /* port names are owned by midi.c */
+    loopctx.this_inport_name = NULL;
+    loopctx.this_outport_name = NULL;
+}
+
+static uint32_t _midi_loopback_get_sample_rate() {
+    return(loopctx.sample_rate);
+}
+
+static uint32_t _midi_loopback_cycle_begin(uint32_t nframes) {
+    return(loopctx.frame);
+}
+
+static int _midi_loopback_get_in_event(uint32_t i, MidiBackendEvent *ev) {
+    if(i >= loopctx.in_count) {
+        return(-1);
+    }
+
+    *ev = loopctx.in[i];
+
+    return(0);
+}
+
+static int _midi_loopback_write_out(uint32_t time, const unsigned char *buffer, size_t size) {
+    loopctx.stats.out_events++;
+    loopctx.stats.out_bytes += size;
+
+    if(loopctx.has_peer && loopctx.peer.receive != NULL) {
+        loopctx.peer.receive(loopctx.peer.priv, loopctx.frame + time, buffer, size);
+    }
+
+    return(0);
+}
+
+static int _midi_loopback_write_thru(uint32_t time, const unsigned char *buffer, size_t size) {
+    loopctx.stats.thru_events++;
+
+    if(loopctx.has_peer && loopctx.peer.thru != NULL) {
+        loopctx.peer.thru(loopctx.peer.priv, loopctx.frame + time, buffer, size);
+    }
+
+    return(0);
+}
+
+static int _midi_loopback_connect(const char *src, const char *dst) {
+    /* the only valid connections are between the guitar and this client */
+    if((strcmp(src, MIDI_LOOPBACK_PORT_NAME) == 0 &&
+        loopctx.this_inport_name != NULL &&
+        strcmp(dst, loopctx.this_inport_name) == 0) ||
+       (strcmp(dst, MIDI_LOOPBACK_PORT_NAME) == 0 &&
+        loopctx.this_outport_name != NULL &&
+        strcmp(src, loopctx.this_outport_name) == 0)) {
+        midi_backend_port_connect(src, dst, 1);
+        return(0);
+    }
+
+    term_print("Loopback can't connect %s to %s.", src, dst);
+
+    return(-1);
+}
+
+static char *_midi_loopback_find_port(const char *pattern, unsigned long flags) {
+    regex_t re;
+    int match;
+
+    if(regcomp(&re, pattern, REG_EXTENDED | REG_NOSUB) != 0) {
+        term_print("Invalid port pattern %s.", pattern);
+        return(NULL);
+    }
+    match = regexec(&re, MIDI_LOOPBACK_PORT_NAME, 0, NULL, 0);
+    regfree(&re);
+
+    /* the guitar's one port name works as both an input and an output */
+    if(match != 0) {
+        term_print("No ports found for criteria.");
+        return(NULL);
+    }
+
+    return(midi_copy_string(MIDI_LOOPBACK_PORT_NAME));
+}
+
+const MidiBackend midi_backend_loopback = {
+    .name = "loopback",
+    .open = _midi_loopback_open,
+    .register_ports = _midi_loopback_register_ports,
+    .activate = _midi_loopback_activate,
+    .deactivate = _midi_loopback_deactivate,
+    .close = _midi_loopback_close,
+    .get_sample_rate = _midi_loopback_get_sample_rate,
+    .cycle_begin = _midi_loopback_cycle_begin,
+    .get_in_event = _midi_loopback_get_in_event,
+    .write_out = _midi_loopback_write_out,
+    .write_thru = _midi_loopback_write_thru,
+    .connect = _midi_loopback_connect,
+    .find_port = _midi_loopback_find_port
+};
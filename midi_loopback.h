@@ -0,0 +1,75 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MIDI_LOOPBACK_H
+#define _MIDI_LOOPBACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* in-process backend which stands in for a server and a guitar.  A clock
+ * either runs in its own thread at the configured rate or is stepped
+ * manually, and whatever is attached as the peer plays the part of the
+ * guitar. */
+
+#define MIDI_LOOPBACK_PORT_NAME "loopback:Jamstik MIDI IN"
+
+#define MIDI_LOOPBACK_MAX_EVENTS (1024)
+#define MIDI_LOOPBACK_BUFFER_SIZE (65536)
+
+typedef struct {
+    /* called at the start of every period, before it's processed, events
+     * may be injected with midi_loopback_inject() from here */
+    void (*cycle)(void *priv, uint32_t frame, uint32_t nframes);
+    /* data sent out to the guitar, long sysex messages may be split
+     * across more than one call */
+    void (*receive)(void *priv, uint32_t frame,
+                    const unsigned char *buffer, size_t size);
+    /* data sent out the thru port, may be NULL */
+    void (*thru)(void *priv, uint32_t frame,
+                 const unsigned char *buffer, size_t size);
+    void *priv;
+} MidiLoopbackPeer;
+
+typedef struct {
+    uint64_t cycles;
+    uint64_t in_events;
+    uint64_t out_events;
+    uint64_t out_bytes;
+    uint64_t thru_events;
+    uint64_t dropped;
+} MidiLoopbackStats;
+
+/* these must be called before midi_setup() */
+void midi_loopback_configure(uint32_t sample_rate, uint32_t nframes, int realtime);
+void midi_loopback_set_peer(const MidiLoopbackPeer *peer);
+
+/* queue an event to arrive from the guitar time frames in to the current
+ * period, only to be called from the peer's cycle callback or between
+ * steps */
+int midi_loopback_inject(uint32_t time, const unsigned char *buffer, size_t size);
+/* nonzero if an event of size would fit in this period */
+int midi_loopback_inject_room(size_t size);
+/* run one period, only when not running in realtime */
+int midi_loopback_step();
+uint32_t midi_loopback_get_frame();
+uint32_t midi_loopback_get_sample_rate();
+void midi_loopback_get_stats(MidiLoopbackStats *stats);
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MIDI_RING_H
+#define _MIDI_RING_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "midi.h"
+
+/* the event rings between the backend's process callback and everything
+ * else, only midi.c uses these, they're here so they can be benchmarked on
+ * their own */
+
+/* must be a power of 2 and big enough to hold at least 2 maximum size
+ * chunks plus the padding needed to skip to the start of the buffer */
+#define MIDI_RING_SIZE (131072)
+#define MIDI_RING_ALIGN (sizeof(size_t))
+#define MIDI_RING_PAD ((size_t)-1)
+
+/* header of a record in the ring, the data follows immediately after */
+typedef struct midi_event {
+    size_t size;
+    unsigned int flags;
+    midi_timestamp ts;
+    unsigned char buffer[];
+} midi_event;
+
+#define MIDI_RECORD_SIZE(SIZE) \
+    ((sizeof(midi_event) + (SIZE) + MIDI_RING_ALIGN - 1) & ~(MIDI_RING_ALIGN - 1))
+
+/* single producer, single consumer ring of variable length records.  Records
+ * never wrap around the end of the buffer, if one wouldn't fit, a pad record
+ * is placed to indicate to the reader to skip back to the start.  The
+ * positions only ever count up and are masked when accessing the buffer. */
+typedef struct {
+    unsigned char *buf;
+    atomic_size_t readpos;
+    atomic_size_t writepos;
+    size_t high_water;
+
+    /* record being written to but not yet visible to the reader */
+    midi_event *pending;
+    size_t pending_pad;
+
+    /* in the middle of a sysex arriving in chunks, and whether the rest of
+     * it is being thrown away */
+    int sysex;
+    int sysex_dropped;
+
+    /* reader's progress through a partially sent record */
+    size_t sent;
+} EventRB;
+
+int _midi_rb_init(EventRB *e);
+void _midi_rb_free(EventRB *e);
+midi_event *_midi_rb_reserve(EventRB *e, size_t size);
+void _midi_rb_commit(EventRB *e);
+midi_event *_midi_get_event(EventRB *e);
+int _midi_consume_event(EventRB *e);
+int _midi_add_event(EventRB *e, size_t size, unsigned char *buf,
+                    const midi_timestamp *ts);
+void _midi_get_ring_stats(EventRB *e, midi_ring_stats *stats);
+
+#endif
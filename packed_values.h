@@ -17,19 +17,105 @@
  * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#ifndef _PACKED_VALUES_H
+#define _PACKED_VALUES_H
+
 #include <stdint.h>
 
-uint8_t decode_packed_uint8(const unsigned char *buf);
-uint16_t decode_packed_uint16(const unsigned char *buf);
-int16_t decode_packed_int16(const unsigned char *buf);
-uint32_t decode_packed_uint32(const unsigned char *buf);
-int32_t decode_packed_int32(const unsigned char *buf);
-uint64_t decode_packed_uint64(const unsigned char *buf);
-int64_t decode_packed_int64(const unsigned char *buf);
-void encode_packed_uint8(uint8_t val, const unsigned char *buf);
-void encode_packed_uint16(uint16_t val, const unsigned char *buf);
-void encode_packed_int16(int16_t val, const unsigned char *buf);
-void encode_packed_uint32(uint32_t val, const unsigned char *buf);
-void encode_packed_int32(int32_t val, const unsigned char *buf);
-void encode_packed_uint64(uint64_t val, const unsigned char *buf);
-void encode_packed_int64(int64_t val, const unsigned char *buf);
+/* values are sent most significant bit first, 7 bits to a byte since the top
+ * bit of each byte can't be set in a SysEx message, and whatever's left over
+ * goes at the top of the last byte.  All the widths are the same code with a
+ * different bit count, which folds away when it's a constant. */
+#define PACKED_SIZE(BITS) (((BITS) + 6) / 7)
+#define PACKED_MAX_SIZE PACKED_SIZE(64)
+
+static inline uint64_t decode_packed(const unsigned char *buf, unsigned int bits) {
+    unsigned int bytes = PACKED_SIZE(bits);
+    unsigned int last = bits - ((bytes - 1) * 7);
+    uint64_t val;
+    unsigned int i;
+
+    /* every byte shifted in to place on its own rather than shifting the
+     * whole value along, so they don't wait on each other */
+    val = (uint64_t)(buf[bytes - 1] & 0x7F) >> (7 - last);
+#pragma GCC unroll 10
+    for(i = 0; i < bytes - 1; i++) {
+        val |= (uint64_t)(buf[i] & 0x7F) << (bits - ((i + 1) * 7));
+    }
+
+    return(val);
+}
+
+static inline void encode_packed(uint64_t val, unsigned char *buf, unsigned int bits) {
+    unsigned int bytes = PACKED_SIZE(bits);
+    unsigned int last = bits - ((bytes - 1) * 7);
+    unsigned int i;
+
+#pragma GCC unroll 10
+    for(i = 0; i < bytes - 1; i++) {
+        buf[i] = (val >> (bits - ((i + 1) * 7))) & 0x7F;
+    }
+    buf[bytes - 1] = (val << (7 - last)) & 0x7F;
+}
+
+static inline int64_t packed_sign_extend(uint64_t val, unsigned int bits) {
+    return((int64_t)(val << (64 - bits)) >> (64 - bits));
+}
+
+static inline uint8_t decode_packed_uint8(const unsigned char *buf) {
+    return(decode_packed(buf, 8));
+}
+
+static inline uint16_t decode_packed_uint16(const unsigned char *buf) {
+    return(decode_packed(buf, 16));
+}
+
+static inline int16_t decode_packed_int16(const unsigned char *buf) {
+    return((int16_t)decode_packed(buf, 16));
+}
+
+static inline uint32_t decode_packed_uint32(const unsigned char *buf) {
+    return(decode_packed(buf, 32));
+}
+
+static inline int32_t decode_packed_int32(const unsigned char *buf) {
+    return((int32_t)decode_packed(buf, 32));
+}
+
+static inline uint64_t decode_packed_uint64(const unsigned char *buf) {
+    return(decode_packed(buf, 64));
+}
+
+static inline int64_t decode_packed_int64(const unsigned char *buf) {
+    return((int64_t)decode_packed(buf, 64));
+}
+
+static inline void encode_packed_uint8(uint8_t val, unsigned char *buf) {
+    encode_packed(val, buf, 8);
+}
+
+static inline void encode_packed_uint16(uint16_t val, unsigned char *buf) {
+    encode_packed(val, buf, 16);
+}
+
+static inline void encode_packed_int16(int16_t val, unsigned char *buf) {
+    encode_packed((uint16_t)val, buf, 16);
+}
+
+static inline void encode_packed_uint32(uint32_t val, unsigned char *buf) {
+    encode_packed(val, buf, 32);
+}
+
+static inline void encode_packed_int32(int32_t val, unsigned char *buf) {
+    encode_packed((uint32_t)val, buf, 32);
+}
+
+static inline void encode_packed_uint64(uint64_t val, unsigned char *buf) {
+    encode_packed(val, buf, 64);
+}
+
+static inline void encode_packed_int64(int64_t val, unsigned char *buf) {
+    encode_packed((uint64_t)val, buf, 64);
+}
+
+#endif
@@ -0,0 +1,270 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "terminal.h"
+#include "profile.h"
+
+static int profile_config_saved(JsInfo *js, JsConfig *config) {
+    JsConfigMeta *meta;
+    const char *category;
+
+    if(!config->validValue || !js_config_get_type_is_numeric(config->Typ)) {
+        return(0);
+    }
+
+    meta = js_config_meta(js, config);
+    if(meta->F & PROFILE_SKIP_FLAGS) {
+        return(0);
+    }
+    category = js_category_name(js, meta->Cat);
+    if(category != NULL && strcmp(category, PROFILE_SKIP_CATEGORY) == 0) {
+        return(0);
+    }
+
+    return(1);
+}
+
+/* write every value which has been read and is part of the guitar's setup.
+ * returns the number of values written or -1 on failure */
+int profile_save(JsInfo *js, const char *path) {
+    FILE *out;
+    char *temp;
+    size_t len;
+    unsigned int i;
+    unsigned int count = 0;
+    JsConfig *config;
+
+    /* write to a temporary name then rename so a half written profile is
+     * never applied */
+    len = strlen(path) + 5;
+    temp = malloc(len);
+    if(temp == NULL) {
+        term_print("Failed to allocate memory!");
+        return(-1);
+    }
+    snprintf(temp, len, "%s.tmp", path);
+
+    out = fopen(temp, "w");
+    if(out == NULL) {
+        term_print("Failed to open %s for writing.", temp);
+        goto error;
+    }
+
+    fprintf(out, "# jamstikctl profile\n");
+    for(i = 0; i < js->config_count; i++) {
+        config = &(js->config[i]);
+        if(!profile_config_saved(js, config)) {
+            continue;
+        }
+
+        if(js_config_get_type_is_signed(config->Typ)) {
+            fprintf(out, "%.8s %ld\n", config->CC.name, config->val.sint);
+        } else {
+            fprintf(out, "%.8s %lu\n", config->CC.name, config->val.uint);
+        }
+        count++;
+    }
+
+    if(fclose(out) != 0) {
+        term_print("Failed to write profile %s.", temp);
+        goto error_unlink;
+    }
+    if(rename(temp, path) < 0) {
+        term_print("Failed to rename %s to %s.", temp, path);
+        goto error_unlink;
+    }
+
+    free(temp);
+    return(count);
+
+error_unlink:
+    unlink(temp);
+error:
+    free(temp);
+    return(-1);
+}
+
+static int profile_add(Profile *p, const char *name, int neg,
+                       unsigned long long int value) {
+    ProfileEntry *temp;
+    unsigned int i;
+
+    /* a name given again replaces what was there */
+    for(i = 0; i < p->count; i++) {
+        if(memcmp(p->entry[i].CC.name, name, JS_CONFIG_NAME_LEN) == 0) {
+            break;
+        }
+    }
+
+    if(i == p->alloc) {
+        temp = realloc(p->entry, sizeof(ProfileEntry) * (p->alloc == 0 ? 64 : p->alloc * 2));
+        if(temp == NULL) {
+            term_print("Failed to allocate memory!");
+            return(-1);
+        }
+        p->entry = temp;
+        p->alloc = p->alloc == 0 ? 64 : p->alloc * 2;
+    }
+    if(i == p->count) {
+        p->count++;
+    }
+
+    memcpy(p->entry[i].CC.name, name, JS_CONFIG_NAME_LEN);
+    p->entry[i].neg = neg;
+    p->entry[i].value = value;
+
+    return(0);
+}
+
+Profile *profile_load(const char *path) {
+    FILE *in;
+    Profile *p;
+    char line[PROFILE_MAX_LINE];
+    char *pos;
+    char *name;
+    char *end;
+    unsigned int lineno = 0;
+    int neg;
+    unsigned long long int value;
+
+    in = fopen(path, "r");
+    if(in == NULL) {
+        term_print("Failed to open profile %s.", path);
+        return(NULL);
+    }
+
+    p = malloc(sizeof(Profile));
+    if(p == NULL) {
+        term_print("Failed to allocate memory!");
+        goto error_close;
+    }
+    p->count = 0;
+    p->alloc = 0;
+    p->entry = NULL;
+
+    while(fgets(line, sizeof(line), in) != NULL) {
+        lineno++;
+
+        pos = line;
+        while(isspace(*pos)) {
+            pos++;
+        }
+        if(*pos == '\0' || *pos == '#') {
+            continue;
+        }
+
+        name = pos;
+        while(*pos != '\0' && !isspace(*pos)) {
+            pos++;
+        }
+        if(pos - name != JS_CONFIG_NAME_LEN) {
+            term_print("%s:%u: Names must be %d characters.",
+                       path, lineno, JS_CONFIG_NAME_LEN);
+            goto error_free;
+        }
+        while(isspace(*pos)) {
+            pos++;
+        }
+
+        neg = 1;
+        if(*pos == '-') {
+            neg = -1;
+            pos++;
+        }
+        if(!isdigit(*pos)) {
+            term_print("%s:%u: Expected a number.", path, lineno);
+            goto error_free;
+        }
+        errno = 0;
+        value = strtoull(pos, &end, 10);
+        if(errno != 0) {
+            term_print("%s:%u: Value is too big.", path, lineno);
+            goto error_free;
+        }
+        while(isspace(*end)) {
+            end++;
+        }
+        if(*end != '\0') {
+            term_print("%s:%u: Unexpected text after value.", path, lineno);
+            goto error_free;
+        }
+
+        if(profile_add(p, name, neg, value) < 0) {
+            goto error_free;
+        }
+    }
+    if(ferror(in)) {
+        term_print("Failed to read profile %s.", path);
+        goto error_free;
+    }
+
+    fclose(in);
+    return(p);
+
+error_free:
+    profile_free(p);
+error_close:
+    fclose(in);
+    return(NULL);
+}
+
+void profile_free(Profile *p) {
+    free(p->entry);
+    free(p);
+}
+
+/* compare a profile's value to the one last read from or acked by the
+ * guitar, a value which hasn't been read can't be known to be the same.
+ * returns 1 if it needs to be sent, 0 if not and -1 if it can't be */
+int profile_entry_changed(JsInfo *js, ProfileEntry *entry) {
+    JsConfig *config;
+
+    config = js_config_find(js, entry->CC.name);
+    if(config == NULL) {
+        term_print("%.8s isn't in this guitar's schema, skipping it.", entry->CC.name);
+        return(-1);
+    }
+    if(!js_config_get_type_is_numeric(config->Typ)) {
+        term_print("%.8s isn't numeric, skipping it.", entry->CC.name);
+        return(-1);
+    }
+    if(!js_config_get_type_is_signed(config->Typ) &&
+       entry->neg < 0 && entry->value != 0) {
+        term_print("%.8s can't be negative, skipping it.", entry->CC.name);
+        return(-1);
+    }
+
+    if(!config->validValue) {
+        return(1);
+    }
+
+    if(js_config_get_type_is_signed(config->Typ)) {
+        return(entry->value > INT64_MAX ||
+               config->val.sint != (int64_t)entry->value * entry->neg);
+    }
+
+    return(config->val.uint != entry->value);
+}
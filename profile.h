@@ -0,0 +1,53 @@
+/*
+ * Copyright 2023 paulguy <paulguy119@gmail.com>
+ *
+ * This file is part of jamstikctl.
+ *
+ * jamstikctl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * jamstikctl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with jamstikctl.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include "json_schema.h"
+
+/* a profile is a text file of config values, one "NAME value" per line,
+ * blank lines and lines starting with # are ignored */
+
+#define PROFILE_MAX_LINE (64)
+
+/* values which are about the guitar itself rather than how it's set up
+ * aren't saved */
+#define PROFILE_SKIP_CATEGORY "__SYSTEM"
+#define PROFILE_SKIP_FLAGS (SF_ENGINEERING | SF_CRITICAL | SF_NEVERSHOW)
+
+/* same as number entry, value is the magnitude and neg is 1 or -1 */
+typedef struct {
+    JsName CC;
+    int neg;
+    unsigned long long int value;
+} ProfileEntry;
+
+typedef struct {
+    unsigned int count;
+    unsigned int alloc;
+    ProfileEntry *entry;
+} Profile;
+
+int profile_save(JsInfo *js, const char *path);
+Profile *profile_load(const char *path);
+void profile_free(Profile *p);
+int profile_entry_changed(JsInfo *js, ProfileEntry *entry);
+
+#endif
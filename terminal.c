@@ -23,6 +23,7 @@
 #include <string.h>
 #include <curses.h>
 #include <wchar.h>
+#include <pthread.h>
 
 typedef struct {
     WINDOW *main_term;
@@ -30,6 +31,9 @@ typedef struct {
     WINDOW *status_term;
 
     int lastlines;
+
+    /* curses isn't thread safe and messages may come from other threads */
+    pthread_mutex_t lock;
 } terminal_ctx_t;
 
 terminal_ctx_t termctx;
@@ -161,6 +165,7 @@ char *term_get_string_and_lines(int *lines, int *len,
 }
 
 void term_cleanup() {
+    pthread_mutex_lock(&(termctx.lock));
     if(termctx.main_term != NULL) {
         termctx.main_term = NULL;
         delwin(termctx.status_term);
@@ -169,11 +174,16 @@ void term_cleanup() {
         termctx.notes_term = NULL;
         endwin();
     }
+    pthread_mutex_unlock(&(termctx.lock));
 }
 
 int term_setup(int only_print) {
     termctx.main_term = NULL;
 
+    if(pthread_mutex_init(&(termctx.lock), NULL) != 0) {
+        return(-1);
+    }
+
     if(!only_print) {
         termctx.main_term = initscr();
         if(termctx.main_term == NULL) {
@@ -219,8 +229,10 @@ int term_print_mode() {
 int term_getkey() {
     int key;
 
+    pthread_mutex_lock(&(termctx.lock));
     key = getch();
-    
+    pthread_mutex_unlock(&(termctx.lock));
+
     if(key == ERR) {
         return(-1);
     }
@@ -235,10 +247,12 @@ int term_print(const char *f, ...) {
     char *str;
 
     if(term_print_mode()) {
+        pthread_mutex_lock(&(termctx.lock));
         va_start(ap, f);
         n = vfprintf(stdout, f, ap);
         va_end(ap);
         fputc('\n', stdout);
+        pthread_mutex_unlock(&(termctx.lock));
     } else {
         /* push messages from the bottom */
         va_start(ap, f);
@@ -249,12 +263,14 @@ int term_print(const char *f, ...) {
             return(-1);
         }
 
+        pthread_mutex_lock(&(termctx.lock));
         wscrl(termctx.status_term, strlines);
         mvwaddnstr(termctx.status_term, LINES-termctx.lastlines-strlines, 0,
                    str, n);
         free(str);
 
         wrefresh(termctx.status_term);
+        pthread_mutex_unlock(&(termctx.lock));
     }
 
     return(n);
@@ -267,10 +283,12 @@ int term_print_static(const char *f, ...) {
     int strlines;
 
     if(term_print_mode()) {
+        pthread_mutex_lock(&(termctx.lock));
         va_start(ap, f);
         n = vfprintf(stdout, f, ap);
         va_end(ap);
         fputc('\n', stdout);
+        pthread_mutex_unlock(&(termctx.lock));
     } else {
         va_start(ap, f);
         str = term_get_string_and_lines(&strlines, &n, f, ap);
@@ -280,6 +298,7 @@ int term_print_static(const char *f, ...) {
             return(-1);
         }
 
+        pthread_mutex_lock(&(termctx.lock));
         if(strlines != termctx.lastlines) {
             if(strlines > termctx.lastlines) {
                 wscrl(termctx.status_term, strlines - termctx.lastlines);
@@ -294,13 +313,71 @@ int term_print_static(const char *f, ...) {
 
             termctx.lastlines = strlines;
         }
-        wclear(termctx.notes_term);
+        /* not wclear(), that makes the next refresh repaint every cell
+         * instead of only the ones which changed */
+        werase(termctx.notes_term);
 
         mvwaddnstr(termctx.notes_term, 0, 0, str, n);
         free(str);
 
         wrefresh(termctx.notes_term);
+        pthread_mutex_unlock(&(termctx.lock));
+    }
+
+    return(n);
+}
+
+/* replace a single line of what term_print_static() put up, leaving the rest
+ * alone.  It's only put on screen by the next term_update().
+ * returns -1 if there's no such line or the text would wrap, the whole thing
+ * has to go through term_print_static() then */
+int term_print_static_line(int line, const char *f, ...) {
+    int n;
+    va_list ap;
+    char *str;
+    int strlines;
+
+    if(term_print_mode()) {
+        pthread_mutex_lock(&(termctx.lock));
+        va_start(ap, f);
+        n = vfprintf(stdout, f, ap);
+        va_end(ap);
+        fputc('\n', stdout);
+        pthread_mutex_unlock(&(termctx.lock));
+    } else {
+        va_start(ap, f);
+        str = term_get_string_and_lines(&strlines, &n, f, ap);
+        va_end(ap);
+
+        if(str == NULL) {
+            return(-1);
+        }
+
+        pthread_mutex_lock(&(termctx.lock));
+        if(strlines != 1 || line < 0 || line >= termctx.lastlines) {
+            pthread_mutex_unlock(&(termctx.lock));
+            free(str);
+            return(-1);
+        }
+
+        mvwaddnstr(termctx.notes_term, line, 0, str, n);
+        wclrtoeol(termctx.notes_term);
+        free(str);
+
+        wnoutrefresh(termctx.notes_term);
+        pthread_mutex_unlock(&(termctx.lock));
     }
 
     return(n);
 }
+
+/* put everything from term_print_static_line() on screen at once */
+void term_update() {
+    if(term_print_mode()) {
+        return;
+    }
+
+    pthread_mutex_lock(&(termctx.lock));
+    doupdate();
+    pthread_mutex_unlock(&(termctx.lock));
+}
@@ -22,5 +22,8 @@ int term_setup(int only_print);
 int term_print_mode();
 int term_getkey();
 int term_check_size();
+int term_count_lines(int textwidth, int n, const char *str);
 int term_print_static(const char *f, ...);
+int term_print_static_line(int line, const char *f, ...);
+void term_update();
 int term_print(const char *f, ...);